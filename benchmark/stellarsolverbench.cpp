@@ -0,0 +1,417 @@
+/*  stellarsolver-bench, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//This program times star extraction and plate solving with each of the built in profiles
+//on a corpus of images and synthetic star fields, and reports the results as JSON.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_OSX)
+#include <mach/mach.h>
+#endif
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "pixelkernels.h"
+#include "testerutils/fileio.h"
+#include "testerutils/syntheticstarfield.h"
+
+static const double PI = 3.14159265358979323846;
+
+// This struct contains one image of the corpus
+struct BenchImage
+{
+    QString name;                       // The file name, or a name for the synthetic field
+    FITSImage::Statistic stats;
+    QVector<uint8_t> buffer;            // A copy of the image buffer so the loader can be reused
+    bool positionGiven = false;
+    double ra = 0, dec = 0;
+    bool scaleGiven = false;
+    double scaleLow = 0, scaleHigh = 0;
+    SSolver::ScaleUnits scaleUnits = SSolver::DEG_WIDTH;
+    bool hasTruth = false;              // Whether the true solution is known, as it is for the synthetic fields
+    FITSImage::Solution truth;
+};
+
+// This struct contains the measurements of one run
+struct BenchSample
+{
+    double wallMs;
+    double cpuMs;
+    int stars;
+    bool success;
+    qint64 rssDeltaKB;                  // How much more resident memory the process used after the run than before it
+    double errorArcsec;                 // The distance of the solved center from the true center, -1 if not known
+};
+
+//This gets the CPU time used by all the threads of the process so far
+static double processCPUTimeMs()
+{
+#if defined(Q_OS_WIN)
+    FILETIME creation, exit, kernel, user;
+    if(!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    auto toMs = [](const FILETIME & time)
+    {
+        return ((quint64(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 10000.0;
+    };
+    return toMs(kernel) + toMs(user);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0
+           + usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+#endif
+}
+
+//This gets the resident memory the process is using right now in KB
+static qint64 currentRSSKB()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize / 1024;
+#elif defined(Q_OS_OSX)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return info.resident_size / 1024;
+#else
+    //The second number in statm is the number of resident pages
+    QFile statm("/proc/self/statm");
+    if(!statm.open(QIODevice::ReadOnly))
+        return 0;
+    QList<QByteArray> pages = statm.readAll().split(' ');
+    if(pages.count() < 2)
+        return 0;
+    return pages.at(1).toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+//This gets a percentile of the samples with the nearest rank method
+static double percentile(QVector<double> values, double p)
+{
+    if(values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    int rank = qBound(1, (int)std::ceil(p / 100.0 * values.count()), values.count());
+    return values.at(rank - 1);
+}
+
+static QJsonObject percentiles(const QVector<double> &values)
+{
+    QJsonObject object;
+    object["p50"] = percentile(values, 50);
+    object["p95"] = percentile(values, 95);
+    object["p99"] = percentile(values, 99);
+    return object;
+}
+
+//This renders a synthetic star field from an index file, so the true solution is known
+static bool syntheticField(const QString &indexFile, int number, quint32 seed, int width, int height, BenchImage &image)
+{
+    SyntheticStarField field;
+    SyntheticStarField::Settings settings;
+    settings.width = width;
+    settings.height = height;
+    if(!SyntheticStarField::fieldForIndex(indexFile, seed + number, settings) || !field.render(indexFile, settings))
+        return false;
+
+    image.name = QString("synthetic-%1").arg(number);
+    image.stats = field.getStats();
+    image.buffer.resize(image.stats.size);
+    memcpy(image.buffer.data(), field.getImageBuffer(), image.buffer.size());
+    image.hasTruth = true;
+    image.truth = field.getSolution();
+    return true;
+}
+
+static bool loadImage(const QString &fileName, BenchImage &image)
+{
+    fileio imageLoader;
+    imageLoader.logToSignal = false;
+    if(!imageLoader.loadImage(fileName))
+        return false;
+    image.name = QFileInfo(fileName).fileName();
+    image.stats = imageLoader.getStats();
+    image.buffer.resize(image.stats.samples_per_channel * image.stats.channels * image.stats.bytesPerPixel);
+    memcpy(image.buffer.data(), imageLoader.getImageBuffer(), image.buffer.size());
+    image.positionGiven = imageLoader.position_given;
+    image.ra = imageLoader.ra;
+    image.dec = imageLoader.dec;
+    image.scaleGiven = imageLoader.scale_given;
+    image.scaleLow = imageLoader.scale_low;
+    image.scaleHigh = imageLoader.scale_high;
+    image.scaleUnits = imageLoader.scale_units;
+    return true;
+}
+
+static BenchSample runOnce(const BenchImage &image, const SSolver::Parameters &profile, const QStringList &indexFolders, bool solve)
+{
+    qint64 rssStart = currentRSSKB();
+    StellarSolver stellarSolver(image.stats, image.buffer.constData());
+    stellarSolver.setParameters(profile);
+    stellarSolver.setIndexFolderPaths(indexFolders);
+    if(image.positionGiven)
+        stellarSolver.setSearchPositionRaDec(image.ra, image.dec);
+    if(image.scaleGiven)
+        stellarSolver.setSearchScale(image.scaleLow, image.scaleHigh, image.scaleUnits);
+
+    BenchSample sample;
+    QElapsedTimer timer;
+    double cpuStart = processCPUTimeMs();
+    timer.start();
+    sample.success = solve ? stellarSolver.solve() : stellarSolver.extract();
+    sample.wallMs = timer.nsecsElapsed() / 1000000.0;
+    sample.cpuMs = processCPUTimeMs() - cpuStart;
+    //This is measured while the solver still holds its stars and buffers
+    sample.rssDeltaKB = currentRSSKB() - rssStart;
+    sample.stars = stellarSolver.getNumStarsFound();
+    sample.errorArcsec = -1;
+    if(solve && sample.success && image.hasTruth)
+    {
+        const FITSImage::Solution &solution = stellarSolver.getSolution();
+        double ra1 = image.truth.ra * PI / 180.0, dec1 = image.truth.dec * PI / 180.0;
+        double ra2 = solution.ra * PI / 180.0, dec2 = solution.dec * PI / 180.0;
+        double cosDistance = sin(dec1) * sin(dec2) + cos(dec1) * cos(dec2) * cos(ra1 - ra2);
+        sample.errorArcsec = acos(qBound(-1.0, cosDistance, 1.0)) * 180.0 / PI * 3600.0;
+    }
+    return sample;
+}
+
+static QJsonObject runCase(const BenchImage &image, const SSolver::Parameters &profile, const QStringList &indexFolders, bool solve, int runs)
+{
+    QVector<double> wall, cpu, errors;
+    int successes = 0, stars = 0;
+    qint64 rssDeltaKB = 0;
+    for(int i = 0; i < runs; i++)
+    {
+        BenchSample sample = runOnce(image, profile, indexFolders, solve);
+        wall.append(sample.wallMs);
+        cpu.append(sample.cpuMs);
+        stars = sample.stars;
+        rssDeltaKB = qMax(rssDeltaKB, sample.rssDeltaKB);
+        if(sample.success)
+            successes++;
+        if(sample.errorArcsec >= 0)
+            errors.append(sample.errorArcsec);
+    }
+
+    QJsonObject result;
+    result["image"] = image.name;
+    result["profile"] = profile.listName;
+    result["operation"] = solve ? "solve" : "extract";
+    result["runs"] = runs;
+    result["wallMs"] = percentiles(wall);
+    result["cpuMs"] = percentiles(cpu);
+    //The largest growth of the resident memory in one run of this case, which includes index files it was the first to load
+    result["rssDeltaKB"] = rssDeltaKB;
+    result["starsFound"] = stars;
+    result["successes"] = successes;
+    result["successRate"] = runs > 0 ? (double)successes / runs : 0.0;
+    if(!errors.isEmpty())
+        result["centerErrorArcsec"] = percentiles(errors);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("stellarsolver-bench");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times star extraction and plate solving with the built in profiles and reports the results as JSON.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("images", "Image files to use, randomsky.fits and pleiades.jpg by default.", "[images...]");
+    QCommandLineOption indexOption("index-folder", "A folder with index files, astrometry by default.  Can be repeated.", "folder");
+    QCommandLineOption runsOption("runs", "How many times each image is extracted and solved with each profile.", "count", "5");
+    QCommandLineOption syntheticOption("synthetic", "How many synthetic star fields to add to the corpus.", "count", "2");
+    QCommandLineOption syntheticIndexOption("synthetic-index", "The index file the synthetic star fields are made from, the first one in the index folders by default.", "file");
+    QCommandLineOption seedOption("seed", "The seed for the synthetic star fields.", "seed", "1");
+    QCommandLineOption sizeOption("synthetic-size", "The width and height of the synthetic star fields.", "WxH", "1024x768");
+    QCommandLineOption profileOption("profile", "Only use the built in profile with this name.  Can be repeated.", "name");
+    QCommandLineOption noSolveOption("no-solve", "Only time star extraction.");
+    QCommandLineOption threadsOption("threads", "Also time star extraction with both partition algorithms and each of these numbers of threads, for example 1,2,4,8,16,32,64.", "counts");
+    QCommandLineOption outputOption("output", "Write the JSON to this file instead of the standard output.", "file");
+    parser.addOptions({indexOption, runsOption, syntheticOption, syntheticIndexOption, seedOption, sizeOption, profileOption, noSolveOption, threadsOption, outputOption});
+    parser.process(app);
+
+    QStringList indexFolders = parser.values(indexOption);
+    if(indexFolders.isEmpty())
+        indexFolders << "astrometry";
+    int runs = qMax(1, parser.value(runsOption).toInt());
+    QStringList size = parser.value(sizeOption).split('x');
+    int width = size.count() == 2 ? size.at(0).toInt() : 0;
+    int height = size.count() == 2 ? size.at(1).toInt() : 0;
+    if(width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Invalid synthetic field size: %s\n", parser.value(sizeOption).toUtf8().constData());
+        return 1;
+    }
+    QList<int> threadCounts;
+    if(parser.isSet(threadsOption))
+    {
+        for(auto &count : parser.value(threadsOption).split(','))
+        {
+            if(count.toInt() <= 0)
+            {
+                fprintf(stderr, "Invalid number of threads: %s\n", count.toUtf8().constData());
+                return 1;
+            }
+            threadCounts.append(count.toInt());
+        }
+    }
+
+    QList<BenchImage> corpus;
+    QStringList imageFiles = parser.positionalArguments();
+    if(imageFiles.isEmpty())
+    {
+        for(auto &defaultFile : QStringList() << "randomsky.fits" << "pleiades.jpg")
+        {
+            if(QFileInfo::exists(defaultFile))
+                imageFiles << defaultFile;
+        }
+    }
+    for(auto &imageFile : imageFiles)
+    {
+        BenchImage image;
+        if(!loadImage(imageFile, image))
+        {
+            fprintf(stderr, "Error in loading image file %s\n", imageFile.toUtf8().constData());
+            return 1;
+        }
+        corpus.append(image);
+    }
+    quint32 seed = parser.value(seedOption).toUInt();
+    int syntheticCount = parser.value(syntheticOption).toInt();
+    if(syntheticCount > 0)
+    {
+        QString indexFile = parser.value(syntheticIndexOption);
+        if(indexFile.isEmpty())
+        {
+            QStringList indexFiles = StellarSolver::getIndexFiles(indexFolders);
+            if(!indexFiles.isEmpty())
+                indexFile = indexFiles.first();
+        }
+        for(int i = 0; i < syntheticCount; i++)
+        {
+            BenchImage image;
+            if(indexFile.isEmpty() || !syntheticField(indexFile, i, seed, width, height, image))
+            {
+                fprintf(stderr, "Unable to make synthetic star fields from index file %s\n", indexFile.toUtf8().constData());
+                return 1;
+            }
+            corpus.append(image);
+        }
+    }
+
+    QList<SSolver::Parameters> profiles;
+    for(auto &profile : StellarSolver::getBuiltInProfiles())
+    {
+        if(parser.values(profileOption).isEmpty() || parser.values(profileOption).contains(profile.listName))
+            profiles.append(profile);
+    }
+
+    QJsonArray results;
+    for(auto &image : corpus)
+    {
+        for(auto &profile : profiles)
+        {
+            fprintf(stderr, "Timing %s with %s. . .\n", image.name.toUtf8().constData(), profile.listName.toUtf8().constData());
+            results.append(runCase(image, profile, indexFolders, false, runs));
+            if(!parser.isSet(noSolveOption))
+                results.append(runCase(image, profile, indexFolders, true, runs));
+        }
+    }
+
+    //The partitions are extracted in QtConcurrent's global pool, so its size sets the number of threads
+    QJsonArray scaling;
+    const int defaultThreads = QThreadPool::globalInstance()->maxThreadCount();
+    for(auto &image : corpus)
+    {
+        for(auto &profile : profiles)
+        {
+            for(auto algorithm : {SSolver::PARTITION_GRID, SSolver::PARTITION_ADAPTIVE})
+            {
+                SSolver::Parameters partitionProfile = profile;
+                partitionProfile.partitionAlgorithm = algorithm;
+                double firstWallMs = 0;
+                for(int threads : threadCounts)
+                {
+                    fprintf(stderr, "Timing %s with %s, %s partitions and %d threads. . .\n", image.name.toUtf8().constData(),
+                            profile.listName.toUtf8().constData(), SSolver::getPartitionAlgoString(algorithm).toUtf8().constData(), threads);
+                    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+                    QJsonObject result = runCase(image, partitionProfile, indexFolders, false, runs);
+                    double wallMs = result["wallMs"].toObject()["p50"].toDouble();
+                    if(firstWallMs == 0)
+                        firstWallMs = wallMs;
+                    result["partitionAlgorithm"] = SSolver::getPartitionAlgoString(algorithm);
+                    result["threads"] = threads;
+                    result["speedup"] = wallMs > 0 ? firstWallMs / wallMs : 0.0;
+                    scaling.append(result);
+                }
+            }
+        }
+    }
+    QThreadPool::globalInstance()->setMaxThreadCount(defaultThreads);
+
+    QJsonObject report;
+    report["version"] = StellarSolver::getVersionNumber();
+    report["simd"] = QString(PixelKernels::simdLevel());
+    report["runs"] = runs;
+    report["seed"] = (qint64)seed;
+    report["indexFolders"] = QJsonArray::fromStringList(indexFolders);
+    report["results"] = results;
+    if(!threadCounts.isEmpty())
+        report["scaling"] = scaling;
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly))
+        {
+            fprintf(stderr, "Unable to write %s\n", file.fileName().toUtf8().constData());
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
@@ -66,5 +66,45 @@ int main(int argc, char *argv[])
     printf("Field parity: %s\n\n", FITSImage::getParityText(solution.parity).toUtf8().data());
 
 
+    //Both images can also be solved at the same time as a batch, sharing the loaded index files.
+    //Each one needs its own loader here, since the image buffers have to stay valid until they are solved.
+    fileio pleiadesLoader, randomskyLoader;
+    pleiadesLoader.logToSignal = false;
+    randomskyLoader.logToSignal = false;
+    if(!pleiadesLoader.loadImage("pleiades.jpg") || !randomskyLoader.loadImage("randomsky.fits"))
+    {
+        printf("Error in loading FITS file");
+        exit(1);
+    }
+
+    QList<SolveJob> jobs;
+    SolveJob pleiadesJob;
+    pleiadesJob.id = 1;
+    pleiadesJob.statistics = pleiadesLoader.getStats();
+    pleiadesJob.imageBuffer = pleiadesLoader.getImageBuffer();
+    jobs.append(pleiadesJob);
+    SolveJob randomskyJob;
+    randomskyJob.id = 2;
+    randomskyJob.statistics = randomskyLoader.getStats();
+    randomskyJob.imageBuffer = randomskyLoader.getImageBuffer();
+    jobs.append(randomskyJob);
+
+    printf("Starting to blindly solve pleiades.jpg and randomsky.fits as a batch. . .\n");
+    fflush( stdout );
+    QList<QFuture<SolveResult>> results = stellarSolver.solveBatch(jobs);
+    for(auto &future : results)
+    {
+        SolveResult result = future.result();
+        printf("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n");
+        if(!result.solved)
+        {
+            printf("Job %d: Solver Failed\n\n", result.id);
+            continue;
+        }
+        printf("Job %d: Field center: (RA,Dec) = (%f, %f) deg.\n", result.id, result.solution.ra, result.solution.dec);
+        printf("Job %d: Pixel Scale: %f\"\n\n", result.id, result.solution.pixscale);
+    }
+
+
     return 0;
 }
@@ -0,0 +1,221 @@
+/*  stellarsolver-index-compiler, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//This program converts astrometry.net index files to packed index files, which the internal solver
+//maps into memory as a whole and uses in place, without reading any FITS headers.
+//A folder with both keeps using the packed one, so the FITS files can stay where they are.
+//If a FITS file changes after its packed one was made, the FITS file is used until it is converted again.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+
+//Includes for this project
+#include "stellarsolver.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+#include "astrometry/kdtree.h"
+#include "astrometry/quadfile.h"
+#include "astrometry/starkd.h"
+#include "astrometry/codekd.h"
+}
+
+//The packed index files are written in this folder inside the output folder and then moved out of it.
+//Solvers only look at the files in an index folder, not in the folders inside it, so they never see half a file.
+static const char *PARTIAL_FOLDER = ".stellarsolver-index-compiler";
+
+//This adds an array to the hash, in pieces since QCryptographicHash takes the size as an int
+static void hashArray(QCryptographicHash &hash, const void *data, size_t size)
+{
+    if(!data)
+        return;
+    const char *bytes = (const char *)data;
+    while(size > 0)
+    {
+        int piece = (int)qMin(size, (size_t)(1 << 30));
+        hash.addData(bytes, piece);
+        bytes += piece;
+        size -= piece;
+    }
+}
+
+//This hashes the arrays of a kd-tree, leaving out the bounding boxes, splits and points if the tree was made smaller
+static void hashTree(QCryptographicHash &hash, const kdtree_t *kd, bool nodesAndData)
+{
+    hash.addData((const char *)&kd->ndata, sizeof(kd->ndata));
+    hash.addData((const char *)&kd->nnodes, sizeof(kd->nnodes));
+    hashArray(hash, kd->lr, kdtree_sizeof_lr(kd));
+    hashArray(hash, kd->perm, kdtree_sizeof_perm(kd));
+    if(!nodesAndData)
+        return;
+    if(kd->bb.any && kd->nnodes > 0)
+        hashArray(hash, kd->bb.any, kdtree_sizeof_bb(kd) / kd->nnodes * 2 * kd->n_bb);
+    hashArray(hash, kd->split.any, kdtree_sizeof_split(kd));
+    hashArray(hash, kd->splitdim, kdtree_sizeof_splitdim(kd));
+    hashArray(hash, kd->data.any, kdtree_sizeof_data(kd));
+}
+
+//This hashes the quads and the kd-trees of a loaded index.  With 16 bit stars, only the order of the stars is compared.
+static QByteArray indexChecksum(const index_t *index, bool u16Stars)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hashArray(hash, index->quads->quadarray, sizeof(uint32_t) * index->quads->numquads * index->quads->dimquads);
+    hashTree(hash, index->codekd->tree, true);
+    hashTree(hash, index->starkd->tree, !u16Stars);
+    hashArray(hash, index->starkd->sweep, index->starkd->sweep ? sizeof(uint8_t) * index->starkd->tree->ndata : 0);
+    return hash.result();
+}
+
+//This loads an index with its kd-trees and reads them in, returning the time it took
+static double timeLoad(const QString &path, index_t **index)
+{
+    QElapsedTimer timer;
+    timer.start();
+    *index = index_load(path.toUtf8().constData(), 0, NULL);
+    if(*index)
+        index_prefetch(*index, TRUE);
+    return timer.nsecsElapsed() / 1e6;
+}
+
+//This converts one index file, returning false if it failed
+static bool compile(const QString &path, const QString &outputFolder, bool u16Stars, bool force)
+{
+    QFileInfo info(path);
+    QString folder = outputFolder.isEmpty() ? info.absolutePath() : outputFolder;
+    QString output = QDir(folder).absoluteFilePath(info.completeBaseName() + INDEX_PACKED_SUFFIX);
+
+    if(!force && QFileInfo::exists(output) && QFileInfo(output).lastModified() >= info.lastModified())
+    {
+        printf("%s is up to date\n", output.toUtf8().constData());
+        return true;
+    }
+
+    index_t *index = nullptr;
+    double fitsMs = timeLoad(path, &index);
+    if(!index)
+    {
+        fprintf(stderr, "Error in loading index file %s\n", path.toUtf8().constData());
+        return false;
+    }
+
+    //It is written where solvers don't look, and checked before it is moved next to the other index files
+    QDir partialDir(QDir(folder).absoluteFilePath(PARTIAL_FOLDER));
+    QString partial = partialDir.absoluteFilePath(info.completeBaseName() + INDEX_PACKED_SUFFIX);
+    bool ok = partialDir.mkpath(".") &&
+              index_write_packed(index, partial.toUtf8().constData(), u16Stars ? INDEX_PACKED_U16_STARS : 0) == 0;
+    int nquads = index->nquads;
+    int nstars = index->nstars;
+    QByteArray checksum = indexChecksum(index, u16Stars);
+    index_free(index);
+    if(!ok)
+    {
+        QFile::remove(partial);
+        QDir(folder).rmdir(PARTIAL_FOLDER);
+        fprintf(stderr, "Error in writing packed index file %s\n", output.toUtf8().constData());
+        return false;
+    }
+
+    //The packed index is loaded back to check that it has the same quads and kd-trees
+    index_t *packed = nullptr;
+    double packedMs = timeLoad(partial, &packed);
+    ok = packed && packed->nquads == nquads && packed->nstars == nstars && indexChecksum(packed, u16Stars) == checksum;
+    if(packed)
+        index_free(packed);
+    if(!ok)
+    {
+        QFile::remove(partial);
+        QDir(folder).rmdir(PARTIAL_FOLDER);
+        fprintf(stderr, "The packed index file %s does not match %s\n", output.toUtf8().constData(), path.toUtf8().constData());
+        return false;
+    }
+
+    QFile::remove(output);
+    ok = QFile::rename(partial, output);
+    if(!ok)
+        QFile::remove(partial);
+    //Another compiler may still be writing to the folder, then it is left for that one to remove
+    QDir(folder).rmdir(PARTIAL_FOLDER);
+    if(!ok)
+    {
+        fprintf(stderr, "Error in moving packed index file %s into place\n", output.toUtf8().constData());
+        return false;
+    }
+
+    printf("%s: %d quads, %d stars, %.1f MB -> %.1f MB, loaded in %.1f ms -> %.1f ms\n",
+           output.toUtf8().constData(), nquads, nstars,
+           info.size() / 1048576.0, QFileInfo(output).size() / 1048576.0, fitsMs, packedMs);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("stellarsolver-index-compiler");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts astrometry.net index files to packed index files for the internal solver.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("indexes", "Index files, or folders of index files, to convert.", "indexes...");
+    QCommandLineOption outputOption("output-folder", "Write the packed index files to this folder instead of next to the index files.", "folder");
+    QCommandLineOption u16Option("u16-stars", "Store the star positions in 16 bits instead of 32.  The precision this gives is printed, check it against the jitter of the index.");
+    QCommandLineOption forceOption("force", "Convert the index files even if their packed index files are up to date.");
+    parser.addOptions({outputOption, u16Option, forceOption});
+    parser.process(app);
+
+    QStringList indexFiles;
+    for(auto &argument : parser.positionalArguments())
+    {
+        QDir dir(argument);
+        if(QFileInfo(argument).isDir())
+        {
+            //Other FITS files in the folder are skipped
+            for(auto &fileName : dir.entryList(QStringList() << "*.fits" << "*.fit", QDir::Files))
+            {
+                if(index_is_file_index(dir.absoluteFilePath(fileName).toUtf8().constData()))
+                    indexFiles << dir.absoluteFilePath(fileName);
+            }
+        }
+        else
+            indexFiles << argument;
+    }
+    if(indexFiles.isEmpty())
+        parser.showHelp(1);
+
+    QString outputFolder = parser.value(outputOption);
+    if(!outputFolder.isEmpty() && !QDir().mkpath(outputFolder))
+    {
+        fprintf(stderr, "Error in creating the folder %s\n", outputFolder.toUtf8().constData());
+        return 1;
+    }
+
+    int failures = 0;
+    for(auto &indexFile : indexFiles)
+    {
+        const QByteArray path = indexFile.toUtf8();
+        if(index_is_packed_file(path.constData()) || !index_is_file_index(path.constData()))
+        {
+            fprintf(stderr, "%s is not a FITS index file\n", path.constData());
+            failures++;
+            continue;
+        }
+        if(!compile(indexFile, outputFolder, parser.isSet(u16Option), parser.isSet(forceOption)))
+            failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -184,8 +184,24 @@ static index_t* get_index(blind_t* bp, size_t i) {
         return ind;
     }
     i -= sl_size(bp->indexnames);
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (bp->load_index && !bp->indexes_inparallel) {
+        index_t* ind = pl_get(bp->indexes, i);
+        if (bp->load_index(ind, bp->index_userdata)) {
+            ERROR("Failed to load index %s", ind->indexname);
+            return NULL;
+        }
+        return ind;
+    }
     return pl_get(bp->indexes, i);
 }
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Returns the index without loading it, or NULL if only its file name is known.
+static index_t* peek_index(blind_t* bp, size_t i) {
+    if (i < sl_size(bp->indexnames))
+        return NULL;
+    return pl_get(bp->indexes, i - sl_size(bp->indexnames));
+}
 static char* get_index_name(blind_t* bp, size_t i) {
     index_t* index;
     if (i < sl_size(bp->indexnames)) {
@@ -200,6 +216,10 @@ static void done_with_index(blind_t* bp, size_t i, index_t* ind) {
     if (i < sl_size(bp->indexnames)) {
         index_close(ind);
     }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    else if (bp->done_with_index && !bp->indexes_inparallel) {
+        bp->done_with_index(ind, bp->index_userdata);
+    }
 }
 static size_t n_indexes(blind_t* bp) {
     return sl_size(bp->indexnames) + pl_size(bp->indexes);
@@ -420,7 +440,14 @@ void blind_run(blind_t* bp) {
                    arcsec2arcmin(quadlo), arcsec2arcmin(quadhi));
 
             for (I=0; I<Nindexes; I++) {
-                index_t* index = get_index(bp, I);
+                index_t* index = peek_index(bp, I);
+                //# Modified by Robert Lancaster for the StellarSolver Internal Library
+                // The scale range is in the metadata, so indexes that can't be used are not loaded.
+                if (index && !index_overlaps_scale_range(index, quadlo, quadhi))
+                    continue;
+                index = get_index(bp, I);
+                if (!index)
+                    continue;
                 if (!index_overlaps_scale_range(index, quadlo, quadhi)) {
                     done_with_index(bp, I, index);
                     continue;
@@ -450,7 +477,8 @@ void blind_run(blind_t* bp) {
         }
     }
 
-    if (bp->single_field_solved)
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (bp->single_field_solved || bp->verify_only)
         goto cleanup;
 
     // Start solving...
@@ -493,6 +521,9 @@ void blind_run(blind_t* bp) {
 
             // Load the index...
             index = get_index(bp, I);
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            if (!index)
+                continue;
             solver_add_index(sp, index);
             logverb("Trying index %s...\n", index->indexname);
 
@@ -565,7 +596,8 @@ int blind_parameters_are_sane(blind_t* bp, solver_t* sp) {
         logerr("You must set a \"distractors\" proportion.\n");
         return 0;
     }
-    if (!(sl_size(bp->indexnames) || (bp->indexes_inparallel && pl_size(bp->indexes)))) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (!(sl_size(bp->indexnames) || ((bp->indexes_inparallel || bp->load_index) && pl_size(bp->indexes)))) {
         logerr("You must specify one or more indexes.\n");
         return 0;
     }
@@ -212,11 +212,22 @@ int engine_add_index(engine_t* engine, char* path) {
     return 0;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, so that indexes held by the IndexCatalog can be shared
+int engine_add_loaded_index(engine_t* engine, index_t* ind) {
+    // The index is borrowed, so it is not added to free_indexes and engine_free will not free it.
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexname);
+        return -1;
+    }
+    return 0;
+}
+
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
                                int i) {
     index_t* index;
     index = pl_get(engine->indexes, i);
-    if (engine->inparallel) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (engine->inparallel || bp->load_index) {
         blind_add_loaded_index(bp, index);
     } else {
         blind_add_index(bp, index->indexname);
@@ -463,6 +474,7 @@ int engine_run_job(engine_t* engine, job_t* job) {
             double fmin, fmax;
             double app_max, app_min;
             int k;
+            int nadded;
             il* indexlist;
 
             // arcsec per pixel range
@@ -512,10 +524,14 @@ int engine_run_job(engine_t* engine, job_t* job) {
                 il_append_list(indexlist, list);
             }
 
+            nadded = 0;
             for (k=0; k<il_size(indexlist); k++) {
                 int ii = il_get(indexlist, k);
                 index_t* index = pl_get(engine->indexes, ii);
                 anbool inrange = TRUE;
+                //# Modified by Robert Lancaster for the StellarSolver Internal Library
+                if (engine->index_subset && !il_contains(engine->index_subset, ii))
+                    continue;
                 if (job->use_radec_center)
                     inrange = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
                 if (!inrange) {
@@ -524,10 +540,16 @@ int engine_run_job(engine_t* engine, job_t* job) {
                     continue;
                 }
                 add_index_to_blind(engine, bp, ii);
+                nadded++;
             }
 
             il_free(indexlist);
 
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            // nothing to search at this scale with the selected subset of indexes.
+            if (engine->index_subset && !nadded)
+                continue;
+
             logverb("Running blind solver:\n");
             blind_log_run_parameters(bp);
 
@@ -965,6 +987,8 @@ void engine_free(engine_t* engine) {
         il_free(engine->ibiggest);
     if (engine->default_depths)
         il_free(engine->default_depths);
+    if (engine->index_subset) //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        il_free(engine->index_subset);
     if (engine->index_paths)
         sl_free2(engine->index_paths);
     free(engine);
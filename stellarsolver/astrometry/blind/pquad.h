@@ -6,6 +6,8 @@
 #ifndef PQUAD_H
 #define PQUAD_H
 
+#include <stdint.h>
+
 /**
  This file is just required for testing purposes (of solver.c)
  */
@@ -19,7 +21,9 @@ struct potential_quad
 	double costheta, sintheta;
 	// (field pixel noise / quad scale in pixels)^2
 	double rel_field_noise2;
-	anbool* inbox;
+	//# Modified by Robert Lancaster for the StellarSolver Internal Library
+	// bitset: bit i is set if star i can be star C or D; carved from the solver's pquad blocks
+	uint32_t* inbox;
 	int ninbox;
 	double* xy;
 };
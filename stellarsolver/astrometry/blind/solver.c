@@ -39,15 +39,18 @@
 #include "errors.h"
 #include "tweak2.h"
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, to call the kernels for the index's dimquads
 #if TESTING_TRYALLCODES
 #define DEBUGSOLVER 1
-#define TRY_ALL_CODES test_try_all_codes
+#define TRY_ALL_CODES(pq, fieldstars, kernels, solver, tol2) \
+    test_try_all_codes(pq, fieldstars, (kernels)->dimquads, solver, tol2)
 void test_try_all_codes(pquad* pq,
                         int* fieldstars, int dimquad,
                         solver_t* solver, double tol2);
 
 #else
-#define TRY_ALL_CODES try_all_codes
+#define TRY_ALL_CODES(pq, fieldstars, kernels, solver, tol2) \
+    (kernels)->try_all_codes(pq, fieldstars, solver, tol2)
 #endif
 
 #if TESTING_TRYPERMUTATIONS
@@ -533,25 +536,24 @@ void solver_compute_quad_range(const solver_t* sp, const index_t* index,
     }
 }
 
-static void try_all_codes(const pquad* pq,
-                          const int* fieldstars, int dimquad,
-                          solver_t* solver, double tol2);
-
-static void try_all_codes_2(const int* fieldstars, int dimquad,
-                            const double* code, solver_t* solver,
-                            anbool current_parity, double tol2);
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The codes built from one field quad, searched in the code kd-tree together.
+typedef struct {
+    int n;
+    double codes[SOLVER_MAX_CODES * DCMAX];
+    int stars[SOLVER_MAX_CODES][DQMAX];
+    anbool parity[SOLVER_MAX_CODES];
+} codebatch_t;
 
-static void try_permutations(const int* origstars, int dimquad,
-                             const double* origcode,
-                             solver_t* solver, anbool current_parity,
-                             double tol2,
-                             int* stars, double* code,
-                             int slot, anbool* placed,
-                             kdtree_qres_t** presult);
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The quad matching kernels built for one dimquads, see solver_dimquads.c.
+typedef struct {
+    int dimquads;
+    void (*try_all_codes)(const pquad* pq, const int* fieldstars,
+                          solver_t* solver, double tol2);
+} quad_kernels_t;
 
-static void resolve_matches(kdtree_qres_t* krez, const double *field,
-                            const int* fstars, int dimquads,
-                            solver_t* solver, anbool current_parity);
+static const quad_kernels_t* get_quad_kernels(int dimquads);
 
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
 
@@ -571,46 +573,223 @@ static void check_scale(pquad* pq, solver_t* s) {
     pq->scale_ok = TRUE;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The potential quads are stored in a packed triangle (only A < B is used),
+// and their "inbox" arrays are bitsets.  The "inbox" and "xy" arrays are
+// carved out of large blocks owned by the solver, which are reused by every
+// solver_run() until solver_cleanup().
+#define PQUAD_INDEX(A, B) ((size_t)(B) * (size_t)((B) - 1) / 2 + (size_t)(A))
+#define PQUAD_BLOCK_SIZE (4 * 1024 * 1024)
+#define INBOX_WORDS(n) (((n) + 31) / 32)
+// The field star grid has at most this many cells in each direction.
+#define FIELDGRID_MAX 256
+
+static inline anbool inbox_get(const pquad* pq, int i) {
+    return (pq->inbox[i >> 5] >> (i & 31)) & 1;
+}
+
+static inline void inbox_set(pquad* pq, int i) {
+    pq->inbox[i >> 5] |= (1u << (i & 31));
+}
+
+static inline void inbox_clear(pquad* pq, int i) {
+    pq->inbox[i >> 5] &= ~(1u << (i & 31));
+}
+
+// Returns the first star from i up to (not including) "top" that is in the box, or "top".
+static inline int inbox_next(const pquad* pq, int i, int top) {
+    uint32_t w;
+    if (i >= top)
+        return top;
+    w = pq->inbox[i >> 5] >> (i & 31);
+    while (!w) {
+        i = (i | 31) + 1;
+        if (i >= top)
+            return top;
+        w = pq->inbox[i >> 5];
+    }
+    while (!(w & 1)) {
+        w >>= 1;
+        i++;
+    }
+    return MIN(i, top);
+}
+
+static void pquads_reset(solver_t* s, int numxy) {
+    size_t n = PQUAD_INDEX(0, numxy);
+    if (n > s->pquads_capacity) {
+        free(s->pquads);
+        s->pquads = malloc(n * sizeof(pquad));
+        s->pquads_capacity = n;
+    }
+    if (!s->pquad_blocks)
+        s->pquad_blocks = pl_new(16);
+    s->pquad_block = 0;
+    s->pquad_block_used = 0;
+}
+
+static void pquad_alloc_inbox(solver_t* s, pquad* pq, int numxy) {
+    size_t xybytes = (size_t)numxy * 2 * sizeof(double);
+    size_t inboxbytes = INBOX_WORDS(numxy) * sizeof(uint32_t);
+    size_t need = xybytes + ((inboxbytes + 7) & ~(size_t)7);
+    char* mem;
+    assert(need <= PQUAD_BLOCK_SIZE);
+    if (s->pquad_block < pl_size(s->pquad_blocks) &&
+        s->pquad_block_used + need > PQUAD_BLOCK_SIZE) {
+        s->pquad_block++;
+        s->pquad_block_used = 0;
+    }
+    if (s->pquad_block == pl_size(s->pquad_blocks))
+        pl_append(s->pquad_blocks, malloc(PQUAD_BLOCK_SIZE));
+    mem = (char*)pl_get(s->pquad_blocks, s->pquad_block) + s->pquad_block_used;
+    s->pquad_block_used += need;
+    pq->xy = (double*)mem;
+    pq->inbox = (uint32_t*)(mem + xybytes);
+}
+
+static void pquads_free(solver_t* s) {
+    size_t i;
+    free(s->pquads);
+    s->pquads = NULL;
+    s->pquads_capacity = 0;
+    if (s->pquad_blocks) {
+        for (i = 0; i < pl_size(s->pquad_blocks); i++)
+            free(pl_get(s->pquad_blocks, i));
+        pl_free(s->pquad_blocks);
+    }
+    s->pquad_blocks = NULL;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Checks whether star i is in the circle of the quad with A and B at the corners,
+// and if it is, stores its position in the quad's frame.
+static inline anbool check_star_in_box(pquad* pq, int i, double Ax, double Ay, solver_t* solver) {
+    double r;
+    double Cx, Cy, xxtmp;
+    double tol = solver->codetol;
+    field_getxy(solver, i, &Cx, &Cy);
+    Cx -= Ax;
+    Cy -= Ay;
+    xxtmp = Cx;
+    Cx = Cx * pq->costheta + Cy * pq->sintheta;
+    Cy = -xxtmp * pq->sintheta + Cy * pq->costheta;
+
+    // make sure it's in the circle centered at (0.5, 0.5)
+    // with radius 1/sqrt(2) (plus codetol for fudge):
+    // (x-1/2)^2 + (y-1/2)^2   <=   (r + codetol)^2
+    // x^2-x+1/4 + y^2-y+1/4   <=   (1/sqrt(2) + codetol)^2
+    // x^2-x + y^2-y + 1/2     <=   1/2 + sqrt(2)*codetol + codetol^2
+    // x^2-x + y^2-y           <=   sqrt(2)*codetol + codetol^2
+    r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
+    if (r > (tol * (M_SQRT2 + tol)))
+        return FALSE;
+    setx(pq->xy, i, Cx);
+    sety(pq->xy, i, Cy);
+    return TRUE;
+}
+
 static void check_inbox(pquad* pq, int start, solver_t* solver) {
     int i;
     double Ax, Ay;
     field_getxy(solver, pq->fieldA, &Ax, &Ay);
     // check which C, D points are inside the circle.
     for (i = start; i < pq->ninbox; i++) {
-        double r;
-        double Cx, Cy, xxtmp;
-        double tol = solver->codetol;
-        if (!pq->inbox[i])
-            continue;
-        field_getxy(solver, i, &Cx, &Cy);
-        Cx -= Ax;
-        Cy -= Ay;
-        xxtmp = Cx;
-        Cx = Cx * pq->costheta + Cy * pq->sintheta;
-        Cy = -xxtmp * pq->sintheta + Cy * pq->costheta;
-
-        // make sure it's in the circle centered at (0.5, 0.5)
-        // with radius 1/sqrt(2) (plus codetol for fudge):
-        // (x-1/2)^2 + (y-1/2)^2   <=   (r + codetol)^2
-        // x^2-x+1/4 + y^2-y+1/4   <=   (1/sqrt(2) + codetol)^2
-        // x^2-x + y^2-y + 1/2     <=   1/2 + sqrt(2)*codetol + codetol^2
-        // x^2-x + y^2-y           <=   sqrt(2)*codetol + codetol^2
-        r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
-        if (r > (tol * (M_SQRT2 + tol))) {
-            pq->inbox[i] = FALSE;
+        if (!inbox_get(pq, i))
             continue;
+        if (!check_star_in_box(pq, i, Ax, Ay, solver))
+            inbox_clear(pq, i);
+    }
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Sets up the "inbox" of a new AB pair for stars [0, n): this is what filling it
+// and calling check_inbox() did, but only the stars in the grid cells that the
+// circle touches are checked, instead of all n of them.
+static void init_inbox(pquad* pq, int n, solver_t* solver) {
+    int cx0, cx1, cy0, cy1, cx, cy, k;
+    double Ax, Ay, Bx, By, Mx, My, r;
+    memset(pq->inbox, 0, INBOX_WORDS(n) * sizeof(uint32_t));
+    pq->ninbox = n;
+    field_getxy(solver, pq->fieldA, &Ax, &Ay);
+    field_getxy(solver, pq->fieldB, &Bx, &By);
+    // The circle is centered on the middle of AB, its radius is |AB| / 2 in the
+    // quad's frame plus codetol, where |AB| is sqrt(2); a little extra covers rounding.
+    Mx = 0.5 * (Ax + Bx);
+    My = 0.5 * (Ay + By);
+    r = sqrt(pq->scale) * (0.5 + solver->codetol / M_SQRT2) * 1.001 + 1e-6;
+    cx0 = MAX((int)floor((Mx - r - solver->fieldgrid_x0) / solver->fieldgrid_cell), 0);
+    cx1 = MIN((int)floor((Mx + r - solver->fieldgrid_x0) / solver->fieldgrid_cell), solver->fieldgrid_nx - 1);
+    cy0 = MAX((int)floor((My - r - solver->fieldgrid_y0) / solver->fieldgrid_cell), 0);
+    cy1 = MIN((int)floor((My + r - solver->fieldgrid_y0) / solver->fieldgrid_cell), solver->fieldgrid_ny - 1);
+    for (cy = cy0; cy <= cy1; cy++) {
+        for (cx = cx0; cx <= cx1; cx++) {
+            int c = cy * solver->fieldgrid_nx + cx;
+            for (k = solver->fieldgrid_start[c]; k < solver->fieldgrid_start[c + 1]; k++) {
+                int i = solver->fieldgrid_stars[k];
+                if (i >= n)
+                    break;
+                if (i == pq->fieldA || i == pq->fieldB)
+                    continue;
+                if (check_star_in_box(pq, i, Ax, Ay, solver))
+                    inbox_set(pq, i);
+            }
         }
-        setx(pq->xy, i, Cx);
-        sety(pq->xy, i, Cy);
     }
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Puts the field stars in a grid of cells, about two stars per cell.
+static void fieldgrid_build(solver_t* solver) {
+    int i, c, N, ncells;
+    double x1, y1, W, H;
+
+    N = starxy_n(solver->fieldxy);
+    solver->fieldgrid_x0 = solver->fieldgrid_y0 = HUGE_VAL;
+    x1 = y1 = -HUGE_VAL;
+    for (i = 0; i < N; i++) {
+        solver->fieldgrid_x0 = MIN(solver->fieldgrid_x0, field_getx(solver, i));
+        solver->fieldgrid_y0 = MIN(solver->fieldgrid_y0, field_gety(solver, i));
+        x1 = MAX(x1, field_getx(solver, i));
+        y1 = MAX(y1, field_gety(solver, i));
+    }
+    if (!N)
+        solver->fieldgrid_x0 = solver->fieldgrid_y0 = x1 = y1 = 0;
+    W = MAX(x1 - solver->fieldgrid_x0, 1.0);
+    H = MAX(y1 - solver->fieldgrid_y0, 1.0);
+    solver->fieldgrid_cell = MAX(sqrt(2.0 * W * H / MAX(N, 1)), MAX(W, H) / FIELDGRID_MAX);
+    solver->fieldgrid_nx = MIN((int)(W / solver->fieldgrid_cell) + 1, FIELDGRID_MAX + 1);
+    solver->fieldgrid_ny = MIN((int)(H / solver->fieldgrid_cell) + 1, FIELDGRID_MAX + 1);
+    ncells = solver->fieldgrid_nx * solver->fieldgrid_ny;
+
+    free(solver->fieldgrid_start);
+    free(solver->fieldgrid_stars);
+    solver->fieldgrid_start = calloc(ncells + 1, sizeof(int));
+    solver->fieldgrid_stars = malloc(MAX(N, 1) * sizeof(int));
+    for (i = 0; i < N; i++) {
+        c = (int)((field_gety(solver, i) - solver->fieldgrid_y0) / solver->fieldgrid_cell) * solver->fieldgrid_nx +
+            (int)((field_getx(solver, i) - solver->fieldgrid_x0) / solver->fieldgrid_cell);
+        solver->fieldgrid_start[c + 1]++;
+    }
+    for (c = 0; c < ncells; c++)
+        solver->fieldgrid_start[c + 1] += solver->fieldgrid_start[c];
+    // fill the cells in star order, each start moves along as its cell fills up
+    for (i = 0; i < N; i++) {
+        c = (int)((field_gety(solver, i) - solver->fieldgrid_y0) / solver->fieldgrid_cell) * solver->fieldgrid_nx +
+            (int)((field_getx(solver, i) - solver->fieldgrid_x0) / solver->fieldgrid_cell);
+        solver->fieldgrid_stars[solver->fieldgrid_start[c]++] = i;
+    }
+    // now each start is where the next cell starts
+    for (c = ncells; c > 0; c--)
+        solver->fieldgrid_start[c] = solver->fieldgrid_start[c - 1];
+    solver->fieldgrid_start[0] = 0;
+}
+
 #if defined DEBUGSOLVER
 static void print_inbox(pquad* pq) {
     int i;
     debug("[ ");
     for (i = 0; i < pq->ninbox; i++) {
-        if (pq->inbox[i])
+        if (inbox_get(pq, i))
             debug("%i ", i);
     }
     debug("] (n %i)\n", pq->ninbox);
@@ -649,6 +828,7 @@ void solver_preprocess_field(solver_t* solver) {
 
     solver->vf->do_uniformize = solver->verify_uniformize;
     solver->vf->do_dedup = solver->verify_dedup;
+    fieldgrid_build(solver); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 }
 
 void solver_free_field(solver_t* solver) {
@@ -659,6 +839,11 @@ void solver_free_field(solver_t* solver) {
     if (solver->vf)
         verify_field_free(solver->vf);
     solver->vf = NULL;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    free(solver->fieldgrid_start);
+    free(solver->fieldgrid_stars);
+    solver->fieldgrid_start = NULL;
+    solver->fieldgrid_stars = NULL;
 }
 
 starxy_t* solver_get_field(solver_t* solver) {
@@ -691,11 +876,11 @@ static double get_tolerance(solver_t* solver) {
  n_to_add - number of stars to add
  adding - the star we're currently adding; in [0, n_to_add).
  fieldtop - the maximum field star number to build quads out of.
- dimquad, solver, tol2 - passed to try_all_codes.
+ kernels, solver, tol2 - passed to try_all_codes.
  */
 static void add_stars(const pquad* pq, int* field, int fieldoffset,
                       int n_to_add, int adding, int fieldtop,
-                      int dimquad,
+                      const quad_kernels_t* kernels,
                       solver_t* solver, double tol2) {
     int bottom;
     int* f = field + fieldoffset;
@@ -707,9 +892,9 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     // It looks funny that we're using f[adding] as a loop variable, but
     // it's required because try_all_codes needs to know which field stars
     // were used to create the quad (which are stored in the "f" array)
-    for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
-        if (!pq->inbox[f[adding]])
-            continue;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, to skip whole words of stars that aren't in the box
+    for (f[adding]=inbox_next(pq, bottom, fieldtop); f[adding]<fieldtop;
+         f[adding]=inbox_next(pq, f[adding]+1, fieldtop)) {
         if (unlikely(solver->quit_now))
             return;
 
@@ -717,11 +902,11 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
         // call try_all_codes to try the quad we've built.
         if (adding == n_to_add-1) {
             // (when not testing, TRY_ALL_CODES is just try_all_codes.)
-            TRY_ALL_CODES(pq, field, dimquad, solver, tol2);
+            TRY_ALL_CODES(pq, field, kernels, solver, tol2);
         } else {
             // Else recurse.
             add_stars(pq, field, fieldoffset, n_to_add, adding+1,
-                      fieldtop, dimquad, solver, tol2);
+                      fieldtop, kernels, solver, tol2);
         }
     }
 }
@@ -770,9 +955,11 @@ void solver_run(solver_t* solver) {
 #ifndef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         double minAB2s[num_indexes];
         double maxAB2s[num_indexes];
+        const quad_kernels_t* kernels[num_indexes];
 #else
         double* minAB2s = (double*)malloc(sizeof(double)*num_indexes);
         double* maxAB2s = (double*)malloc(sizeof(double)*num_indexes);
+        const quad_kernels_t** kernels = (const quad_kernels_t**)malloc(sizeof(quad_kernels_t*)*num_indexes);
 #endif
         solver->minminAB2 = HUGE_VAL;
         solver->maxmaxAB2 = -HUGE_VAL;
@@ -786,6 +973,11 @@ void solver_run(solver_t* solver) {
             //minAB, maxAB);
             minAB2s[i] = square(minAB);
             maxAB2s[i] = square(maxAB);
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            kernels[i] = get_quad_kernels(index_dimquads(index));
+            if (!kernels[i])
+                logerr("Index \"%s\" has %i stars per quad, which is not supported; skipping it\n",
+                       index->indexname, index_dimquads(index));
             solver->minminAB2 = MIN(solver->minminAB2, minAB2s[i]);
             solver->maxmaxAB2 = MAX(solver->maxmaxAB2, maxAB2s[i]);
 
@@ -813,18 +1005,21 @@ void solver_run(solver_t* solver) {
          MIN(M_PI, arcsec2rad(field_diag * solver->funits_upper)) ...
          */
 
-        pquads = calloc(numxy * numxy, sizeof(pquad));
+        //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        pquads_reset(solver, numxy);
+        pquads = solver->pquads;
 
         /* We maintain an array of "potential quads" (pquad) structs, where
          * each struct corresponds to one choice of stars A and B; the struct
-         * at index (B * numxy + A) holds information about quads that could be
-         * created using stars A,B.
+         * at index PQUAD_INDEX(A, B) = (B * (B-1) / 2 + A) holds information
+         * about quads that could be created using stars A,B.
          *
-         * (We only use the above-diagonal elements of this 2D array because
-         * A<B.)
+         * (We only store the above-diagonal elements of this 2D array because
+         * A<B.)  Every pquad is initialized before it is used, so the array
+         * is not cleared between runs.
          *
          * For each AB pair, we cache the scale and the rotation parameters,
-         * and we keep an array "inbox" of length "numxy" of booleans, one for
+         * and we keep a bitset "inbox" of length "numxy", one bit for
          * each star, which say whether that star is eligible to be star C or D
          * of a quad with AB at the corners.  (Obviously A and B aren't
          * eligible).
@@ -840,7 +1035,7 @@ void solver_run(solver_t* solver) {
             debug("startobj > 0; priming pquad arrays.\n");
             for (field[B] = 0; field[B] < solver->startobj; field[B]++) {
                 for (field[A] = 0; field[A] < field[B]; field[A]++) {
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + PQUAD_INDEX(field[A], field[B]);
                     pq->fieldA = field[A];
                     pq->fieldB = field[B];
                     debug("trying A=%i, B=%i\n", field[A], field[B]);
@@ -849,13 +1044,8 @@ void solver_run(solver_t* solver) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
-                    pq->xy = malloc(numxy * 2 * sizeof(double));
-                    pq->inbox = malloc(numxy * sizeof(anbool));
-                    memset(pq->inbox, TRUE, solver->startobj);
-                    pq->ninbox = solver->startobj;
-                    pq->inbox[field[A]] = FALSE;
-                    pq->inbox[field[B]] = FALSE;
-                    check_inbox(pq, 0, solver);
+                    pquad_alloc_inbox(solver, pq, numxy);
+                    init_inbox(pq, solver->startobj, solver);
                     debug("  inbox(A=%i, B=%i): ", field[A], field[B]);
                     print_inbox(pq);
                 }
@@ -899,7 +1089,7 @@ void solver_run(solver_t* solver) {
             // first do an index-independent scale check...
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 // initialize the "pquad" struct for this AB combo.
-                pquad* pq = pquads + field[B] * numxy + field[A];
+                pquad* pq = pquads + PQUAD_INDEX(field[A], field[B]);
                 pq->fieldA = field[A];
                 pq->fieldB = field[B];
                 debug("  trying A=%i, B=%i\n", field[A], field[B]);
@@ -908,17 +1098,10 @@ void solver_run(solver_t* solver) {
                     debug("    bad scale for A=%i, B=%i\n", field[A], field[B]);
                     continue;
                 }
-                // initialize the "inbox" array:
-                pq->inbox = malloc(numxy * sizeof(anbool));
-                pq->xy = malloc(numxy * 2 * sizeof(double));
-                // -try all stars up to "newpoint"...
-                assert(sizeof(anbool) == 1);
-                memset(pq->inbox, TRUE, newpoint + 1);
-                pq->ninbox = newpoint + 1;
-                // -except A and B.
-                pq->inbox[field[A]] = FALSE;
-                pq->inbox[field[B]] = FALSE;
-                check_inbox(pq, 0, solver);
+                // initialize the "inbox" bitset:
+                pquad_alloc_inbox(solver, pq, numxy);
+                // -try all stars up to "newpoint", except A and B.
+                init_inbox(pq, newpoint + 1, solver);
                 debug("    inbox(A=%i, B=%i): ", field[A], field[B]);
                 print_inbox(pq);
             }
@@ -927,11 +1110,13 @@ void solver_run(solver_t* solver) {
             for (i = 0; i < num_indexes; i++) {
                 index_t* index = pl_get(solver->indexes, i);
                 int dimquads;
+                if (!kernels[i]) //# Modified by Robert Lancaster for the StellarSolver Internal Library
+                    continue;
                 set_index(solver, index);
                 dimquads = index_dimquads(index);
                 for (field[A] = 0; field[A] < newpoint; field[A]++) {
                     // initialize the "pquad" struct for this AB combo.
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + PQUAD_INDEX(field[A], field[B]);
                     if (!pq->scale_ok)
                         continue;
                     if ((pq->scale < minAB2s[i]) ||
@@ -942,7 +1127,7 @@ void solver_run(solver_t* solver) {
                     tol2 = get_tolerance(solver);
                     // Now look at all sets of (C, D, ...) stars (subject to field[C] < field[D] < ...)
                     // ("dimquads - 2" because we've set stars A and B at this point)
-                    add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver, tol2);
+                    add_stars(pq, field, C, dimquads-2, 0, newpoint, kernels[i], solver, tol2);
                     if (solver->quit_now)
                         goto quitnow;
                 }
@@ -958,16 +1143,16 @@ void solver_run(solver_t* solver) {
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
                     // grab the "pquad" for this AB combo
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = pquads + PQUAD_INDEX(field[A], field[B]);
                     if (!pq->scale_ok) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
                     // test if this C is in the box:
-                    pq->inbox[field[C]] = TRUE;
+                    inbox_set(pq, field[C]);
                     pq->ninbox = field[C] + 1;
                     check_inbox(pq, field[C], solver);
-                    if (!pq->inbox[field[C]]) {
+                    if (!inbox_get(pq, field[C])) {
                         debug("  C is not in the box for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
@@ -981,6 +1166,8 @@ void solver_run(solver_t* solver) {
                     for (i = 0; i < pl_size(solver->indexes); i++) {
                         int dimquads;
                         index_t* index = pl_get(solver->indexes, i);
+                        if (!kernels[i]) //# Modified by Robert Lancaster for the StellarSolver Internal Library
+                            continue;
                         if ((pq->scale < minAB2s[i]) ||
                             (pq->scale > maxAB2s[i]))
                             continue;
@@ -991,9 +1178,9 @@ void solver_run(solver_t* solver) {
 
                         if (dimquads > 3) {
                             // ("dimquads - 3" because we've set stars A, B, and C at this point)
-                            add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, solver, tol2);
+                            add_stars(pq, field, D, dimquads-3, 0, newpoint, kernels[i], solver, tol2);
                         } else {
-                            TRY_ALL_CODES(pq, field, dimquads, solver, tol2);
+                            TRY_ALL_CODES(pq, field, kernels[i], solver, tol2);
                         }
                         if (solver->quit_now)
                             goto quitnow;
@@ -1010,364 +1197,55 @@ void solver_run(solver_t* solver) {
         }
 
     quitnow:
-        for (i = 0; i < (numxy*numxy); i++) {
-            pquad* pq = pquads + i;
-            free(pq->inbox);
-            free(pq->xy);
-        }
-        free(pquads);
+        //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        // the pquads are kept for the next run and freed by solver_cleanup().
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(minAB2s);
         free(maxAB2s);
+        free((void*)kernels);
 #endif
     }
 }
 
-/**
- All the stars in this quad have been chosen.  Figure out which
- permutations of stars CDE are valid and search for matches.
- */
-static void try_all_codes(const pquad* pq,
-                          const int* fieldstars, int dimquad,
-                          solver_t* solver, double tol2) {
-    int dimcode = (dimquad - 2) * 2;
-    double code[DCMAX];
-    double flipcode[DCMAX];
-    int i;
-
-    solver->numtries++;
-
-    debug("  trying quad [");
-    for (i=0; i<dimquad; i++) {
-        debug("%s%i", (i?" ":""), fieldstars[i]);
-    }
-    debug("]\n");
-
-    for (i=0; i<dimquad-NBACK; i++) {
-        code[2*i  ] = getx(pq->xy, fieldstars[NBACK+i]);
-        code[2*i+1] = gety(pq->xy, fieldstars[NBACK+i]);
-    }
-
-    if (solver->parity == PARITY_NORMAL ||
-        solver->parity == PARITY_BOTH) {
-
-        debug("    trying normal parity: code=[");
-        for (i=0; i<dimcode; i++)
-            debug("%s%g", (i?", ":""), code[i]);
-        debug("].\n");
-
-        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2);
-    }
-    if (solver->parity == PARITY_FLIP ||
-        solver->parity == PARITY_BOTH) {
-
-        quad_flip_parity(code, flipcode, dimcode);
-
-        debug("    trying reverse parity: code=[");
-        for (i=0; i<dimcode; i++)
-            debug("%s%g", (i?", ":""), flipcode[i]);
-        debug("].\n");
-
-        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2);
-    }
-}
-
-/**
- This function tries the quad with the "backbone" stars A and B in
- normal and flipped configurations.
- */
-static void try_all_codes_2(const int* fieldstars, int dimquad,
-                            const double* code, solver_t* solver,
-                            anbool current_parity, double tol2) {
-    int i;
-    kdtree_qres_t* result = NULL;
-    int dimcode = (dimquad - 2) * 2;
-    int stars[DQMAX];
-    double flipcode[DCMAX];
-
-    // We actually only use elements up to dimquads-2.
-    anbool placed[DQMAX];
-
-    // Un-flipped:
-    stars[0] = fieldstars[0];
-    stars[1] = fieldstars[1];
-
-    for (i=0; i<DQMAX; i++)
-        placed[i] = FALSE;
-
-    try_permutations(fieldstars, dimquad, code, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-    if (unlikely(solver->quit_now))
-        goto bailout;
-
-    // Flipped:
-    stars[0] = fieldstars[1];
-    stars[1] = fieldstars[0];
-
-    for (i=0; i<dimcode; i++)
-        flipcode[i] = 1.0 - code[i];
-
-    for (i=0; i<DQMAX; i++)
-        placed[i] = FALSE;
-
-    try_permutations(fieldstars, dimquad, flipcode, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-
- bailout:
-    kdtree_free_query(result);
-}
-
-/**
- This functions tries different permutations of the non-backbone
- stars C [, D [,E ] ]
- */
-static void try_permutations(const int* origstars, int dimquad,
-                             const double* origcode,
-                             solver_t* solver, anbool current_parity,
-                             double tol2,
-                             int* stars, double* code,
-                             int slot, anbool* placed,
-                             kdtree_qres_t** presult) {
-    int i;
-    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
-        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
-    double mycode[DCMAX];
-    int Nstars = dimquad - NBACK;
-    int lastslot = dimquad - NBACK - 1;
-    /*
-     This is a recursive function that tries all combinations of the
-     "internal" stars (ie, not stars A,B that form the "backbone" of
-     the quad).
-
-     We fill the "stars" array with the star IDs (from "origstars") of
-     the stars that form the quad, while simultaneously filling the
-     "code" array with the corresponding code coordinates (from
-     "origcode").
-
-     For example, if "dimquad" is 5, and "origstars" contains
-     A,B,C,D,E, we want to call "resolve_matches" with the following
-     combinations in "stars":
-
-     AB CDE
-     AB CED
-     AB DCE
-     AB DEC
-     AB ECD
-     AB EDC
-
-     This call will try to put each star in "slot" in turn, then for
-     each one recurse to "slot" in the rest of the stars.
-
-     Note that we are filling stars[2], stars[3], etc; the first two
-     elements are already filled by stars A and B.
-     */
-
-    if (code == NULL)
-        code = mycode;
-
-    // We try putting each star that hasn't already been placed in
-    // this "slot".
-    for (i=0; i<Nstars; i++) {
-        if (placed[i])
-            continue;
-
-        // Check cx <= dx, if we're a "dx".
-        if (slot > 0 && solver->index->cx_less_than_dx) {
-            if (code[2*(slot - 1) +0] > origcode[2*i +0] + solver->cxdx_margin) {
-                debug("cx <= dx check failed: %g > %g + %g\n",
-                      code[2*(slot - 1) +0], origcode[2*i +0],
-                      solver->cxdx_margin);
-                solver->num_cxdx_skipped++;
-                continue;
-            }
-        }
-
-        // Slot in this star...
-        stars[slot + NBACK] = origstars[i + NBACK];
-        code[2*slot +0] = origcode[2*i +0];
-        code[2*slot +1] = origcode[2*i +1];
-
-        // Check meanx <= 1/2.
-        if (solver->index->cx_less_than_dx &&
-            solver->index->meanx_less_than_half) {
-            // Check the "cx + dx <= 1" condition (for quads); in general,
-            // combined with the "cx <= dx" condition, this means that the
-            // mean(x) <= 1/2.
-            int j;
-            double meanx = 0;
-            for (j=0; j<=slot; j++)
-                meanx += code[2*j];
-            meanx /= (slot+1);
-            if (meanx > 0.5 + solver->cxdx_margin) {
-                debug("meanx <= 0.5 check failed: %g > 0.5 + %g\n", 
-                      meanx, solver->cxdx_margin);
-                solver->num_meanx_skipped++;
-                continue;
-            }
-        }
-
-        // If we have more slots to fill...
-        if (slot < lastslot) {
-            placed[i] = TRUE;
-            try_permutations(origstars, dimquad, origcode, solver,
-                             current_parity, tol2, stars, code, 
-                             slot+1, placed, presult);
-            placed[i] = FALSE;
-
-        } else {
-#if defined(TESTING_TRYPERMUTATIONS)
-            TEST_TRY_PERMUTATIONS(stars, code, dimquad, solver);
-            continue;
-#endif
-				
-            // Search with the code we've built.
-            *presult = kdtree_rangesearch_options_reuse
-                (solver->index->codekd->tree, *presult, code, tol2, options);
-            //debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
-            //fstars[A], fstars[B], fstars[C], fstars[D], result->nres);
-
-            if ((*presult)->nres) {
-                double pixvals[DQMAX*2];
-                int j;
-                for (j=0; j<dimquad; j++) {
-                    setx(pixvals, j, field_getx(solver, stars[j]));
-                    sety(pixvals, j, field_gety(solver, stars[j]));
-                }
-                resolve_matches(*presult, pixvals, stars, dimquad, solver,
-                                current_parity);
-            }
-            if (unlikely(solver->quit_now))
-                return;
-        }
-    }
-}
-
-// "field" contains the xy pixel coordinates of stars A,B,C,D.
-static void resolve_matches(kdtree_qres_t* krez, const double *field,
-                            const int* fieldstars, int dimquads,
-                            solver_t* solver, anbool current_parity) {
-    int jj, thisquadno;
-    MatchObj mo;
-
-    if(dimquads <= 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
-        return;
-#ifndef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-        unsigned int star[dimquads];
-#else
-        unsigned int* star = (unsigned int*)malloc(sizeof(unsigned int)*dimquads);
-#endif
-
-    assert(krez);
-
-    for (jj = 0; jj < krez->nres; jj++) {
-
-#ifndef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-        double starxyz[dimquads*3];
-#else
-        double* starxyz = (double*)malloc(sizeof(double)*dimquads*3);
-#endif
-
-        double scale;
-        double arcsecperpix;
-        tan_t wcs;
-        int i;
-        anbool outofbounds = FALSE;
-        double abscale;
-
-        solver->nummatches++;
-        thisquadno = krez->inds[jj];
-        quadfile_get_stars(solver->index->quads, thisquadno, star);
-        for (i=0; i<dimquads; i++) {
-            startree_get(solver->index->starkd, star[i], starxyz + 3*i);
-            if (solver->use_radec)
-                if (distsq(starxyz + 3*i, solver->centerxyz, 3) > solver->r2) {
-                    outofbounds = TRUE;
-                    break;
-                }
-        }
-        if (outofbounds) {
-            debug("Quad match is out of bounds.\n");
-            solver->num_radec_skipped++;
-            continue;
-        }
-
-        debug("        stars [");
-        for (i=0; i<dimquads; i++)
-            debug("%s%i", (i?" ":""), star[i]);
-        debug("]\n");
-
-        // Quick-n-dirty scale estimate based on two stars.
-        //abscale = distsq(starxyz, starxyz+3, 3) / distsq(field, field+2, 2);
-        // in (rad per pix)**2
-        abscale = square(distsq2rad(distsq(starxyz, starxyz+3, 3))) / 
-            distsq(field, field+2, 2);
-        if (abscale > solver->abscale_high ||
-            abscale < solver->abscale_low) {
-            solver->num_abscale_skipped++;
-            continue;
-        }
-
-        // compute TAN projection from the matching quad alone.
-        if (fit_tan_wcs(starxyz, field, dimquads, &wcs, &scale)) {
-            // bad quad.
-            logverb("bad quad at %s:%i\n", __FILE__, __LINE__);
-            continue;
-        }
-        arcsecperpix = scale * 3600.0;
-
-        // FIXME - should there be scale fudge here?
-        if (arcsecperpix > solver->funits_upper ||
-            arcsecperpix < solver->funits_lower) {
-            debug("          bad scale (%g arcsec/pix, range %g %g)\n",
-                  arcsecperpix, solver->funits_lower, solver->funits_upper);
-            continue;
-        }
-        solver->numscaleok++;
-
-        set_matchobj_template(solver, &mo);
-        memcpy(&(mo.wcstan), &wcs, sizeof(tan_t));
-        mo.wcs_valid = TRUE;
-        mo.code_err = krez->sdists[jj];
-        mo.scale = arcsecperpix;
-        mo.parity = current_parity;
-        mo.quads_tried = solver->numtries;
-        mo.quads_matched = solver->nummatches;
-        mo.quads_scaleok = solver->numscaleok;
-        mo.quad_npeers = krez->nres;
-        mo.timeused = solver->timeused;
-        mo.quadno = thisquadno;
-        mo.dimquads = dimquads;
-        for (i=0; i<dimquads; i++) {
-            mo.star[i] = star[i];
-            mo.field[i] = fieldstars[i];
-            mo.ids[i] = 0;
-        }
-
-        memcpy(mo.quadpix, field, 2 * dimquads * sizeof(double));
-        memcpy(mo.quadxyz, starxyz, 3 * dimquads * sizeof(double));
-
-        set_center_and_radius(solver, &mo, &(mo.wcstan), NULL);
-
-        if (solver_handle_hit(solver, &mo, NULL, FALSE))
-            solver->quit_now = TRUE;
-
-        if (unlikely(solver->quit_now))
-        {
-            #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-             free(starxyz);
-             free(star);
-            #endif
-            return;
-        }
-
-#ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-        free(starxyz);
-#endif
-    }
-#ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-        free(star);
-#endif
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// try_all_codes(), try_permutations(), search_codes() and resolve_matches()
+// are built for each dimquads from solver_dimquads.c.
+#define DQFUNC(name) name##_dq3
+#define DQ 3
+#define DQ_NPERMS 1
+#include "solver_dimquads.c"
+#undef DQ
+#undef DQ_NPERMS
+#undef DQFUNC
+
+#define DQFUNC(name) name##_dq4
+#define DQ 4
+#define DQ_NPERMS 2
+#include "solver_dimquads.c"
+#undef DQ
+#undef DQ_NPERMS
+#undef DQFUNC
+
+#define DQFUNC(name) name##_dq5
+#define DQ 5
+#define DQ_NPERMS 6
+#include "solver_dimquads.c"
+#undef DQ
+#undef DQ_NPERMS
+#undef DQFUNC
+
+static const quad_kernels_t quad_kernels[] = {
+    { 3, try_all_codes_dq3 },
+    { 4, try_all_codes_dq4 },
+    { 5, try_all_codes_dq5 },
+};
+
+// Returns the kernels for quads of "dimquads" stars, or NULL if there are none.
+static const quad_kernels_t* get_quad_kernels(int dimquads) {
+    if (dimquads < 3 || dimquads > DQMAX)
+        return NULL;
+    return quad_kernels + (dimquads - 3);
 }
 
 void solver_inject_match(solver_t* solver, MatchObj* mo, sip_t* sip) {
@@ -1630,6 +1508,7 @@ void solver_clear_indexes(solver_t* solver) {
 }
 
 void solver_cleanup(solver_t* solver) {
+    int i;
     solver_free_field(solver);
     pl_free(solver->indexes);
     solver->indexes = NULL;
@@ -1640,6 +1519,11 @@ void solver_cleanup(solver_t* solver) {
     if (solver->predistort)
         sip_free(solver->predistort);
     solver->predistort = NULL;
+    pquads_free(solver); //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    for (i = 0; i < SOLVER_MAX_CODES; i++) { //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        kdtree_free_query(solver->code_results[i]);
+        solver->code_results[i] = NULL;
+    }
 }
 
 void solver_free(solver_t* solver) {
@@ -0,0 +1,334 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/**
+ The quad matching kernels for one number of stars per quad.
+
+ This file is #included by solver.c once for each "dimquads", with
+ DQ set to the number of stars in a quad, DQ_NPERMS to (DQ-2)! and
+ DQFUNC(name) giving the name of each function for that DQ, in the same
+ way that libkd builds its kernels for each data type.  Since DQ is a
+ constant, the codes and stars are fixed-size arrays and the loops over
+ them can be unrolled; the orders of the stars C, D, E are taken from a
+ table instead of being built by recursion.
+ */
+
+#define DQ_NCODE (2 * (DQ - 2))
+
+/**
+ The orders to try the stars C [, D [, E ] ] in, in the order that
+ trying each remaining star in each slot in turn gives.
+ */
+static const int DQFUNC(perms)[DQ_NPERMS][DQ - 2] = {
+#if DQ == 3
+    {0},
+#elif DQ == 4
+    {0, 1}, {1, 0},
+#elif DQ == 5
+    {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0},
+#else
+#error "No permutation table for this DQ"
+#endif
+};
+
+// "field" contains the xy pixel coordinates of stars A,B,C,D.
+static void DQFUNC(resolve_matches)(kdtree_qres_t* krez, const double *field,
+                                    const int* fieldstars,
+                                    solver_t* solver, anbool current_parity) {
+    int jj, thisquadno;
+    MatchObj mo;
+    unsigned int star[DQ];
+
+    assert(krez);
+
+    for (jj = 0; jj < krez->nres; jj++) {
+        double starxyz[DQ*3];
+        double scale;
+        double arcsecperpix;
+        tan_t wcs;
+        int i;
+        anbool outofbounds = FALSE;
+        double abscale;
+
+        solver->nummatches++;
+        thisquadno = krez->inds[jj];
+        quadfile_get_stars(solver->index->quads, thisquadno, star);
+        for (i=0; i<DQ; i++) {
+            startree_get(solver->index->starkd, star[i], starxyz + 3*i);
+            if (solver->use_radec)
+                if (distsq(starxyz + 3*i, solver->centerxyz, 3) > solver->r2) {
+                    outofbounds = TRUE;
+                    break;
+                }
+        }
+        if (outofbounds) {
+            debug("Quad match is out of bounds.\n");
+            solver->num_radec_skipped++;
+            continue;
+        }
+
+        debug("        stars [");
+        for (i=0; i<DQ; i++)
+            debug("%s%i", (i?" ":""), star[i]);
+        debug("]\n");
+
+        // Quick-n-dirty scale estimate based on two stars.
+        // in (rad per pix)**2
+        abscale = square(distsq2rad(distsq(starxyz, starxyz+3, 3))) /
+            distsq(field, field+2, 2);
+        if (abscale > solver->abscale_high ||
+            abscale < solver->abscale_low) {
+            solver->num_abscale_skipped++;
+            continue;
+        }
+
+        // compute TAN projection from the matching quad alone.
+        if (fit_tan_wcs(starxyz, field, DQ, &wcs, &scale)) {
+            // bad quad.
+            logverb("bad quad at %s:%i\n", __FILE__, __LINE__);
+            continue;
+        }
+        arcsecperpix = scale * 3600.0;
+
+        // FIXME - should there be scale fudge here?
+        if (arcsecperpix > solver->funits_upper ||
+            arcsecperpix < solver->funits_lower) {
+            debug("          bad scale (%g arcsec/pix, range %g %g)\n",
+                  arcsecperpix, solver->funits_lower, solver->funits_upper);
+            continue;
+        }
+        solver->numscaleok++;
+
+        set_matchobj_template(solver, &mo);
+        memcpy(&(mo.wcstan), &wcs, sizeof(tan_t));
+        mo.wcs_valid = TRUE;
+        mo.code_err = krez->sdists[jj];
+        mo.scale = arcsecperpix;
+        mo.parity = current_parity;
+        mo.quads_tried = solver->numtries;
+        mo.quads_matched = solver->nummatches;
+        mo.quads_scaleok = solver->numscaleok;
+        mo.quad_npeers = krez->nres;
+        mo.timeused = solver->timeused;
+        mo.quadno = thisquadno;
+        mo.dimquads = DQ;
+        for (i=0; i<DQ; i++) {
+            mo.star[i] = star[i];
+            mo.field[i] = fieldstars[i];
+            mo.ids[i] = 0;
+        }
+
+        memcpy(mo.quadpix, field, 2 * DQ * sizeof(double));
+        memcpy(mo.quadxyz, starxyz, 3 * DQ * sizeof(double));
+
+        set_center_and_radius(solver, &mo, &(mo.wcstan), NULL);
+
+        if (solver_handle_hit(solver, &mo, NULL, FALSE))
+            solver->quit_now = TRUE;
+
+        if (unlikely(solver->quit_now))
+            return;
+    }
+}
+
+/**
+ Searches the code kd-tree for all the codes of a quad in one pass,
+ then resolves the matches of each code in the order they were built.
+ */
+static void DQFUNC(search_codes)(const codebatch_t* batch,
+                                 solver_t* solver, double tol2) {
+    int i, j;
+    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+
+    if (batch->n == 0)
+        return;
+
+    if (!kdtree_rangesearch_batch(solver->index->codekd->tree,
+                                  solver->code_results, batch->codes,
+                                  batch->n, tol2, options)) {
+        ERROR("Failed to search the code kd-tree");
+        return;
+    }
+
+    for (i=0; i<batch->n; i++) {
+        double pixvals[DQ*2];
+        if (!solver->code_results[i]->nres)
+            continue;
+        for (j=0; j<DQ; j++) {
+            setx(pixvals, j, field_getx(solver, batch->stars[i][j]));
+            sety(pixvals, j, field_gety(solver, batch->stars[i][j]));
+        }
+        DQFUNC(resolve_matches)(solver->code_results[i], pixvals, batch->stars[i],
+                                solver, batch->parity[i]);
+        if (unlikely(solver->quit_now))
+            return;
+    }
+}
+
+/**
+ This functions tries the different orders of the non-backbone
+ stars C [, D [,E ] ], adding each one that passes the cx <= dx and
+ meanx <= 1/2 checks to "batch".
+
+ The orders come from the permutation table.  A star that fails a
+ check in some slot fails it for every order starting the same way, so
+ those orders are skipped, just as the recursive search skipped them.
+ "stars" already holds stars A and B.
+ */
+static void DQFUNC(try_permutations)(const int* origstars, const double* origcode,
+                                     solver_t* solver, anbool current_parity,
+                                     int* stars, codebatch_t* batch) {
+    double code[DQ_NCODE];
+    anbool cxdx = solver->index->cx_less_than_dx;
+    anbool meanx_half = cxdx && solver->index->meanx_less_than_half;
+    // the slot where the last order failed a check, (DQ - 2) if it didn't
+    int failed = DQ - 2;
+    int p, s, same;
+
+    for (p=0; p<DQ_NPERMS; p++) {
+        const int* perm = DQFUNC(perms)[p];
+        // slots [0, same) hold the same stars as in the last order
+        same = 0;
+        if (p > 0)
+            while (same < DQ - 2 && perm[same] == DQFUNC(perms)[p-1][same])
+                same++;
+        if (same > failed)
+            continue;
+        failed = DQ - 2;
+
+        for (s=same; s<DQ - 2; s++) {
+            int i = perm[s];
+            // Check cx <= dx, if we're a "dx".
+            if (s > 0 && cxdx) {
+                if (code[2*(s - 1) +0] > origcode[2*i +0] + solver->cxdx_margin) {
+                    debug("cx <= dx check failed: %g > %g + %g\n",
+                          code[2*(s - 1) +0], origcode[2*i +0],
+                          solver->cxdx_margin);
+                    solver->num_cxdx_skipped++;
+                    failed = s;
+                    break;
+                }
+            }
+
+            // Slot in this star...
+            stars[s + NBACK] = origstars[i + NBACK];
+            code[2*s +0] = origcode[2*i +0];
+            code[2*s +1] = origcode[2*i +1];
+
+            // Check meanx <= 1/2.
+            if (meanx_half) {
+                // Check the "cx + dx <= 1" condition (for quads); in general,
+                // combined with the "cx <= dx" condition, this means that the
+                // mean(x) <= 1/2.
+                int j;
+                double meanx = 0;
+                for (j=0; j<=s; j++)
+                    meanx += code[2*j];
+                meanx /= (s+1);
+                if (meanx > 0.5 + solver->cxdx_margin) {
+                    debug("meanx <= 0.5 check failed: %g > 0.5 + %g\n",
+                          meanx, solver->cxdx_margin);
+                    solver->num_meanx_skipped++;
+                    failed = s;
+                    break;
+                }
+            }
+        }
+        if (failed < DQ - 2)
+            continue;
+
+#if defined(TESTING_TRYPERMUTATIONS)
+        TEST_TRY_PERMUTATIONS(stars, code, DQ, solver);
+        continue;
+#endif
+
+        // Queue the code we've built.
+        assert(batch->n < SOLVER_MAX_CODES);
+        memcpy(batch->codes + batch->n * DQ_NCODE, code,
+               DQ_NCODE * sizeof(double));
+        memcpy(batch->stars[batch->n], stars, DQ * sizeof(int));
+        batch->parity[batch->n] = current_parity;
+        batch->n++;
+    }
+}
+
+/**
+ This function tries the quad with the "backbone" stars A and B in
+ normal and flipped configurations.
+ */
+static void DQFUNC(try_all_codes_2)(const int* fieldstars, const double* code,
+                                    solver_t* solver, anbool current_parity,
+                                    codebatch_t* batch) {
+    int i;
+    int stars[DQ];
+    double flipcode[DQ_NCODE];
+
+    // Un-flipped:
+    stars[0] = fieldstars[0];
+    stars[1] = fieldstars[1];
+    DQFUNC(try_permutations)(fieldstars, code, solver, current_parity, stars, batch);
+
+    // Flipped:
+    stars[0] = fieldstars[1];
+    stars[1] = fieldstars[0];
+    for (i=0; i<DQ_NCODE; i++)
+        flipcode[i] = 1.0 - code[i];
+    DQFUNC(try_permutations)(fieldstars, flipcode, solver, current_parity, stars, batch);
+}
+
+/**
+ All the stars in this quad have been chosen.  Figure out which
+ permutations of stars CDE are valid and search for matches.
+ */
+static void DQFUNC(try_all_codes)(const pquad* pq, const int* fieldstars,
+                                  solver_t* solver, double tol2) {
+    double code[DQ_NCODE];
+    double flipcode[DQ_NCODE];
+    codebatch_t batch;
+    int i;
+
+    solver->numtries++;
+    batch.n = 0;
+
+    debug("  trying quad [");
+    for (i=0; i<DQ; i++) {
+        debug("%s%i", (i?" ":""), fieldstars[i]);
+    }
+    debug("]\n");
+
+    for (i=0; i<DQ-NBACK; i++) {
+        code[2*i  ] = getx(pq->xy, fieldstars[NBACK+i]);
+        code[2*i+1] = gety(pq->xy, fieldstars[NBACK+i]);
+    }
+
+    if (solver->parity == PARITY_NORMAL ||
+        solver->parity == PARITY_BOTH) {
+
+        debug("    trying normal parity: code=[");
+        for (i=0; i<DQ_NCODE; i++)
+            debug("%s%g", (i?", ":""), code[i]);
+        debug("].\n");
+
+        DQFUNC(try_all_codes_2)(fieldstars, code, solver, FALSE, &batch);
+    }
+    if (solver->parity == PARITY_FLIP ||
+        solver->parity == PARITY_BOTH) {
+
+        quad_flip_parity(code, flipcode, DQ_NCODE);
+
+        debug("    trying reverse parity: code=[");
+        for (i=0; i<DQ_NCODE; i++)
+            debug("%s%g", (i?", ":""), flipcode[i]);
+        debug("].\n");
+
+        DQFUNC(try_all_codes_2)(fieldstars, flipcode, solver, TRUE, &batch);
+    }
+
+    DQFUNC(search_codes)(&batch, solver, tol2);
+}
+
+#undef DQ_NCODE
@@ -62,9 +62,358 @@ struct verify_s {
     // temp storage
     int* tbadguys;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // storage reused between verifications, NULL to allocate it for just this one
+    struct verify_scratch_t* scratch;
 };
 typedef struct verify_s verify_t;
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Instead of building a kd-tree of the reference stars for every hypothesis, they are put
+// in a uniform grid of cells, which takes one counting sort.  The grid and the other
+// per-hypothesis arrays are kept here and only grow, so verifying the thousands of false
+// matches in a blind solve doesn't allocate anything once they are big enough.
+#define VERIFY_GRID_MAX 256
+
+// The field side of verification doesn't change during a solve either, so the neighbours used
+// to deduplicate the field stars and the bins used to uniformize them are cached here as well.
+// The neighbour lists grow by powers of two in radius**2 up to a radius holding this many
+// neighbours per star on average; field stars needing a larger radius still use the kd-tree.
+#define VERIFY_DEDUP_NEIGHBOURS 16
+// How many uniformization grid sizes to keep the bins for.
+#define VERIFY_UNIBINS 4
+
+static int get_xy_bin(const double* xy,
+                      double fieldW, double fieldH,
+                      int nw, int nh);
+
+struct verify_unibins_t {
+    double fieldW, fieldH;
+    int nw, nh;
+    // per field star
+    int* binids;
+    double* centers;
+};
+typedef struct verify_unibins_t verify_unibins_t;
+
+struct verify_scratch_t {
+    // The grid of reference stars in pixel space
+    double gridx0, gridy0, gridcell;
+    int gridnx, gridny;
+    // cell c holds the reference stars cellrefs[cellstart[c]] to cellrefs[cellstart[c+1]-1]
+    int* cellstart;
+    int cellcap;
+    int* cellrefs;
+    // the reference star positions in the order of cellrefs
+    double* cellxy;
+    // per reference star
+    int* rmatches;
+    double* rprobs;
+    int refcap;
+    // per test star
+    int* theta;
+    double* all_logodds;
+    int testcap;
+
+    // per field star, allocated once
+    int NF;
+    double* sigma2;
+    int* tbadguys;
+    anbool* keepers;
+    int* binids;
+    int* binmembers;
+    // per uniformization bin
+    int* binstart;
+    anbool* goodbins;
+    int bincap;
+    // neighbours of field star i with a larger index, within sqrt(nbrr2):
+    // nbrind[nbrstart[i]] to nbrind[nbrstart[i+1]-1], at squared distances nbrd2
+    double nbrr2;
+    double nbrmaxr2;
+    int* nbrstart;
+    int* nbrind;
+    double* nbrd2;
+    verify_unibins_t unibins[VERIFY_UNIBINS];
+    int nextunibins;
+};
+typedef struct verify_scratch_t verify_scratch_t;
+
+static void scratch_reserve(verify_scratch_t* s, int NR, int NT, int ncells) {
+    if (NR > s->refcap) {
+        free(s->cellrefs);
+        free(s->cellxy);
+        free(s->rmatches);
+        free(s->rprobs);
+        s->refcap = NR;
+        s->cellrefs = malloc(NR * sizeof(int));
+        s->cellxy = malloc(2 * NR * sizeof(double));
+        s->rmatches = malloc(NR * sizeof(int));
+        s->rprobs = malloc(NR * sizeof(double));
+    }
+    if (NT > s->testcap) {
+        free(s->theta);
+        free(s->all_logodds);
+        s->testcap = NT;
+        s->theta = malloc(NT * sizeof(int));
+        s->all_logodds = malloc(NT * sizeof(double));
+    }
+    if (ncells + 1 > s->cellcap) {
+        free(s->cellstart);
+        s->cellcap = ncells + 1;
+        s->cellstart = malloc(s->cellcap * sizeof(int));
+    }
+}
+
+static void scratch_free(verify_scratch_t* s) {
+    int i;
+    if (!s)
+        return;
+    free(s->cellstart);
+    free(s->cellrefs);
+    free(s->cellxy);
+    free(s->rmatches);
+    free(s->rprobs);
+    free(s->theta);
+    free(s->all_logodds);
+    free(s->sigma2);
+    free(s->tbadguys);
+    free(s->keepers);
+    free(s->binids);
+    free(s->binmembers);
+    free(s->binstart);
+    free(s->goodbins);
+    free(s->nbrstart);
+    free(s->nbrind);
+    free(s->nbrd2);
+    for (i=0; i<VERIFY_UNIBINS; i++) {
+        free(s->unibins[i].binids);
+        free(s->unibins[i].centers);
+    }
+}
+
+// Makes sure the per-field-star arrays exist; the field never changes so this only allocates once.
+static void scratch_reserve_field(verify_scratch_t* s, int NF) {
+    if (s->sigma2 && NF <= s->NF)
+        return;
+    free(s->sigma2);
+    free(s->tbadguys);
+    free(s->keepers);
+    free(s->binids);
+    free(s->binmembers);
+    s->NF = NF;
+    s->sigma2 = malloc(MAX(NF, 1) * sizeof(double));
+    s->tbadguys = malloc(MAX(NF, 1) * sizeof(int));
+    s->keepers = malloc(MAX(NF, 1) * sizeof(anbool));
+    s->binids = malloc(MAX(NF, 1) * sizeof(int));
+    s->binmembers = malloc(MAX(NF, 1) * sizeof(int));
+}
+
+static void scratch_reserve_bins(verify_scratch_t* s, int nbins) {
+    if (nbins + 1 <= s->bincap)
+        return;
+    free(s->binstart);
+    free(s->goodbins);
+    s->bincap = nbins + 1;
+    s->binstart = malloc(s->bincap * sizeof(int));
+    s->goodbins = malloc(s->bincap * sizeof(anbool));
+}
+
+// (Re)builds the neighbour lists of the field stars for a radius**2 of at least "r2", if the
+// cap allows it.
+static void scratch_build_neighbours(verify_scratch_t* s, const verify_field_t* vf, double r2) {
+    int i, j, N, n, cap;
+    kdtree_qres_t* res = NULL;
+    int options = KD_OPTIONS_COMPUTE_DISTS | KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_SMALL_RADIUS;
+
+    N = starxy_n(vf->field);
+    if (N < 2)
+        return;
+    if (s->nbrmaxr2 == 0) {
+        double x0, y0, x1, y1;
+        x0 = y0 = HUGE_VAL;
+        x1 = y1 = -HUGE_VAL;
+        for (i=0; i<N; i++) {
+            x0 = MIN(x0, vf->xy[2*i+0]);
+            y0 = MIN(y0, vf->xy[2*i+1]);
+            x1 = MAX(x1, vf->xy[2*i+0]);
+            y1 = MAX(y1, vf->xy[2*i+1]);
+        }
+        s->nbrmaxr2 = VERIFY_DEDUP_NEIGHBOURS * MAX(x1 - x0, 1.0) * MAX(y1 - y0, 1.0) / (M_PI * N);
+    }
+    r2 = MIN(exp2(ceil(log2(r2))), s->nbrmaxr2);
+    if (r2 <= s->nbrr2)
+        return;
+
+    free(s->nbrstart);
+    free(s->nbrind);
+    free(s->nbrd2);
+    cap = 4 * N;
+    s->nbrstart = malloc((N + 1) * sizeof(int));
+    s->nbrind = malloc(cap * sizeof(int));
+    s->nbrd2 = malloc(cap * sizeof(double));
+    n = 0;
+    for (i=0; i<N; i++) {
+        s->nbrstart[i] = n;
+        res = kdtree_rangesearch_options_reuse(vf->ftree, res, vf->xy + 2*i, r2, options);
+        for (j=0; j<res->nres; j++) {
+            if (res->inds[j] <= i)
+                continue;
+            if (n == cap) {
+                cap *= 2;
+                s->nbrind = realloc(s->nbrind, cap * sizeof(int));
+                s->nbrd2 = realloc(s->nbrd2, cap * sizeof(double));
+            }
+            s->nbrind[n] = res->inds[j];
+            s->nbrd2[n] = res->sdists[j];
+            n++;
+        }
+    }
+    s->nbrstart[N] = n;
+    kdtree_free_query(res);
+    s->nbrr2 = r2;
+    debug2("Cached %i field star neighbours within %g pixels\n", n, sqrt(r2));
+}
+
+// Finds (or computes) the uniformization bin of every field star for an nw x nh grid.
+static const verify_unibins_t* scratch_get_unibins(verify_scratch_t* s, const verify_field_t* vf,
+                                                   double fieldW, double fieldH, int nw, int nh) {
+    int i, N;
+    verify_unibins_t* ub;
+    for (i=0; i<VERIFY_UNIBINS; i++) {
+        ub = s->unibins + i;
+        if (ub->binids && ub->nw == nw && ub->nh == nh &&
+            ub->fieldW == fieldW && ub->fieldH == fieldH)
+            return ub;
+    }
+    ub = s->unibins + s->nextunibins;
+    s->nextunibins = (s->nextunibins + 1) % VERIFY_UNIBINS;
+    free(ub->binids);
+    free(ub->centers);
+    N = starxy_n(vf->field);
+    ub->fieldW = fieldW;
+    ub->fieldH = fieldH;
+    ub->nw = nw;
+    ub->nh = nh;
+    ub->binids = malloc(MAX(N, 1) * sizeof(int));
+    for (i=0; i<N; i++)
+        ub->binids[i] = get_xy_bin(vf->xy + 2*i, fieldW, fieldH, nw, nh);
+    ub->centers = verify_uniformize_bin_centers(fieldW, fieldH, nw, nh);
+    return ub;
+}
+
+// Does what verify_uniformize_field() does, with the cached bins; "binids" gets the bin of
+// each star in the new order.
+static void scratch_uniformize(verify_scratch_t* s, const verify_unibins_t* ub,
+                               int* perm, int N, int* binids) {
+    int i, b, k, p, nbins;
+    nbins = ub->nw * ub->nh;
+    scratch_reserve_bins(s, nbins);
+    if (N <= 0)
+        return;
+    // put the stars in their bins, keeping their order
+    memset(s->binstart, 0, (nbins + 1) * sizeof(int));
+    for (i=0; i<N; i++)
+        s->binstart[ub->binids[perm[i]] + 1]++;
+    for (b=0; b<nbins; b++)
+        s->binstart[b + 1] += s->binstart[b];
+    for (i=0; i<N; i++) {
+        b = ub->binids[perm[i]];
+        s->binmembers[s->binstart[b]++] = perm[i];
+    }
+    for (b=nbins; b>0; b--)
+        s->binstart[b] = s->binstart[b - 1];
+    s->binstart[0] = 0;
+    // make sweeps through the bins, grabbing one star from each.
+    p = 0;
+    for (k=0; p<N; k++) {
+        for (b=0; b<nbins; b++) {
+            if (k >= s->binstart[b + 1] - s->binstart[b])
+                continue;
+            perm[p] = s->binmembers[s->binstart[b] + k];
+            binids[p] = b;
+            p++;
+        }
+    }
+}
+
+// Sorts the reference stars (in "refperm" order) into the grid cells, and makes sure there is room for NT test stars.
+static void scratch_build_grid(verify_scratch_t* s, const verify_t* v) {
+    int i, c, ncells;
+    double x1, y1, W, H;
+    const double* xy;
+
+    s->gridx0 = s->gridy0 = HUGE_VAL;
+    x1 = y1 = -HUGE_VAL;
+    for (i=0; i<v->NR; i++) {
+        xy = v->refxy + 2 * v->refperm[i];
+        s->gridx0 = MIN(s->gridx0, xy[0]);
+        s->gridy0 = MIN(s->gridy0, xy[1]);
+        x1 = MAX(x1, xy[0]);
+        y1 = MAX(y1, xy[1]);
+    }
+    W = MAX(x1 - s->gridx0, 1.0);
+    H = MAX(y1 - s->gridy0, 1.0);
+    // about one reference star per cell
+    s->gridcell = MAX(sqrt(W * H / v->NR), MAX(W, H) / VERIFY_GRID_MAX);
+    s->gridnx = MIN((int)(W / s->gridcell) + 1, VERIFY_GRID_MAX + 1);
+    s->gridny = MIN((int)(H / s->gridcell) + 1, VERIFY_GRID_MAX + 1);
+    ncells = s->gridnx * s->gridny;
+    scratch_reserve(s, v->NR, v->NT, ncells);
+
+    memset(s->cellstart, 0, (ncells + 1) * sizeof(int));
+    for (i=0; i<v->NR; i++) {
+        xy = v->refxy + 2 * v->refperm[i];
+        c = (int)((xy[1] - s->gridy0) / s->gridcell) * s->gridnx + (int)((xy[0] - s->gridx0) / s->gridcell);
+        s->cellstart[c + 1]++;
+    }
+    for (c=0; c<ncells; c++)
+        s->cellstart[c + 1] += s->cellstart[c];
+    // fill the cells, each start moves along as its cell fills up
+    for (i=0; i<v->NR; i++) {
+        int k;
+        xy = v->refxy + 2 * v->refperm[i];
+        c = (int)((xy[1] - s->gridy0) / s->gridcell) * s->gridnx + (int)((xy[0] - s->gridx0) / s->gridcell);
+        k = s->cellstart[c]++;
+        s->cellrefs[k] = i;
+        s->cellxy[2*k+0] = xy[0];
+        s->cellxy[2*k+1] = xy[1];
+    }
+    // now each start is where the next cell starts
+    for (c=ncells; c>0; c--)
+        s->cellstart[c] = s->cellstart[c - 1];
+    s->cellstart[0] = 0;
+}
+
+// Returns the nearest reference star within sqrt(maxd2) of "xy", as an index in "refperm" order, or -1.
+static int scratch_nearest_within(const verify_scratch_t* s, const double* xy, double maxd2, double* p_d2) {
+    int cx0, cx1, cy0, cy1, cx, cy, k;
+    int ibest = -1;
+    double bestd2 = maxd2;
+    double r = sqrt(maxd2);
+
+    cx0 = MAX((int)floor((xy[0] - r - s->gridx0) / s->gridcell), 0);
+    cx1 = MIN((int)floor((xy[0] + r - s->gridx0) / s->gridcell), s->gridnx - 1);
+    cy0 = MAX((int)floor((xy[1] - r - s->gridy0) / s->gridcell), 0);
+    cy1 = MIN((int)floor((xy[1] + r - s->gridy0) / s->gridcell), s->gridny - 1);
+    for (cy=cy0; cy<=cy1; cy++) {
+        for (cx=cx0; cx<=cx1; cx++) {
+            int c = cy * s->gridnx + cx;
+            for (k=s->cellstart[c]; k<s->cellstart[c + 1]; k++) {
+                double dx = s->cellxy[2*k+0] - xy[0];
+                double dy = s->cellxy[2*k+1] - xy[1];
+                double d2 = dx*dx + dy*dy;
+                if (d2 <= bestd2) {
+                    bestd2 = d2;
+                    ibest = s->cellrefs[k];
+                }
+            }
+        }
+    }
+    if (ibest != -1 && p_d2)
+        *p_d2 = bestd2;
+    return ibest;
+}
+
 static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
 
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
@@ -96,6 +445,8 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     vf->do_dedup = TRUE;
     vf->do_ror = TRUE;
 
+    vf->scratch = calloc(1, sizeof(verify_scratch_t)); //# Modified by Robert Lancaster for the StellarSolver Internal Library
+
     return vf;
 }
 
@@ -105,6 +456,9 @@ void verify_field_free(verify_field_t* vf) {
     kdtree_free(vf->ftree);
     free(vf->xy);
     free(vf->fieldcopy);
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    scratch_free(vf->scratch);
+    free(vf->scratch);
     free(vf);
 }
 
@@ -112,15 +466,17 @@ static double get_sigma2_at_radius(double verify_pix2, double r2, double quadr2)
     return verify_pix2 * (1.0 + r2/quadr2);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, to fill "sigma2s" if it is given
 static double* compute_sigma2s(const verify_field_t* vf,
                                const double* xy, int NF,
                                const double* qc, double Q2,
-                               double verify_pix2, anbool do_gamma) {
-    double* sigma2s;
+                               double verify_pix2, anbool do_gamma,
+                               double* sigma2s) {
     int i;
     double R2;
 
-    sigma2s = malloc(NF * sizeof(double));
+    if (!sigma2s)
+        sigma2s = malloc(NF * sizeof(double));
     if (!do_gamma) {
         for (i=0; i<NF; i++)
             sigma2s[i] = verify_pix2;
@@ -143,8 +499,9 @@ static double* compute_sigma2s(const verify_field_t* vf,
     return sigma2s;
 }
 
-double* verify_compute_sigma2s(const verify_field_t* vf, const MatchObj* mo,
-                               double verify_pix2, anbool do_gamma) {
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+static double* compute_field_sigma2s(const verify_field_t* vf, const MatchObj* mo,
+                                     double verify_pix2, anbool do_gamma, double* sigma2s) {
     int NF;
     double qc[2];
     double Q2=0;
@@ -153,13 +510,18 @@ double* verify_compute_sigma2s(const verify_field_t* vf, const MatchObj* mo,
         verify_get_quad_center(vf, mo, qc, &Q2);
         debug2("Quad radius = %g pixels\n", sqrt(Q2));
     }
-    return compute_sigma2s(vf, NULL, NF, qc, Q2, verify_pix2, do_gamma);
+    return compute_sigma2s(vf, NULL, NF, qc, Q2, verify_pix2, do_gamma, sigma2s);
+}
+
+double* verify_compute_sigma2s(const verify_field_t* vf, const MatchObj* mo,
+                               double verify_pix2, anbool do_gamma) {
+    return compute_field_sigma2s(vf, mo, verify_pix2, do_gamma, NULL);
 }
 
 double* verify_compute_sigma2s_arr(const double* xy, int NF,
                                    const double* qc, double Q2,
                                    double verify_pix2, anbool do_gamma) {
-    return compute_sigma2s(NULL, xy, NF, qc, Q2, verify_pix2, do_gamma);
+    return compute_sigma2s(NULL, xy, NF, qc, Q2, verify_pix2, do_gamma, NULL);
 }
 
 static double logd_at(double distractor, int mu, int NR, double logbg) {
@@ -195,9 +557,16 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
     v->NTall = starxy_n(vf->field);
     v->testxy = vf->xy;
     v->NT = v->NTall;
-    v->testsigma = verify_compute_sigma2s(vf, mo, pix2, do_gamma);
     v->testperm = permutation_init(NULL, v->NTall);
-    v->tbadguys = malloc(v->NTall * sizeof(int));
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, to use the scratch storage if there is some
+    if (v->scratch) {
+        scratch_reserve_field(v->scratch, v->NTall);
+        v->testsigma = compute_field_sigma2s(vf, mo, pix2, do_gamma, v->scratch->sigma2);
+        v->tbadguys = v->scratch->tbadguys;
+    } else {
+        v->testsigma = verify_compute_sigma2s(vf, mo, pix2, do_gamma);
+        v->tbadguys = malloc(v->NTall * sizeof(int));
+    }
 
     if (DEBUGVERIFY) {
         debug2("start:\n");
@@ -206,10 +575,10 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
     }
 
     if (vf->do_dedup) {
-        // Deduplicate test stars.  This could be done (approximately) in preprocessing.
+        // Deduplicate test stars.  With scratch storage, the neighbours of the field stars
+        // are cached at a power-of-two radius**2 (see scratch_build_neighbours()).
         // FIXME -- this should be at the reference deduplication radius, not relative to sigma!
         // -- this requires the match scale
-        // -- can perhaps discretize dedup to nearest power-of-sqrt(2) pixel radius and cache it.
         // -- we can compute sigma much later
         keepers = verify_deduplicate_field_stars(v, vf, 1.0);
 
@@ -268,7 +637,8 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
     v->NT = igood;
     // remember the bad guys
     memcpy(v->testperm + igood, v->tbadguys, ibad * sizeof(int));
-    free(keepers);
+    if (!v->scratch) //# Modified by Robert Lancaster for the StellarSolver Internal Library
+        free(keepers);
 
     if (DEBUGVERIFY) {
         debug2("after dedup and removing quad:\n");
@@ -301,6 +671,7 @@ static void verify_apply_ror(verify_t* v,
     int igood, ibad;
     int* binids = NULL;
     double* bincenters = NULL;
+    const verify_unibins_t* ub = NULL; //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
     // If we're verifying an existing WCS solution, then don't increase the variance
     // away from the center of the matched quad.
@@ -315,7 +686,8 @@ static void verify_apply_ror(verify_t* v,
         verify_get_quad_center(vf, mo, qc, &Q2);
 
     // Uniformize test stars
-    // FIXME - can do this (possibly at several scales) in preprocessing.
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // With scratch storage, the bins of the field stars are cached for each grid size.
     if (vf->do_uniformize) {
         // -get uniformization scale.
         verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &uni_nw, &uni_nh);
@@ -323,8 +695,15 @@ static void verify_apply_ror(verify_t* v,
 
         // uniformize!
         if (uni_nw > 1 || uni_nh > 1) {
-            verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
-            bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
+            if (v->scratch) {
+                ub = scratch_get_unibins(v->scratch, vf, fieldW, fieldH, uni_nw, uni_nh);
+                binids = v->scratch->binids;
+                scratch_uniformize(v->scratch, ub, v->testperm, v->NT, binids);
+                bincenters = ub->centers;
+            } else {
+                verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
+                bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
+            }
 
             if (DEBUGVERIFY) {
                 debug2("after uniformizing:\n");
@@ -344,7 +723,11 @@ static void verify_apply_ror(verify_t* v,
 
         if (binids) {
             assert(uni_nw);
-            goodbins = malloc(uni_nw * uni_nh * sizeof(anbool));
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            if (ub)
+                goodbins = v->scratch->goodbins;
+            else
+                goodbins = malloc(uni_nw * uni_nh * sizeof(anbool));
             Ngoodbins = 0;
             for (i=0; i<(uni_nw * uni_nh); i++) {
                 double binr2 = distsq(bincenters + 2*i, qc, 2);
@@ -382,7 +765,12 @@ static void verify_apply_ror(verify_t* v,
             assert(!bincenters);
             if (!uni_nw)
                 verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &uni_nw, &uni_nh);
-            bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
+            //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            if (v->scratch) {
+                ub = scratch_get_unibins(v->scratch, vf, fieldW, fieldH, uni_nw, uni_nh);
+                bincenters = ub->centers;
+            } else
+                bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
             Ngoodbins = 0;
             for (i=0; i<(uni_nw * uni_nh); i++) {
                 double binr2 = distsq(bincenters + 2*i, qc, 2);
@@ -442,10 +830,14 @@ static void verify_apply_ror(verify_t* v,
         debug2("ROR changed from %g to %g\n", sqrt(ror2),
                sqrt(verify_get_ror2(Q2, effA, distractors, v->NR, pix2)));
 
-        free(goodbins);
+        if (!ub) //# Modified by Robert Lancaster for the StellarSolver Internal Library
+            free(goodbins);
+    }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, these belong to the scratch storage if it was used
+    if (!ub) {
+        free(bincenters);
+        free(binids);
     }
-    free(bincenters);
-    free(binids);
 
     *p_effA = effA;
     if (p_uninw)
@@ -472,9 +864,9 @@ static double real_verify_star_lists(verify_t* v,
     double logbg;
     double logd;
     //double matchnsigma = 5.0;
-    double* refcopy;
-    kdtree_t* rtree;
-    int Nleaf = 10;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, the kd-tree of reference stars was replaced by the scratch grid
+    verify_scratch_t localscratch;
+    verify_scratch_t* s;
     int* rmatches;
     double* rprobs;
     double* all_logodds = NULL;
@@ -487,32 +879,38 @@ static double real_verify_star_lists(verify_t* v,
         return -HUGE_VAL;
     }
 
-    // Build a tree out of the index stars in pixel space...
-    // kdtree scrambles the data array so make a copy first.
-    refcopy = malloc(2 * v->NR * sizeof(double));
-    // we must pack/unpermute the refxys; remember this packing order in "rperm".
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Put the index stars in pixel space into a grid, in the reusable storage if there is some.
+    s = v->scratch;
+    if (!s) {
+        memset(&localscratch, 0, sizeof(verify_scratch_t));
+        s = &localscratch;
+    }
+    scratch_build_grid(s, v);
+    // The grid gives back the stars in "refperm" order; "rperm" maps them to the refxys.
     // we borrow storage for "rperm"...
     if (!v->badguys)
         v->badguys = malloc(v->NR * sizeof(int));
     rperm = v->badguys;
-    for (i=0; i<v->NR; i++) {
-        int ri = v->refperm[i];
-        rperm[i] = ri;
-        refcopy[2*i+0] = v->refxy[2*ri+0];
-        refcopy[2*i+1] = v->refxy[2*ri+1];
-    }
-    rtree = kdtree_build(NULL, refcopy, v->NR, 2, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+    for (i=0; i<v->NR; i++)
+        rperm[i] = v->refperm[i];
 
-    rmatches = malloc(v->NR * sizeof(int));
+    rmatches = s->rmatches;
     for (i=0; i<v->NR; i++)
         rmatches[i] = -1;
 
-    rprobs = malloc(v->NR * sizeof(double));
+    rprobs = s->rprobs;
     for (i=0; i<v->NR; i++)
         rprobs[i] = -HUGE_VAL;
 
-    if (p_logodds || data_log_passes(DATALOG_MASK_VERIFY, DLOG_ODDS))
-        all_logodds = calloc(v->NT, sizeof(double));
+    // With reusable storage, theta and all_logodds belong to it and the caller must not free them.
+    if (p_logodds || data_log_passes(DATALOG_MASK_VERIFY, DLOG_ODDS)) {
+        if (v->scratch) {
+            all_logodds = s->all_logodds;
+            memset(all_logodds, 0, v->NT * sizeof(double));
+        } else
+            all_logodds = calloc(v->NT, sizeof(double));
+    }
     if (p_logodds)
         *p_logodds = all_logodds;
 	
@@ -521,7 +919,12 @@ static double real_verify_star_lists(verify_t* v,
     if (p_istopped)
         *p_istopped = -1;
 
-    theta = calloc(v->NT, sizeof(int)); //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning since items in theta got checked before initialization
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning since items in theta got checked before initialization
+    if (v->scratch) {
+        theta = s->theta;
+        memset(theta, 0, v->NT * sizeof(int));
+    } else
+        theta = calloc(v->NT, sizeof(int));
 
     logbg = log(1.0 / effective_area);
 
@@ -551,7 +954,7 @@ static double real_verify_star_lists(verify_t* v,
         debug2("test star %i: (%.1f,%.1f), sigma: %.1f\n", i, testxy[0], testxy[1], sqrt(sig2));
 
         // find nearest ref star (within 5 sigma)
-        tmpi = kdtree_nearest_neighbour_within(rtree, testxy, sig2 * 25.0, &d2);
+        tmpi = scratch_nearest_within(s, testxy, sig2 * 25.0, &d2); //# Modified by Robert Lancaster for the StellarSolver Internal Library
         if (tmpi == -1) {
             // no nearest neighbour within range.
             debug2("  No nearest neighbour.\n");
@@ -559,8 +962,8 @@ static double real_verify_star_lists(verify_t* v,
             logfg = -HUGE_VAL;
         } else {
             double loggmax;
-            // Note that "refi" is w.r.t. the "refcopy" array (not the original data).
-            refi = kdtree_permute(rtree, tmpi);
+            // Note that "refi" is w.r.t. the "refperm" order (not the original data).
+            refi = tmpi; //# Modified by Robert Lancaster for the StellarSolver Internal Library
             // peak value of the Gaussian
             loggmax = log((1.0 - distractors) / (2.0 * M_PI * sig2 * v->NR));
             // FIXME - do something with uninformative hits?
@@ -761,11 +1164,10 @@ static double real_verify_star_lists(verify_t* v,
          */
     }
 
-    free(rmatches);
-
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
     if (p_theta)
         *p_theta = theta;
-    else
+    else if (!v->scratch)
         free(theta);
 
     if (p_besti)
@@ -774,13 +1176,12 @@ static double real_verify_star_lists(verify_t* v,
     if (p_worstlogodds)
         *p_worstlogodds = bestworstlogodds;
 
-    if (all_logodds && !*p_logodds)
+    if (all_logodds && !v->scratch && !(p_logodds && *p_logodds)) //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(all_logodds);
 
-    free(rprobs);
-
-    kdtree_free(rtree);
-    free(refcopy);
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (s == &localscratch)
+        scratch_free(&localscratch);
 
     return bestlogodds;
 }
@@ -872,9 +1273,20 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
     kdtree_qres_t* res = NULL;
     double nsig2 = nsigmas*nsigmas;
     int options = KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_SMALL_RADIUS;
+    verify_scratch_t* s = v->scratch; //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
     // default to FALSE
-    keepers = calloc(v->NTall, sizeof(anbool));
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, to use the scratch storage and cached neighbours if there are some
+    if (s) {
+        double maxr2 = 0;
+        keepers = s->keepers;
+        memset(keepers, 0, v->NTall * sizeof(anbool));
+        for (i=0; i<v->NT; i++)
+            maxr2 = MAX(maxr2, nsig2 * v->testsigma[v->testperm[i]]);
+        if (maxr2 > s->nbrr2)
+            scratch_build_neighbours(s, vf, maxr2);
+    } else
+        keepers = calloc(v->NTall, sizeof(anbool));
     for (i=0; i<v->NT; i++) {
         ti = v->testperm[i];
         keepers[ti] = TRUE;
@@ -884,6 +1296,14 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
         ti = v->testperm[i];
         if (!keepers[ti])
             continue;
+        // "testperm" is still the identity here, so the neighbours with a larger index are the ones after "i"
+        if (s && nsig2 * v->testsigma[ti] <= s->nbrr2) {
+            double r2 = nsig2 * v->testsigma[ti];
+            for (j=s->nbrstart[ti]; j<s->nbrstart[ti + 1]; j++)
+                if (s->nbrd2[j] <= r2)
+                    keepers[s->nbrind[j]] = FALSE;
+            continue;
+        }
         starxy_get(vf->field, ti, sxy);
         res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, nsig2 * v->testsigma[ti], options);
         for (j=0; j<res->nres; j++) {
@@ -1257,6 +1677,7 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
     assert(isfinite(logbail));
 
     memset(v, 0, sizeof(verify_t));
+    v->scratch = vf->scratch; //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
     if (sip)
         v->wcs = sip;
@@ -1492,11 +1913,14 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 
  cleanup:
     free(refxyz);
-    free(theta);
-    free(allodds);
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, these belong to the scratch storage if there is some
+    if (!v->scratch) {
+        free(theta);
+        free(allodds);
+        free(v->testsigma);
+        free(v->tbadguys);
+    }
     free(v->testperm);
-    free(v->testsigma);
-    free(v->tbadguys);
     free(v->refperm);
     free(v->refxy);
     free(v->refstarid);
@@ -42,6 +42,10 @@ struct blind_params {
     // WCS instances to verify.  (sip_t structs)
     bl* verify_wcs_list;
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Only verify the WCS instances, don't search for new solutions.
+    anbool verify_only;
+
     // Output solved file.
     char *solved_out;
     // Input solved file.
@@ -124,6 +128,17 @@ struct blind_params {
     anbool cancelled;
 
     anbool best_hit_only;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // If "load_index" is set, indexes that are not searched in parallel are
+    // given as already opened, metadata-only index_t's, and these are called
+    // instead of loading and closing the index files for every search:
+    // "load_index" loads the kd-trees before an index is used (returning
+    // non-zero on failure) and "done_with_index" says when it is no longer
+    // being used, so the caller can decide when to unload it.
+    int (*load_index)(index_t* index, void* userdata);
+    void (*done_with_index)(index_t* index, void* userdata);
+    void* index_userdata;
 };
 typedef struct blind_params blind_t;
 /* //# Modified by Robert Lancaster for the StellarSolver Internal Library, these are not used.
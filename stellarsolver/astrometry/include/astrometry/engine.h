@@ -36,6 +36,10 @@ struct engine {
     double minwidth;
     double maxwidth;
     float cpulimit;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // if not NULL, only the indexes at these positions in "indexes" are searched
+    // (the scale selection still considers all of them); freed by engine_free.
+    il* index_subset;
     //# Modified by Robert Lancaster for the StellarSolver Internal Library since we aren't using any files in the internal library
     //char* cancelfn;
     //char* solvedfn;
@@ -59,6 +63,9 @@ void engine_add_search_path(engine_t* engine, const char* path);
 char* engine_find_index(engine_t*, const char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// add an index that is owned by the caller; engine_free will not free it.
+int engine_add_loaded_index(engine_t* engine, index_t* ind);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
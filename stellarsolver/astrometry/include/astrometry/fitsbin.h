@@ -161,6 +161,26 @@ void fitsbin_chunk_reset(fitsbin_chunk_t* chunk);
 
 char* fitsbin_get_filename(const fitsbin_t* fb);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Flags for fitsbin_prefetch().
+// Read the pages in before returning instead of just asking the kernel to.
+#define FITSBIN_PREFETCH_POPULATE  1
+// Ask for transparent huge pages, where the kernel supports them for files.
+#define FITSBIN_PREFETCH_HUGEPAGES 2
+
+/**
+ Asks the kernel to read the mmap'ed chunks of a fitsbin into the page
+ cache (madvise MADV_WILLNEED), so that the first searches don't stall
+ on page faults.  Returns the number of bytes prefetched.  It does
+ nothing for in-memory fitsbins or on Windows.
+ */
+size_t fitsbin_prefetch(fitsbin_t* fb, int flags);
+
+/**
+ The same as fitsbin_prefetch(), for any read-only mapping of a file.
+ */
+size_t fitsbin_prefetch_map(void* map, size_t mapsize, int flags);
+
 // Reading: returns a new copy of the given FITS extension header.
 // (-> *qfits_get_header)
 qfits_header* fitsbin_get_header(const fitsbin_t* fb, int ext);
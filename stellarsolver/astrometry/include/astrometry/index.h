@@ -73,8 +73,52 @@ typedef struct {
     int dimquads;
     int nstars;
     int nquads;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Is this a packed index (see index_write_packed())?  Then the
+    // quads and kd-trees point into "packed_map", the whole file mmap'ed.
+    anbool packed;
+    void* packed_map;
+    size_t packed_mapsize;
 } index_t;
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ Packed indexes hold the quads, the code kd-tree and the star kd-tree of
+ an index in one file: a small fixed header followed by the arrays, each
+ starting on a multiple of INDEX_PACKED_ALIGN bytes.  The file is mmap'ed
+ as a whole and the arrays are used in place, without any FITS headers
+ to parse.  Like fitsbin files, they are in the native byte order.
+
+ index_load() and friends take packed indexes as well as FITS ones.
+ Packed indexes have no tag-along star data.
+ */
+#define INDEX_PACKED_MAGIC   "SSINDEX"
+#define INDEX_PACKED_VERSION 1
+#define INDEX_PACKED_ALIGN   64
+#define INDEX_PACKED_SUFFIX  ".ssidx"
+
+// Flags for index_write_packed().
+// Store the star positions in 16 bits instead of 32, see below.
+#define INDEX_PACKED_U16_STARS 1
+
+/**
+ Returns TRUE if the given file is a packed index.
+ */
+anbool index_is_packed_file(const char* filename);
+
+/**
+ Writes a loaded index as a packed index file.
+
+ With INDEX_PACKED_U16_STARS, a star kd-tree with 32-bit positions is
+ written with 16-bit positions, halving its size.  The precision of the
+ positions is then "range / 65535", for the range the index covers;
+ that is logged, check it against the jitter of the index.
+
+ Returns 0 on success.
+ */
+int index_write_packed(index_t* index, const char* filename, int flags);
+
 /**
  Simple accessor (indx->dimquads): returns the dimensionality of quads
  in this index.
@@ -156,6 +200,16 @@ void index_unload(index_t* index);
 
 int index_reload(index_t* index);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/**
+ Reads the quad file and the code and star kd-trees of a loaded index
+ into the page cache ahead of the search, see fitsbin_prefetch().  If
+ "populate" is set, it waits until they are read.  Transparent huge
+ pages are requested for the kd-trees.  Returns the number of bytes
+ prefetched.
+ */
+size_t index_prefetch(index_t* index, anbool populate);
+
 /**
  Closes the FILE*s in this index.  Once you have index_reload()ed,
  you can call this function and the index will remain valid.
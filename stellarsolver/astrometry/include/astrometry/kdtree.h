@@ -457,6 +457,21 @@ int kdtree_node_point_mindist2_exceeds(const kdtree_t* kd, int node,
 int kdtree_node_point_maxdist2_exceeds(const kdtree_t* kd, int node,
                                        const void* pt, double dist2);
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+#define KDTREE_MAX_BATCH 32
+
+/*
+ Range search for several query points at once; "queries" holds
+ "nqueries" (at most KDTREE_MAX_BATCH) points of kd->ndim values each,
+ in the tree's "external" type.  The tree is traversed once for the
+ whole batch.  "results" is an array of "nqueries" result structs,
+ which are reused like kdtree_rangesearch_options_reuse() does; NULL
+ entries are allocated.  Returns TRUE on success.
+ */
+int kdtree_rangesearch_batch(const kdtree_t* kd, kdtree_qres_t** results,
+                             const void* queries, int nqueries,
+                             double maxd2, int options);
+
 
 /* Sanity-check a tree. 0=okay. */
 int kdtree_check(const kdtree_t* t);
@@ -36,6 +36,11 @@ enum {
 #define DEFAULT_BAIL_THRESHOLD 1e-100
 
 struct verify_field_t;
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// The most codes one field quad can produce: two parities, two orders of
+// the backbone stars, and every order of the (DQMAX-2) other stars.
+#define SOLVER_MAX_CODES (2 * 2 * 6)
+
 struct solver_t {
 
     // FIELDS REQUIRED FROM THE CALLER BEFORE CALLING SOLVER_RUN
@@ -204,6 +209,26 @@ struct solver_t {
 
     // Cached data about this field, for verify_hit().
     verify_field_t* vf;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // Storage for the potential quads of solver_run(), kept until
+    // solver_cleanup() so that it isn't reallocated on every run.
+    struct potential_quad* pquads;
+    size_t pquads_capacity;
+    // Blocks that the pquads' "inbox" and "xy" arrays are carved from.
+    pl* pquad_blocks;
+    size_t pquad_block;
+    size_t pquad_block_used;
+    // Code kd-tree results for the batch of codes tried for one quad.
+    kdtree_qres_t* code_results[SOLVER_MAX_CODES];
+    // Grid of the field stars built by solver_preprocess_field(), so that the
+    // stars that can be C and D of a quad are found without checking them all.
+    // Cell c holds the stars fieldgrid_stars[fieldgrid_start[c]] to
+    // fieldgrid_stars[fieldgrid_start[c+1]-1], in increasing order.
+    double fieldgrid_x0, fieldgrid_y0, fieldgrid_cell;
+    int fieldgrid_nx, fieldgrid_ny;
+    int* fieldgrid_start;
+    int* fieldgrid_stars;
 };
 typedef struct solver_t solver_t;
 
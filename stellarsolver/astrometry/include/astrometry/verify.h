@@ -14,6 +14,10 @@
 #include "astrometry/bl.h"
 #include "astrometry/starxy.h"
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+// Storage that verification reuses from one hypothesis to the next, see verify.c
+struct verify_scratch_t;
+
 struct verify_field_t {
     const starxy_t* field;
     // this copy is normal.
@@ -28,6 +32,10 @@ struct verify_field_t {
     anbool do_dedup;
     // apply radius-of-relevance filtering
     anbool do_ror;
+
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // reused by every verification of this field
+    struct verify_scratch_t* scratch;
 };
 typedef struct verify_field_t verify_field_t;
 
@@ -6,6 +6,7 @@
 typedef double etype;
 
 #define ETYPE_INTEGER 0
+#define ETYPE_DOUBLE  1 //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
 #define ETYPE_MAX  KDT_INFTY_DOUBLE
 #define ETYPE_MIN -KDT_INFTY_DOUBLE
@@ -6,6 +6,7 @@
 typedef float etype;
 
 #define ETYPE_INTEGER 0
+#define ETYPE_DOUBLE  0 //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
 #define ETYPE_MAX  KDT_INFTY_FLOAT
 #define ETYPE_MIN -KDT_INFTY_FLOAT
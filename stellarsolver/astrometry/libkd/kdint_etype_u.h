@@ -6,6 +6,7 @@
 typedef u32 etype;
 
 #define ETYPE_INTEGER 1
+#define ETYPE_DOUBLE  0 //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
 #define ETYPE_MAX  0xffffffffu
 #define ETYPE_MIN  0
@@ -640,6 +640,17 @@ int kdtree_node_point_maxdist2_exceeds(const kdtree_t* kd, int node, const void*
     return res;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+KD_DECLARE(kdtree_rangesearch_batch, int, (const kdtree_t* kd, kdtree_qres_t** results, const void* queries, int nqueries, double maxd2, int options));
+
+int kdtree_rangesearch_batch(const kdtree_t* kd, kdtree_qres_t** results,
+                             const void* queries, int nqueries,
+                             double maxd2, int options) {
+    int res = FALSE;
+    KD_DISPATCH(kdtree_rangesearch_batch, kd->treetype, res=, (kd, results, queries, nqueries, maxd2, options));
+    return res;
+}
+
 void kdtree_nodes_contained(const kdtree_t* kd,
                             const void* querylow, const void* queryhi,
                             void (*callback_contained)(const kdtree_t* kd, int node, void* extra),
@@ -15,6 +15,11 @@
 #include "keywords.h"
 #include "errors.h"
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #define KDTREE_MAX_RESULTS 1000
 #define KDTREE_MAX_DIM 100
 
@@ -1445,6 +1450,271 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 }
 
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ Squared distance between a query and a point that are both in the
+ "external" space.  Double trees use AVX or SSE2 when the compiler
+ targets them; the remaining dimensions are done one at a time.
+ */
+static inline double batch_dist2(const etype* q, const etype* p, int D) {
+    int d = 0;
+    double d2 = 0.0;
+#if defined(KD_DIM)
+    D = KD_DIM;
+#endif
+#if ETYPE_DOUBLE && defined(__AVX__)
+    if (D >= 4) {
+        double sums[4];
+        __m256d acc = _mm256_setzero_pd();
+        for (; d+4<=D; d+=4) {
+            __m256d delta = _mm256_sub_pd(_mm256_loadu_pd(q+d), _mm256_loadu_pd(p+d));
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(delta, delta));
+        }
+        _mm256_storeu_pd(sums, acc);
+        d2 = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+#endif
+#if ETYPE_DOUBLE && defined(__SSE2__)
+    if (d+2 <= D) {
+        double sums[2];
+        __m128d acc = _mm_setzero_pd();
+        for (; d+2<=D; d+=2) {
+            __m128d delta = _mm_sub_pd(_mm_loadu_pd(q+d), _mm_loadu_pd(p+d));
+            acc = _mm_add_pd(acc, _mm_mul_pd(delta, delta));
+        }
+        _mm_storeu_pd(sums, acc);
+        d2 += sums[0] + sums[1];
+    }
+#endif
+    for (; d<D; d++) {
+        double delta = (double)q[d] - (double)p[d];
+        d2 += delta * delta;
+    }
+    return d2;
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+int MANGLE(kdtree_rangesearch_batch)
+     (const kdtree_t* kd, kdtree_qres_t** results, const void* vqueries,
+      int nqueries, double maxd2, int options)
+{
+    //Each split can push a near and a far entry per side, so this stack is deeper than the single query one
+    int nodestack[256];
+    uint32_t maskstack[256];
+    int stackpos = 0;
+    int D = (kd ? kd->ndim : 0);
+    int q, d;
+    anbool do_dists;
+    anbool do_points = TRUE;
+    anbool do_wholenode_check;
+    anbool use_bboxes;
+    double maxdist;
+    uint32_t allqueries;
+    const etype* queries = vqueries;
+
+    if (!kd || !queries || !results || nqueries <= 0 ||
+        nqueries > KDTREE_MAX_BATCH)
+        return FALSE;
+#if defined(KD_DIM)
+    assert(kd->ndim == KD_DIM);
+    D = KD_DIM;
+#else
+    D = kd->ndim;
+#endif
+    if (D > KDTREE_MAX_DIM)
+        return FALSE;
+
+    if (options & KD_OPTIONS_SORT_DISTS)
+        options |= KD_OPTIONS_COMPUTE_DISTS;
+    do_dists = options & KD_OPTIONS_COMPUTE_DISTS;
+    do_wholenode_check = !(options & KD_OPTIONS_SMALL_RADIUS);
+
+    // Same choice as kdtree_rangesearch_options: bounding boxes unless
+    // only splits are available or the caller asked for splits.
+    if (!kd->split.any)
+        use_bboxes = TRUE;
+    else if (kd->bb.any)
+        use_bboxes = !(options & KD_OPTIONS_USE_SPLIT);
+    else
+        use_bboxes = FALSE;
+    assert(use_bboxes || kd->splitdim || TTYPE_INTEGER);
+
+    maxdist = sqrt(maxd2);
+
+    for (q=0; q<nqueries; q++) {
+        kdtree_qres_t* res = results[q];
+        if (res) {
+            resize_results(res, res->capacity ? res->capacity : KDTREE_MAX_RESULTS,
+                           D, do_dists, do_points);
+            res->nres = 0;
+        } else {
+            res = CALLOC(1, sizeof(kdtree_qres_t));
+            if (!res) {
+                SYSERROR("Failed to allocate kdtree_qres_t struct");
+                return FALSE;
+            }
+            resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+            results[q] = res;
+        }
+    }
+
+    /*
+     Every query walks the tree together: each stacked node carries the
+     set of queries that still have to visit it, so the nodes and the
+     points in the leaves are read (and converted to the "external"
+     space) once for the whole batch.
+     */
+    allqueries = (nqueries == 32) ? 0xffffffffu : ((1u << nqueries) - 1);
+    nodestack[0] = 0;
+    maskstack[0] = allqueries;
+
+    while (stackpos >= 0) {
+        int nodeid = nodestack[stackpos];
+        uint32_t mask = maskstack[stackpos];
+        int i, L, R;
+        etype pt[KDTREE_MAX_DIM];
+        stackpos--;
+
+        if (KD_IS_LEAF(kd, nodeid)) {
+            L = kdtree_left(kd, nodeid);
+            R = kdtree_right(kd, nodeid);
+            for (i=L; i<=R; i++) {
+                dtype* data = KD_DATA(kd, D, i);
+                for (d=0; d<D; d++)
+                    pt[d] = POINT_DE(kd, d, data[d]);
+                for (q=0; q<nqueries; q++) {
+                    double dsqd;
+                    if (!(mask & (1u << q)))
+                        continue;
+                    dsqd = batch_dist2(queries + (size_t)q*D, pt, D);
+                    if (dsqd > maxd2)
+                        continue;
+                    if (!add_result(kd, results[q], do_dists ? dsqd : HUGE_VAL,
+                                    KD_PERM(kd, i), data, D, do_dists, do_points))
+                        return FALSE;
+                }
+            }
+            continue;
+        }
+
+        if (use_bboxes) {
+            ttype *tlo=NULL, *thi=NULL;
+            etype bblo[KDTREE_MAX_DIM], bbhi[KDTREE_MAX_DIM];
+            uint32_t wholenode = 0, partial = 0;
+
+            bboxes(kd, nodeid, &tlo, &thi, D);
+            assert(tlo && thi);
+            for (d=0; d<D; d++) {
+                bblo[d] = POINT_TE(kd, d, tlo[d]);
+                bbhi[d] = POINT_TE(kd, d, thi[d]);
+            }
+            for (q=0; q<nqueries; q++) {
+                const etype* query = queries + (size_t)q*D;
+                if (!(mask & (1u << q)))
+                    continue;
+                if (bb_point_mindist2_exceeds(bblo, bbhi, query, D, maxd2))
+                    continue;
+                if (do_wholenode_check &&
+                    !bb_point_maxdist2_exceeds(bblo, bbhi, query, D, maxd2))
+                    wholenode |= (1u << q);
+                else
+                    partial |= (1u << q);
+            }
+
+            if (wholenode) {
+                L = kdtree_left(kd, nodeid);
+                R = kdtree_right(kd, nodeid);
+                for (i=L; i<=R; i++) {
+                    dtype* data = KD_DATA(kd, D, i);
+                    for (d=0; d<D; d++)
+                        pt[d] = POINT_DE(kd, d, data[d]);
+                    for (q=0; q<nqueries; q++) {
+                        double dsqd = HUGE_VAL;
+                        if (!(wholenode & (1u << q)))
+                            continue;
+                        if (do_dists)
+                            dsqd = batch_dist2(queries + (size_t)q*D, pt, D);
+                        if (!add_result(kd, results[q], dsqd, KD_PERM(kd, i),
+                                        data, D, do_dists, do_points))
+                            return FALSE;
+                    }
+                }
+            }
+            if (partial) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+                maskstack[stackpos] = partial;
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+                maskstack[stackpos] = partial;
+            }
+
+        } else {
+            // use_splits.
+            int dim = -1;
+            ttype split = *KD_SPLIT(kd, nodeid);
+            etype rsplit;
+            uint32_t leftside = 0, rightside = 0, needsleft = 0, needsright = 0;
+
+            if (kd->splitdim)
+                dim = kd->splitdim[nodeid];
+            else if (TTYPE_INTEGER) {
+                bigint tmpsplit;
+                tmpsplit = split;
+                dim = tmpsplit & kd->dimmask;
+                split = tmpsplit & kd->splitmask;
+            }
+            rsplit = POINT_TE(kd, dim, split);
+
+            for (q=0; q<nqueries; q++) {
+                etype qd;
+                if (!(mask & (1u << q)))
+                    continue;
+                qd = queries[(size_t)q*D + dim];
+                if (qd < rsplit) {
+                    leftside |= (1u << q);
+                    if (rsplit - qd <= maxdist)
+                        needsright |= (1u << q);
+                } else {
+                    rightside |= (1u << q);
+                    if (qd - rsplit <= maxdist)
+                        needsleft |= (1u << q);
+                }
+            }
+            //Push the children per query side in the same order as kdtree_rangesearch_options does for a single query:
+            //the child on the query's side, then the other child if it is within range.
+            if (leftside) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+                maskstack[stackpos] = leftside;
+            }
+            if (needsright) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+                maskstack[stackpos] = needsright;
+            }
+            if (rightside) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+                maskstack[stackpos] = rightside;
+            }
+            if (needsleft) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+                maskstack[stackpos] = needsleft;
+            }
+        }
+    }
+
+    for (q=0; q<nqueries; q++) {
+        if (!(options & KD_OPTIONS_NO_RESIZE_RESULTS))
+            resize_results(results[q], results[q]->nres, D, do_dists, do_points);
+        if (options & KD_OPTIONS_SORT_DISTS)
+            kdtree_qsort_results(results[q], kd->ndim);
+    }
+    return TRUE;
+}
+
 static void* get_data(const kdtree_t* kd, int i) {
     return KD_DATA(kd, kd->ndim, i);
 }
@@ -9,6 +9,9 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <assert.h>
+#ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
+#include <unistd.h>
+#endif
 
 #include "keywords.h"
 #include "fitsbin.h"
@@ -554,6 +557,55 @@ static int read_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
     return 0;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+size_t fitsbin_prefetch_map(void* map, size_t mapsize, int flags) {
+#ifndef _WIN32
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (!map)
+        return 0;
+#ifdef MADV_HUGEPAGE
+    if (flags & FITSBIN_PREFETCH_HUGEPAGES)
+        // Only a hint: most file systems can't back file mappings with huge pages yet.
+        madvise(map, mapsize, MADV_HUGEPAGE);
+#endif
+    if (madvise(map, mapsize, MADV_WILLNEED))
+        debug("madvise(MADV_WILLNEED) failed for a mapping of %zu bytes\n", mapsize);
+    if (flags & FITSBIN_PREFETCH_POPULATE) {
+        // This has the effect of MAP_POPULATE on a mapping that already exists.
+#ifdef MADV_POPULATE_READ
+        if (madvise(map, mapsize, MADV_POPULATE_READ))
+#endif
+        {
+            volatile char sum = 0;
+            size_t off;
+            for (off=0; off<mapsize; off+=pagesize)
+                sum += ((volatile char*)map)[off];
+            (void)sum;
+        }
+    }
+    return mapsize;
+#else
+    (void)map;
+    (void)mapsize;
+    (void)flags;
+    return 0;
+#endif
+}
+
+size_t fitsbin_prefetch(fitsbin_t* fb, int flags) {
+    size_t total = 0;
+    int i;
+
+    if (!fb || in_memory(fb))
+        return 0;
+    for (i=0; i<nchunks(fb); i++) {
+        fitsbin_chunk_t* chunk = get_chunk(fb, i);
+        total += fitsbin_prefetch_map(chunk->map, chunk->mapsize, flags);
+    }
+    return total;
+}
+
 int fitsbin_read_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
     if (read_chunk(fb, chunk))
         return -1;
@@ -3,6 +3,9 @@
  # Licensed under a 3-clause BSD style license - see LICENSE
  */
 
+#include <stdint.h>
+#include <sys/mman.h>
+
 #include "index.h"
 #include "log.h"
 #include "errors.h"
@@ -152,6 +155,10 @@ anbool index_is_file_index(const char* filename) {
         }
     }
 
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (singlefile && index_is_packed_file(quadfn))
+        goto finish;
+
     if (!(qfits_is_fits(quadfn) &&
           (singlefile || (qfits_is_fits(ckdtfn) && qfits_is_fits(skdtfn))))) {
         /* //# Modified by Robert Lancaster for the StellarSolver Internal Library (so that we don't keep getting messages saying that the config file isn't FITS)
@@ -321,6 +328,455 @@ static void set_meta(index_t* index) {
     index->meanx_less_than_half = qfits_header_getboolean(index->codekd->header, "CXDXLT1", FALSE);
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+/*
+ The layout of a packed index file.  All the fields have their natural
+ alignment, so the structs are the same on all the compilers we use.
+ */
+
+// An array in the file; "size" is 0 if the array isn't there.
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} packed_array_t;
+
+typedef struct {
+    uint32_t treetype;
+    int32_t ndata;
+    int32_t ndim;
+    int32_t nnodes;
+    int32_t n_bb;
+    int32_t has_linear_lr;
+    uint32_t dimbits;
+    uint32_t dimmask;
+    uint32_t splitmask;
+    uint32_t unused;
+    packed_array_t lr;
+    packed_array_t perm;
+    packed_array_t bb;
+    packed_array_t split;
+    packed_array_t splitdim;
+    packed_array_t data;
+    // minval[ndim], maxval[ndim], scale
+    packed_array_t range;
+} packed_tree_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // 0x01020304 as written by the machine that wrote the file.
+    uint32_t endian;
+
+    int32_t indexid;
+    int32_t healpix;
+    int32_t hpnside;
+    int32_t dimquads;
+    int32_t nquads;
+    int32_t nstars;
+    // in arcseconds
+    double index_scale_upper;
+    double index_scale_lower;
+    double index_jitter;
+
+    int32_t cutnside;
+    int32_t cutnsweep;
+    int32_t cutmargin;
+    int32_t circle;
+    int32_t cx_less_than_dx;
+    int32_t meanx_less_than_half;
+    double cutdedup;
+    char cutband[8];
+
+    packed_array_t quads;
+    packed_array_t sweep;
+    packed_tree_t codetree;
+    packed_tree_t startree;
+} packed_header_t;
+
+#define PACKED_ENDIAN 0x01020304
+
+static int packed_tree_size(uint32_t treetype) {
+    switch (treetype & KDT_TREE_MASK) {
+    case KDT_TREE_DOUBLE: return sizeof(double);
+    case KDT_TREE_FLOAT:  return sizeof(float);
+    case KDT_TREE_U32:    return sizeof(uint32_t);
+    case KDT_TREE_U16:    return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+static int packed_data_size(uint32_t treetype) {
+    switch (treetype & KDT_DATA_MASK) {
+    case KDT_DATA_DOUBLE: return sizeof(double);
+    case KDT_DATA_FLOAT:  return sizeof(float);
+    case KDT_DATA_U32:    return sizeof(uint32_t);
+    case KDT_DATA_U16:    return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+anbool index_is_packed_file(const char* filename) {
+    char magic[sizeof(INDEX_PACKED_MAGIC)];
+    anbool rtn = FALSE;
+    FILE* fid = fopen(filename, "rb");
+    if (!fid)
+        return FALSE;
+    if (fread(magic, 1, sizeof(magic), fid) == sizeof(magic))
+        rtn = (memcmp(magic, INDEX_PACKED_MAGIC, sizeof(magic)) == 0);
+    fclose(fid);
+    return rtn;
+}
+
+// Returns the array in the map, or NULL if it isn't there or doesn't have the expected size.
+static void* packed_array(const index_t* index, const packed_array_t* arr, size_t expected) {
+    if (!arr->size)
+        return NULL;
+    if (arr->size != expected ||
+        arr->offset % INDEX_PACKED_ALIGN ||
+        arr->offset > index->packed_mapsize ||
+        arr->size > index->packed_mapsize - arr->offset) {
+        ERROR("Packed index %s: an array of %zu bytes at offset %zu does not fit, expected %zu bytes",
+              index->quadfn, (size_t)arr->size, (size_t)arr->offset, expected);
+        return NULL;
+    }
+    return (char*)index->packed_map + arr->offset;
+}
+
+static kdtree_t* packed_kdtree(const index_t* index, const packed_tree_t* pt, const char* name) {
+    kdtree_t* kd;
+    int tsize = packed_tree_size(pt->treetype);
+    int dsize = packed_data_size(pt->treetype);
+    double* range;
+
+    if (!tsize || !dsize || pt->ndim <= 0 || pt->ndata <= 0 || pt->nnodes <= 0) {
+        ERROR("Packed index %s: the %s kd-tree is not valid", index->quadfn, name);
+        return NULL;
+    }
+    kd = calloc(1, sizeof(kdtree_t));
+    kd->treetype = pt->treetype;
+    kd->ndata = pt->ndata;
+    kd->ndim = pt->ndim;
+    kd->nnodes = pt->nnodes;
+    kd->nbottom = (pt->nnodes + 1) / 2;
+    kd->ninterior = pt->nnodes - kd->nbottom;
+    kd->nlevels = kdtree_nnodes_to_nlevels(pt->nnodes);
+    kd->has_linear_lr = pt->has_linear_lr;
+    kd->dimbits = pt->dimbits;
+    kd->dimmask = pt->dimmask;
+    kd->splitmask = pt->splitmask;
+    kd->name = strdup(name);
+
+    kd->lr = packed_array(index, &pt->lr, sizeof(int32_t) * kd->nbottom);
+    kd->perm = packed_array(index, &pt->perm, sizeof(uint32_t) * kd->ndata);
+    kd->n_bb = pt->n_bb;
+    kd->bb.any = packed_array(index, &pt->bb, (size_t)tsize * kd->ndim * 2 * pt->n_bb);
+    kd->split.any = packed_array(index, &pt->split, (size_t)tsize * kd->ninterior);
+    kd->splitdim = packed_array(index, &pt->splitdim, sizeof(uint8_t) * kd->ninterior);
+    kd->data.any = packed_array(index, &pt->data, (size_t)dsize * kd->ndim * kd->ndata);
+    range = packed_array(index, &pt->range, sizeof(double) * (kd->ndim * 2 + 1));
+    if (range) {
+        kd->minval = range;
+        kd->maxval = range + kd->ndim;
+        kd->scale = range[kd->ndim * 2];
+        kd->invscale = 1.0 / kd->scale;
+    }
+
+    // Integer trees need the range to convert their coordinates.
+    if (!kd->data.any || !(kd->bb.any || kd->split.any) ||
+        ((pt->treetype & (KDT_TREE_U32 | KDT_TREE_U16)) && !range)) {
+        ERROR("Packed index %s: the %s kd-tree is missing its data, nodes or range", index->quadfn, name);
+        kdtree_fits_close(kd);
+        return NULL;
+    }
+    kdtree_update_funcs(kd);
+    return kd;
+}
+
+static int reload_packed(index_t* index) {
+    const packed_header_t* hdr;
+    FILE* fid;
+    off_t size;
+    void* map;
+
+    if (index->packed_map)
+        return 0;
+
+    fid = fopen(index->quadfn, "rb");
+    if (!fid) {
+        SYSERROR("Failed to open packed index %s", index->quadfn);
+        return -1;
+    }
+    if (fseeko(fid, 0, SEEK_END) || (size = ftello(fid)) < (off_t)sizeof(packed_header_t)) {
+        ERROR("Packed index %s is too short", index->quadfn);
+        fclose(fid);
+        return -1;
+    }
+    // The whole file is mapped; the arrays are used where they are.
+#ifdef _WIN32
+    map = mmap_file(fileno(fid), size);
+#else
+    map = mmap(0, size, PROT_READ, MAP_SHARED, fileno(fid), 0);
+#endif
+    fclose(fid);
+    if (map == MAP_FAILED || map == NULL) {
+        SYSERROR("Couldn't mmap packed index %s", index->quadfn);
+        return -1;
+    }
+    index->packed_map = map;
+    index->packed_mapsize = size;
+    hdr = map;
+
+    if (memcmp(hdr->magic, INDEX_PACKED_MAGIC, sizeof(INDEX_PACKED_MAGIC)) ||
+        hdr->version != INDEX_PACKED_VERSION) {
+        ERROR("Packed index %s has an unknown version", index->quadfn);
+        goto bailout;
+    }
+    if (hdr->endian != PACKED_ENDIAN) {
+        ERROR("Packed index %s was written with the wrong endianness", index->quadfn);
+        goto bailout;
+    }
+    if (hdr->dimquads < 3 || hdr->dimquads > DQMAX) {
+        ERROR("Packed index %s has illegal dimquads %i", index->quadfn, hdr->dimquads);
+        goto bailout;
+    }
+
+    index->quads = calloc(1, sizeof(quadfile_t));
+    index->quads->numquads = hdr->nquads;
+    index->quads->numstars = hdr->nstars;
+    index->quads->dimquads = hdr->dimquads;
+    index->quads->index_scale_upper = arcsec2rad(hdr->index_scale_upper);
+    index->quads->index_scale_lower = arcsec2rad(hdr->index_scale_lower);
+    index->quads->indexid = hdr->indexid;
+    index->quads->healpix = hdr->healpix;
+    index->quads->hpnside = hdr->hpnside;
+    index->quads->quadarray = packed_array(index, &hdr->quads,
+                                           sizeof(uint32_t) * hdr->dimquads * (size_t)hdr->nquads);
+    if (!index->quads->quadarray) {
+        ERROR("Packed index %s has no quads", index->quadfn);
+        goto bailout;
+    }
+
+    index->codekd = calloc(1, sizeof(codetree_t));
+    index->codekd->tree = packed_kdtree(index, &hdr->codetree, CODETREE_NAME);
+    if (!index->codekd->tree)
+        goto bailout;
+
+    index->starkd = calloc(1, sizeof(startree_t));
+    index->starkd->tree = packed_kdtree(index, &hdr->startree, STARTREE_NAME);
+    if (!index->starkd->tree)
+        goto bailout;
+    if (index->starkd->tree->ndim != 3) {
+        ERROR("Packed index %s has a star kd-tree with dim %i", index->quadfn, index->starkd->tree->ndim);
+        goto bailout;
+    }
+    index->starkd->sweep = packed_array(index, &hdr->sweep, sizeof(uint8_t) * index->starkd->tree->ndata);
+    return 0;
+
+ bailout:
+    index_unload(index);
+    return -1;
+}
+
+static void set_packed_meta(index_t* index) {
+    const packed_header_t* hdr = index->packed_map;
+    char band[sizeof(hdr->cutband) + 1];
+    memcpy(band, hdr->cutband, sizeof(hdr->cutband));
+    band[sizeof(hdr->cutband)] = '\0';
+    index->index_scale_upper = hdr->index_scale_upper;
+    index->index_scale_lower = hdr->index_scale_lower;
+    index->indexid = hdr->indexid;
+    index->healpix = hdr->healpix;
+    index->hpnside = hdr->hpnside;
+    index->dimquads = hdr->dimquads;
+    index->nquads = hdr->nquads;
+    index->nstars = hdr->nstars;
+    index->index_jitter = hdr->index_jitter;
+    index->cutnside = hdr->cutnside;
+    index->cutnsweep = hdr->cutnsweep;
+    index->cutdedup = hdr->cutdedup;
+    index->cutband = band[0] ? strdup(band) : NULL;
+    index->cutmargin = hdr->cutmargin;
+    index->circle = hdr->circle;
+    index->cx_less_than_dx = hdr->cx_less_than_dx;
+    index->meanx_less_than_half = hdr->meanx_less_than_half;
+}
+
+// Writes an array at the next multiple of INDEX_PACKED_ALIGN bytes.
+static int write_packed_array(FILE* fid, const void* data, size_t size, packed_array_t* arr) {
+    static const char zeros[INDEX_PACKED_ALIGN] = { 0 };
+    off_t pos;
+
+    memset(arr, 0, sizeof(packed_array_t));
+    if (!data || !size)
+        return 0;
+    pos = ftello(fid);
+    if (pos % INDEX_PACKED_ALIGN) {
+        size_t pad = INDEX_PACKED_ALIGN - pos % INDEX_PACKED_ALIGN;
+        if (fwrite(zeros, 1, pad, fid) != pad)
+            return -1;
+        pos += pad;
+    }
+    if (fwrite(data, 1, size, fid) != size)
+        return -1;
+    arr->offset = pos;
+    arr->size = size;
+    return 0;
+}
+
+/*
+ Converts a star kd-tree with 32-bit positions to 16 bits.  The bounding
+ boxes are rounded outwards, so they still hold their stars.  The star
+ kd-trees are searched with the bounding boxes, so the splits are dropped.
+ */
+static int convert_tree_to_u16(const kdtree_t* kd, uint16_t** pdata, uint16_t** pbb, double* pscale) {
+    const double ratio = (double)UINT16_MAX / (double)UINT32_MAX;
+    size_t i, n;
+    uint16_t* data;
+    uint16_t* bb;
+
+    if (kd->treetype != KDTT_DUU || !kd->bb.any || kd->n_bb != kd->nnodes) {
+        logmsg("The star kd-tree is not a 32-bit tree with bounding boxes, keeping its precision.\n");
+        return -1;
+    }
+    n = (size_t)kd->ndata * kd->ndim;
+    data = malloc(n * sizeof(uint16_t));
+    for (i=0; i<n; i++)
+        data[i] = (uint16_t)lround(kd->data.u[i] * ratio);
+    n = (size_t)kd->n_bb * kd->ndim;
+    bb = malloc(2 * n * sizeof(uint16_t));
+    // each node has its low corner followed by its high corner
+    for (i=0; i<2*n; i++) {
+        double v = kd->bb.u[i] * ratio;
+        anbool high = (i / kd->ndim) % 2;
+        v = high ? ceil(v) : floor(v);
+        bb[i] = (uint16_t)MIN(v, UINT16_MAX);
+    }
+    *pdata = data;
+    *pbb = bb;
+    *pscale = kd->scale * ratio;
+    return 0;
+}
+
+static int write_packed_tree(FILE* fid, const kdtree_t* kd, packed_tree_t* pt, anbool u16) {
+    int tsize = packed_tree_size(kd->treetype);
+    int dsize = packed_data_size(kd->treetype);
+    uint16_t* data16 = NULL;
+    uint16_t* bb16 = NULL;
+    double* range = NULL;
+    double scale = kd->scale;
+    int rtn = -1;
+
+    memset(pt, 0, sizeof(packed_tree_t));
+    if (u16 && convert_tree_to_u16(kd, &data16, &bb16, &scale) == 0) {
+        pt->treetype = KDTT_DSS;
+        tsize = dsize = sizeof(uint16_t);
+        logmsg("Star positions are stored in 16 bits, a precision of %g arcsec.\n",
+               rad2arcsec(1.0 / scale));
+    } else
+        pt->treetype = kd->treetype;
+    pt->ndata = kd->ndata;
+    pt->ndim = kd->ndim;
+    pt->nnodes = kd->nnodes;
+    pt->n_bb = kd->bb.any ? kd->n_bb : 0;
+    pt->has_linear_lr = kd->has_linear_lr;
+    pt->dimbits = kd->dimbits;
+    pt->dimmask = kd->dimmask;
+    pt->splitmask = kd->splitmask;
+
+    if (kd->minval && kd->maxval) {
+        range = malloc(sizeof(double) * (kd->ndim * 2 + 1));
+        memcpy(range, kd->minval, sizeof(double) * kd->ndim);
+        memcpy(range + kd->ndim, kd->maxval, sizeof(double) * kd->ndim);
+        range[kd->ndim * 2] = scale;
+    }
+
+    // Written in the order a search reads them: the nodes, then the points.
+    if (write_packed_array(fid, bb16 ? (void*)bb16 : kd->bb.any,
+                           (size_t)tsize * kd->ndim * 2 * pt->n_bb, &pt->bb) ||
+        write_packed_array(fid, bb16 ? NULL : kd->split.any,
+                           (size_t)tsize * kd->ninterior, &pt->split) ||
+        write_packed_array(fid, bb16 ? NULL : kd->splitdim,
+                           sizeof(uint8_t) * kd->ninterior, &pt->splitdim) ||
+        write_packed_array(fid, kd->lr, sizeof(int32_t) * kd->nbottom, &pt->lr) ||
+        write_packed_array(fid, data16 ? (void*)data16 : kd->data.any,
+                           (size_t)dsize * kd->ndim * kd->ndata, &pt->data) ||
+        write_packed_array(fid, kd->perm, sizeof(uint32_t) * kd->ndata, &pt->perm) ||
+        write_packed_array(fid, range, sizeof(double) * (kd->ndim * 2 + 1), &pt->range))
+        goto finish;
+    rtn = 0;
+
+ finish:
+    free(data16);
+    free(bb16);
+    free(range);
+    return rtn;
+}
+
+int index_write_packed(index_t* index, const char* filename, int flags) {
+    packed_header_t hdr;
+    FILE* fid;
+    int rtn = -1;
+
+    if (!index->quads || !index->codekd || !index->starkd) {
+        ERROR("Index %s must be loaded to be packed", index->indexname);
+        return -1;
+    }
+    fid = fopen(filename, "wb");
+    if (!fid) {
+        SYSERROR("Failed to open %s for writing", filename);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.version = INDEX_PACKED_VERSION;
+    hdr.endian = PACKED_ENDIAN;
+    hdr.indexid = index->indexid;
+    hdr.healpix = index->healpix;
+    hdr.hpnside = index->hpnside;
+    hdr.dimquads = index->dimquads;
+    hdr.nquads = index->nquads;
+    hdr.nstars = index->nstars;
+    hdr.index_scale_upper = index->index_scale_upper;
+    hdr.index_scale_lower = index->index_scale_lower;
+    hdr.index_jitter = index->index_jitter;
+    hdr.cutnside = index->cutnside;
+    hdr.cutnsweep = index->cutnsweep;
+    hdr.cutmargin = index->cutmargin;
+    hdr.circle = index->circle;
+    hdr.cx_less_than_dx = index->cx_less_than_dx;
+    hdr.meanx_less_than_half = index->meanx_less_than_half;
+    hdr.cutdedup = index->cutdedup;
+    if (index->cutband)
+        strncpy(hdr.cutband, index->cutband, sizeof(hdr.cutband) - 1);
+
+    // The header is written again at the end, once the offsets are known;
+    // until then the file doesn't have the magic, so it isn't taken for an index.
+    if (fwrite(&hdr, 1, sizeof(hdr), fid) != sizeof(hdr) ||
+        write_packed_tree(fid, index->codekd->tree, &hdr.codetree, FALSE) ||
+        write_packed_array(fid, index->quads->quadarray,
+                           sizeof(uint32_t) * index->dimquads * (size_t)index->nquads, &hdr.quads) ||
+        write_packed_tree(fid, index->starkd->tree, &hdr.startree, flags & INDEX_PACKED_U16_STARS) ||
+        write_packed_array(fid, index->starkd->sweep,
+                           sizeof(uint8_t) * index->starkd->tree->ndata, &hdr.sweep)) {
+        SYSERROR("Failed to write packed index %s", filename);
+        goto finish;
+    }
+    memcpy(hdr.magic, INDEX_PACKED_MAGIC, sizeof(INDEX_PACKED_MAGIC));
+    if (fseeko(fid, 0, SEEK_SET) ||
+        fwrite(&hdr, 1, sizeof(hdr), fid) != sizeof(hdr)) {
+        SYSERROR("Failed to write the header of packed index %s", filename);
+        goto finish;
+    }
+    rtn = 0;
+
+ finish:
+    if (fclose(fid)) {
+        SYSERROR("Failed to close packed index %s", filename);
+        rtn = -1;
+    }
+    return rtn;
+}
+
 int index_dimquads(index_t* indx) {
     return indx->dimquads;
 }
@@ -350,7 +806,10 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 
     get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
                   &singlefile);
-    if (singlefile) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (singlefile && index_is_packed_file(dest->quadfn)) {
+        dest->packed = TRUE;
+    } else if (singlefile) {
         dest->fits = anqfits_open(dest->quadfn);
         if (!dest->fits) {
             ERROR("Failed to open FITS file %s", dest->quadfn);
@@ -362,8 +821,13 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
         goto bailout;
     }
     free(dest->indexname);
-    dest->indexname = strdup(quadfile_get_filename(dest->quads));
-    set_meta(dest);
+    if (dest->packed) {
+        dest->indexname = strdup(dest->quadfn);
+        set_packed_meta(dest);
+    } else {
+        dest->indexname = strdup(quadfile_get_filename(dest->quads));
+        set_meta(dest);
+    }
 
     logverb("Index scale: [%g, %g] arcmin, [%g, %g] arcsec\n",
             dest->index_scale_lower / 60.0, dest->index_scale_upper / 60.0,
@@ -391,6 +855,10 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 }
 
 int index_reload(index_t* index) {
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (index->packed)
+        return reload_packed(index);
+
     // Read .skdt file...
     if (!index->starkd) {
         if (index->fits)
@@ -438,6 +906,23 @@ int index_reload(index_t* index) {
     return -1;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library
+size_t index_prefetch(index_t* index, anbool populate) {
+    int flags = populate ? FITSBIN_PREFETCH_POPULATE : 0;
+    size_t total = 0;
+    if (index->packed)
+        return fitsbin_prefetch_map(index->packed_map, index->packed_mapsize,
+                                    flags | FITSBIN_PREFETCH_HUGEPAGES);
+    // The kd-trees are searched at random, so they get the huge pages.
+    if (index->codekd)
+        total += fitsbin_prefetch(index->codekd->tree->io, flags | FITSBIN_PREFETCH_HUGEPAGES);
+    if (index->starkd)
+        total += fitsbin_prefetch(index->starkd->tree->io, flags | FITSBIN_PREFETCH_HUGEPAGES);
+    if (index->quads)
+        total += fitsbin_prefetch(index->quads->fb, flags);
+    return total;
+}
+
 void index_unload(index_t* index) {
     if (index->starkd) {
         startree_close(index->starkd);
@@ -451,10 +936,21 @@ void index_unload(index_t* index) {
         quadfile_close(index->quads);
         index->quads = NULL;
     }
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    if (index->packed_map) {
+        if (munmap(index->packed_map, index->packed_mapsize))
+            SYSERROR("Failed to munmap packed index %s", index->quadfn);
+        index->packed_map = NULL;
+        index->packed_mapsize = 0;
+    }
 }
 
 int index_close_fds(index_t* ind) {
     kdtree_fits_t* io;
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    // The file of a packed index is closed once it is mapped.
+    if (ind->packed)
+        return 0;
     if (ind->quads->fb->fid) {
         if (fclose(ind->quads->fb->fid)) {
             SYSERROR("Failed to fclose() an astrometry_net_data quadfile");
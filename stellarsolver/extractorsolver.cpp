@@ -44,6 +44,13 @@ void ExtractorSolver::setSearchPositionInDegrees(double ra, double dec)
     search_dec = dec;
 }
 
+//This sets the WCS of an earlier solve, the internal solver verifies it before it searches for quads
+void ExtractorSolver::setSearchWCS(const sip_t &wcs)
+{
+    m_UseSearchWCS = true;
+    searchWCS = wcs;
+}
+
 void ExtractorSolver::execute()
 {
     run();
@@ -12,8 +12,10 @@
 #include <QRect>
 #include <QDir>
 #include <QVector>
+#include <QFuture>
 #include "structuredefinitions.h"
 #include "parameters.h"
+#include "starcatalog.h"
 
 //CFitsio Includes
 #include <fitsio.h>
@@ -21,6 +23,7 @@
 //Astrometry.net includes
 extern "C" {
 #include "astrometry/starutil.h"
+#include "astrometry/sip.h"
 }
 
 using namespace SSolver;
@@ -78,6 +81,11 @@ class ExtractorSolver : public QThread
         double search_ra = HUGE_VAL;        // RA of field center for search, format: decimal degrees
         double search_dec = HUGE_VAL;       // DEC of field center for search, format: decimal degrees
 
+        // Astrometry Search WCS, the WCS of an earlier solve of the same field.  It is not a saved parameter and changes for each image, use the method to set it
+        bool m_UseSearchWCS = false;        // Whether or not to verify the search WCS before searching for quads
+        sip_t searchWCS {};                 // The WCS to verify, in the pixel coordinates of the full size image
+        bool m_TrackSearchWCS = false;      // Whether or not to match the index stars with the extracted stars to follow a field that has drifted before verifying
+
     // ExtractorSolver Methods
         /**
          * @brief extract is the method that does star extraction
@@ -86,10 +94,37 @@ class ExtractorSolver : public QThread
         virtual int extract() = 0;
 
         /**
-         * @brief execute is a function that performs just like start, but in a blocking way, instead of in a different thread.  NOTE: At the moment we are only using this for the Online Solver
+         * @brief execute is a function that performs just like start, but in a blocking way, instead of in a different thread.  NOTE: At the moment we are only using this for the Online Solver and for the jobs of StellarSolver::solveBatch
          */
         virtual void execute();
 
+        /**
+         * @brief startTask starts the extractorsolver asynchronously like start.  Solvers that can run on the SolverPool run there as a task
+         * instead of starting a thread of their own, the others just call start.
+         */
+        virtual void startTask()
+        {
+            start();
+        }
+
+        /**
+         * @brief isWorking gets whether the extractorsolver is running, either in its own thread or as a task
+         * @return true if it is running
+         */
+        bool isWorking() const
+        {
+            return isRunning() || m_Task.isRunning();
+        }
+
+        /**
+         * @brief waitUntilDone blocks until the extractorsolver is not running anymore
+         */
+        void waitUntilDone()
+        {
+            wait();
+            m_Task.waitForFinished();
+        }
+
         /**
          * @brief abort will stop the extractorsolver by setting a cancel variable, using the quit method, using the kill method, and/or making a cancel file
          */
@@ -155,6 +190,32 @@ class ExtractorSolver : public QThread
          */
         void setSearchPositionInDegrees(double ra, double dec);
 
+        /**
+         * @brief setSearchRadius sets how far from the search position the solver looks, overriding the search_radius parameter
+         * @param radius The radius in degrees
+         */
+        void setSearchRadius(double radius)
+        {
+            m_ActiveParameters.search_radius = radius;
+        };
+
+        /**
+         * @brief setSearchWCS sets the WCS of an earlier solve of the same field, so the solver can check whether it still fits before searching
+         * @param wcs The WCS in the pixel coordinates of the full size image
+         */
+        void setSearchWCS(const sip_t &wcs);
+
+        /**
+         * @brief getSolutionWCS gets the WCS of the latest plate solve so that it can be used as the search WCS of a later solve
+         * @param solutionWCS gets the WCS in the pixel coordinates of the full size image
+         * @return false if this solver has no WCS it can share
+         */
+        virtual bool getSolutionWCS(sip_t &solutionWCS)
+        {
+            Q_UNUSED(solutionWCS);
+            return false;
+        }
+
         /**
          * @brief getBackground gets information about the image background found during star exraction
          * @return The background information
@@ -173,6 +234,17 @@ class ExtractorSolver : public QThread
             return m_ExtractedStars.size();
         };
 
+        /**
+         * @brief getStarCatalog gets the stars found during star extraction as a StarCatalog, making it again if the star list changed since
+         * @return The catalog, which copies share instead of copying the stars
+         */
+        const StarCatalog &getStarCatalog()
+        {
+            if(!m_StarCatalog.isCatalogOf(m_ExtractedStars))
+                m_StarCatalog = StarCatalog(m_ExtractedStars);
+            return m_StarCatalog;
+        }
+
         /**
          * @brief getStarList gets the list of stars found during star extraction
          * @return A QList full of stars and their properties
@@ -279,6 +351,7 @@ class ExtractorSolver : public QThread
         bool m_HasSolved = false;               // This boolean is set when the solving is done and successful
         bool m_HasWCS = false;                  // This boolean gets set if the StellarSolver has WCS data to retrieve
         bool m_WasAborted = false;              // This boolean gets set if the StellarSolver was aborted
+        QFuture<void> m_Task;                   // The task running this solver on the SolverPool, if it was started with startTask
 
         // Subframing Options
         bool m_UseSubframe = false;             // Whether or not to use the subframe for star extraction
@@ -292,6 +365,7 @@ class ExtractorSolver : public QThread
 
         FITSImage::Background m_Background;     // This is a report on the background levels found during star extraction
         QList<FITSImage::Star> m_ExtractedStars;// This is the list of stars that get extracted from the image
+        StarCatalog m_StarCatalog;              // This is the catalog of m_ExtractedStars, use getStarCatalog to get it up to date
         FITSImage::Solution m_Solution;         // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;         // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;             // This is the healpix of the index used to solve the image.
@@ -0,0 +1,507 @@
+/*  IndexCatalog, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "indexcatalog.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+// This identifies the metadata cache files, the version has to change if the layout below changes.
+const quint32 METADATA_CACHE_MAGIC = 0x53534958;
+const quint32 METADATA_CACHE_VERSION = 2;
+
+}  // namespace
+
+IndexCatalog &IndexCatalog::instance()
+{
+    static IndexCatalog catalog;
+    return catalog;
+}
+
+IndexCatalog::~IndexCatalog()
+{
+    for(auto entry : m_Entries)
+        freeEntry(entry);
+    for(auto entry : m_Retired)
+        freeEntry(entry);
+}
+
+QVector<index_t *> IndexCatalog::acquire(const QStringList &indexFolders, const QStringList &indexFiles, bool fullyLoaded)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    //The individual index files go first, then the ones in the folders, just like astrometry.net's engine did it.
+    QStringList paths;
+    for(auto &onePath : indexFiles)
+        paths.append(QFileInfo(onePath).absoluteFilePath());
+    for(auto &oneFolder : indexFolders)
+        paths.append(folderListing(oneFolder));
+
+    QVector<index_t *> indexes;
+    QSet<QString> alreadyAdded;
+    for(auto &onePath : paths)
+    {
+        if(alreadyAdded.contains(onePath))
+            continue;
+        alreadyAdded.insert(onePath);
+
+        Entry *entry = lookup(onePath);
+        if(!entry)
+            continue;
+        //When the indexes are searched in parallel, the kd-trees of all of them stay loaded until they are released.
+        if(fullyLoaded)
+        {
+            if(!loadEntryTrees(entry))
+                continue;
+            entry->treeUsers++;
+        }
+        entry->borrowers++;
+        indexes.append(entry->index);
+    }
+    saveMetadataCaches();
+    return indexes;
+}
+
+void IndexCatalog::release(const QVector<index_t *> &indexes, bool fullyLoaded)
+{
+    QMutexLocker locker(&m_Mutex);
+    for(auto &oneIndex : indexes)
+    {
+        Entry *entry = m_Owners.value(oneIndex, nullptr);
+        if(!entry)
+            continue;
+        if(fullyLoaded)
+        {
+            entry->treeUsers--;
+            entry->lastUsed = ++m_Clock;
+        }
+        entry->borrowers--;
+        if(entry->borrowers <= 0 && m_Retired.removeOne(entry))
+            freeEntry(entry);
+    }
+    //Indexes loaded beyond the budget while they were in use can be unloaded now
+    makeRoom(0);
+}
+
+bool IndexCatalog::loadTrees(index_t *index)
+{
+    QMutexLocker locker(&m_Mutex);
+    Entry *entry = m_Owners.value(index, nullptr);
+    if(!entry || !loadEntryTrees(entry))
+        return false;
+    entry->treeUsers++;
+    return true;
+}
+
+void IndexCatalog::doneWithTrees(index_t *index)
+{
+    QMutexLocker locker(&m_Mutex);
+    Entry *entry = m_Owners.value(index, nullptr);
+    if(!entry)
+        return;
+    entry->treeUsers--;
+    entry->lastUsed = ++m_Clock;
+    makeRoom(0);
+}
+
+void IndexCatalog::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_MemoryBudget = bytes;
+    makeRoom(0);
+}
+
+SSolver::IndexResidency IndexCatalog::residency()
+{
+    QMutexLocker locker(&m_Mutex);
+    SSolver::IndexResidency stats;
+    stats.indexes = m_Entries.count();
+    for(auto entry : m_Entries)
+    {
+        if(entry->fullyLoaded)
+            stats.resident++;
+    }
+    stats.residentBytes = residentBytes();
+    stats.memoryBudget = m_MemoryBudget;
+    stats.hits = m_Hits;
+    stats.misses = m_Misses;
+    stats.evictions = m_Evictions;
+    return stats;
+}
+
+void IndexCatalog::rescan()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_FolderListings.clear();
+}
+
+void IndexCatalog::clear()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_FolderListings.clear();
+    const QList<Entry *> entries = m_Entries.values();
+    for(auto entry : entries)
+        retire(entry);
+}
+
+QStringList IndexCatalog::folderListing(const QString &folder)
+{
+    QDir dir(folder);
+    const QString key = dir.absolutePath();
+    auto listing = m_FolderListings.constFind(key);
+    if(listing != m_FolderListings.constEnd())
+        return listing.value();
+
+    //A folder that doesn't exist is not remembered, so it will be found once it is created.
+    if(!dir.exists())
+        return QStringList();
+
+    QStringList indexPaths;
+    for(auto &oneName : dir.entryList(QDir::Files | QDir::Readable))
+    {
+        QFileInfo info(dir, oneName);
+        //Files in the metadata cache that haven't changed don't need to be opened to know if they are index files
+        const CachedMetadata *metadata = cachedMetadata(info);
+        bool isIndex = metadata ? metadata->isIndex : index_is_file_index(info.absoluteFilePath().toUtf8().constData());
+        if(!isIndex)
+        {
+            if(!metadata)
+                cacheMetadata(info, nullptr);
+            continue;
+        }
+        indexPaths.append(info.absoluteFilePath());
+    }
+    //A packed index is the same index as the FITS file it was made from, so only one of them is used.
+    //That is the packed one, unless the FITS file changed after the packed one was made from it.
+    QStringList leftOut;
+    for(auto &onePath : indexPaths)
+    {
+        QFileInfo info(onePath);
+        if(info.suffix() == QString(INDEX_PACKED_SUFFIX).mid(1))
+            continue;
+        QFileInfo packedInfo(info.absolutePath() + "/" + info.completeBaseName() + INDEX_PACKED_SUFFIX);
+        if(!indexPaths.contains(packedInfo.absoluteFilePath()))
+            continue;
+        leftOut.append(packedInfo.lastModified() >= info.lastModified() ? onePath : packedInfo.absoluteFilePath());
+    }
+    for(auto &onePath : leftOut)
+        indexPaths.removeOne(onePath);
+    //Astrometry.net adds the index files from a folder in reverse sorted order
+    std::sort(indexPaths.begin(), indexPaths.end());
+    std::reverse(indexPaths.begin(), indexPaths.end());
+
+    m_FolderListings.insert(key, indexPaths);
+    return indexPaths;
+}
+
+IndexCatalog::Entry *IndexCatalog::lookup(const QString &path)
+{
+    QFileInfo info(path);
+    Entry *entry = m_Entries.value(path, nullptr);
+
+    if(!info.exists())
+    {
+        if(entry)
+            retire(entry);
+        return nullptr;
+    }
+
+    //If the file has changed on disk since it was loaded, the old one is retired and the file is loaded again.
+    if(entry && (entry->size != info.size() || entry->modified != info.lastModified()))
+    {
+        retire(entry);
+        entry = nullptr;
+    }
+
+    if(!entry)
+    {
+        entry = new Entry;
+        entry->path = path;
+        entry->size = info.size();
+        entry->modified = info.lastModified();
+        entry->index = nullptr;
+        entry->trees = nullptr;
+        entry->fullyLoaded = false;
+        entry->borrowers = 0;
+        entry->treeUsers = 0;
+        entry->lastUsed = 0;
+
+        //Only the metadata is loaded here, the kd-trees are loaded when they are needed.
+        //The metadata can come from the cache file without opening the index file.
+        //It holds all of the metadata, since the index is lent out and never changes once it is.
+        const CachedMetadata *metadata = cachedMetadata(info);
+        if(metadata && metadata->isIndex)
+        {
+            index_t *index = (index_t *)calloc(1, sizeof(index_t));
+            index->indexname = strdup(metadata->indexname.toUtf8().constData());
+            index->indexid = metadata->indexid;
+            index->healpix = metadata->healpix;
+            index->hpnside = metadata->hpnside;
+            index->index_jitter = metadata->jitter;
+            index->cutnside = metadata->cutnside;
+            index->cutnsweep = metadata->cutnsweep;
+            index->cutdedup = metadata->cutdedup;
+            index->cutband = metadata->cutband.isEmpty() ? NULL : strdup(metadata->cutband.toUtf8().constData());
+            index->cutmargin = metadata->cutmargin;
+            index->circle = metadata->circle ? TRUE : FALSE;
+            index->cx_less_than_dx = metadata->cxLessThanDx ? TRUE : FALSE;
+            index->meanx_less_than_half = metadata->meanxLessThanHalf ? TRUE : FALSE;
+            index->index_scale_lower = metadata->scaleLower;
+            index->index_scale_upper = metadata->scaleUpper;
+            index->dimquads = metadata->dimquads;
+            index->nstars = metadata->nstars;
+            index->nquads = metadata->nquads;
+            index->packed = metadata->packed ? TRUE : FALSE;
+            entry->index = index;
+        }
+        else if(!metadata)
+        {
+            entry->index = index_load(path.toUtf8().constData(), INDEX_ONLY_LOAD_METADATA, NULL);
+            cacheMetadata(info, entry->index);
+        }
+
+        m_Entries.insert(path, entry);
+        if(entry->index)
+            m_Owners.insert(entry->index, entry);
+    }
+
+    if(!entry->index)
+        return nullptr;
+    return entry;
+}
+
+bool IndexCatalog::loadEntryTrees(Entry *entry)
+{
+    if(entry->fullyLoaded)
+    {
+        m_Hits++;
+        entry->lastUsed = ++m_Clock;
+        return true;
+    }
+    m_Misses++;
+    makeRoom(entry->size);
+
+    //The kd-trees are loaded into an index_t of their own.  Other solvers may be reading the metadata of the index_t
+    //they borrowed right now, without the lock, so that one never changes.  Only the kd-tree pointers are copied into it.
+    index_t *trees = index_load(entry->path.toUtf8().constData(), 0, NULL);
+    if(!trees)
+        return false;
+    index_t *index = entry->index;
+    index->codekd = trees->codekd;
+    index->quads = trees->quads;
+    index->starkd = trees->starkd;
+    index->packed_map = trees->packed_map;
+    index->packed_mapsize = trees->packed_mapsize;
+    entry->trees = trees;
+    entry->fullyLoaded = true;
+    entry->lastUsed = ++m_Clock;
+    return true;
+}
+
+void IndexCatalog::unloadEntryTrees(Entry *entry)
+{
+    index_t *index = entry->index;
+    index->codekd = nullptr;
+    index->quads = nullptr;
+    index->starkd = nullptr;
+    index->packed_map = nullptr;
+    index->packed_mapsize = 0;
+    index_free(entry->trees);
+    entry->trees = nullptr;
+    entry->fullyLoaded = false;
+}
+
+void IndexCatalog::makeRoom(qint64 bytes)
+{
+    if(m_MemoryBudget <= 0)
+        return;
+    qint64 resident = residentBytes();
+    while(resident + bytes > m_MemoryBudget)
+    {
+        Entry *oldest = nullptr;
+        for(auto entry : m_Entries)
+        {
+            if(entry->fullyLoaded && entry->treeUsers <= 0 && (!oldest || entry->lastUsed < oldest->lastUsed))
+                oldest = entry;
+        }
+        //If everything loaded is in use, the budget is exceeded until some of them are done
+        if(!oldest)
+            return;
+        unloadEntryTrees(oldest);
+        resident -= oldest->size;
+        m_Evictions++;
+    }
+}
+
+qint64 IndexCatalog::residentBytes() const
+{
+    qint64 bytes = 0;
+    for(auto entry : m_Entries)
+    {
+        if(entry->fullyLoaded)
+            bytes += entry->size;
+    }
+    for(auto entry : m_Retired)
+    {
+        if(entry->fullyLoaded)
+            bytes += entry->size;
+    }
+    return bytes;
+}
+
+const IndexCatalog::CachedMetadata *IndexCatalog::cachedMetadata(const QFileInfo &info)
+{
+    FolderMetadata &folder = folderMetadata(info.absolutePath());
+    auto metadata = folder.files.constFind(info.fileName());
+    if(metadata == folder.files.constEnd())
+        return nullptr;
+    if(metadata->size != info.size() || metadata->modified != info.lastModified().toMSecsSinceEpoch())
+        return nullptr;
+    return &metadata.value();
+}
+
+void IndexCatalog::cacheMetadata(const QFileInfo &info, const index_t *index)
+{
+    CachedMetadata metadata;
+    metadata.size = info.size();
+    metadata.modified = info.lastModified().toMSecsSinceEpoch();
+    metadata.isIndex = index != nullptr;
+    metadata.indexid = index ? index->indexid : 0;
+    metadata.healpix = index ? index->healpix : 0;
+    metadata.hpnside = index ? index->hpnside : 0;
+    metadata.scaleLower = index ? index->index_scale_lower : 0;
+    metadata.scaleUpper = index ? index->index_scale_upper : 0;
+    metadata.jitter = index ? index->index_jitter : 0;
+    metadata.cutnside = index ? index->cutnside : 0;
+    metadata.cutnsweep = index ? index->cutnsweep : 0;
+    metadata.cutdedup = index ? index->cutdedup : 0;
+    metadata.cutmargin = index ? index->cutmargin : 0;
+    metadata.circle = index ? index->circle : false;
+    metadata.cxLessThanDx = index ? index->cx_less_than_dx : false;
+    metadata.meanxLessThanHalf = index ? index->meanx_less_than_half : false;
+    metadata.dimquads = index ? index->dimquads : 0;
+    metadata.nstars = index ? index->nstars : 0;
+    metadata.nquads = index ? index->nquads : 0;
+    metadata.packed = index ? index->packed : false;
+    if(index)
+    {
+        metadata.indexname = QString::fromUtf8(index->indexname);
+        if(index->cutband)
+            metadata.cutband = QString::fromUtf8(index->cutband);
+    }
+
+    FolderMetadata &folder = folderMetadata(info.absolutePath());
+    folder.files.insert(info.fileName(), metadata);
+    folder.modified = true;
+}
+
+IndexCatalog::FolderMetadata &IndexCatalog::folderMetadata(const QString &folder)
+{
+    auto existing = m_MetadataCache.find(folder);
+    if(existing != m_MetadataCache.end())
+        return existing.value();
+
+    FolderMetadata &metadataCache = m_MetadataCache[folder];
+    QFile file(metadataCacheFileName(folder));
+    if(!file.open(QIODevice::ReadOnly))
+        return metadataCache;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    QString cachedFolder;
+    quint32 count;
+    in >> magic >> version >> cachedFolder >> count;
+    //A cache file from another version or another folder is ignored and will be replaced.
+    if(magic != METADATA_CACHE_MAGIC || version != METADATA_CACHE_VERSION || cachedFolder != folder)
+        return metadataCache;
+
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        QString fileName;
+        CachedMetadata metadata;
+        in >> fileName >> metadata.size >> metadata.modified >> metadata.isIndex >> metadata.indexname
+           >> metadata.indexid >> metadata.healpix >> metadata.hpnside >> metadata.scaleLower >> metadata.scaleUpper
+           >> metadata.jitter >> metadata.cutnside >> metadata.cutnsweep >> metadata.cutdedup >> metadata.cutband >> metadata.cutmargin
+           >> metadata.circle >> metadata.cxLessThanDx >> metadata.meanxLessThanHalf
+           >> metadata.dimquads >> metadata.nstars >> metadata.nquads >> metadata.packed;
+        if(in.status() == QDataStream::Ok)
+            metadataCache.files.insert(fileName, metadata);
+    }
+    return metadataCache;
+}
+
+void IndexCatalog::saveMetadataCaches()
+{
+    for(auto folder = m_MetadataCache.begin(); folder != m_MetadataCache.end(); ++folder)
+    {
+        if(!folder->modified)
+            continue;
+        folder->modified = false;
+
+        //If the cache can't be written, the metadata will just be read from the index files next time.
+        QString fileName = metadataCacheFileName(folder.key());
+        QDir().mkpath(QFileInfo(fileName).absolutePath());
+        QSaveFile file(fileName);
+        if(!file.open(QIODevice::WriteOnly))
+            continue;
+
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << METADATA_CACHE_MAGIC << METADATA_CACHE_VERSION << folder.key() << (quint32)folder->files.count();
+        for(auto metadata = folder->files.constBegin(); metadata != folder->files.constEnd(); ++metadata)
+        {
+            out << metadata.key() << metadata->size << metadata->modified << metadata->isIndex << metadata->indexname
+                << metadata->indexid << metadata->healpix << metadata->hpnside << metadata->scaleLower << metadata->scaleUpper
+                << metadata->jitter << metadata->cutnside << metadata->cutnsweep << metadata->cutdedup << metadata->cutband << metadata->cutmargin
+                << metadata->circle << metadata->cxLessThanDx << metadata->meanxLessThanHalf
+                << metadata->dimquads << metadata->nstars << metadata->nquads << metadata->packed;
+        }
+        file.commit();
+    }
+}
+
+QString IndexCatalog::metadataCacheFileName(const QString &folder)
+{
+    //The cache files are kept in the user's cache folder since index folders are often not writable.
+    QByteArray folderHash = QCryptographicHash::hash(folder.toUtf8(), QCryptographicHash::Md5).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/stellarsolver/index-metadata-"
+           + QString::fromLatin1(folderHash) + ".cache";
+}
+
+void IndexCatalog::retire(Entry *entry)
+{
+    m_Entries.remove(entry->path);
+    if(entry->borrowers > 0)
+        m_Retired.append(entry);
+    else
+        freeEntry(entry);
+}
+
+void IndexCatalog::freeEntry(Entry *entry)
+{
+    if(entry->trees)
+        unloadEntryTrees(entry);
+    if(entry->index)
+    {
+        m_Owners.remove(entry->index);
+        index_free(entry->index);
+    }
+    delete entry;
+}
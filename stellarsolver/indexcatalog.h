@@ -0,0 +1,250 @@
+/*  IndexCatalog, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "parameters.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+/**
+ * @brief The IndexCatalog class keeps the astrometry index files loaded between solves.
+ * There is one catalog for the whole process.  Every InternalExtractorSolver, including the child solvers,
+ * borrows its index_t objects from it instead of loading them into a new engine for each solve.
+ * A file is only loaded again when its size or modification time changes, and the index folders are
+ * only listed again when rescan is called.
+ * The metadata of the index files is also saved in a small cache file for each index folder, so that
+ * after a restart the index list can be built without reading the headers of every index file.
+ * When the indexes are not searched in parallel, their kd-trees are loaded one at a time with loadTrees and
+ * stay loaded afterwards, up to the memory budget.  Beyond that, the least recently used ones are unloaded.
+ */
+class IndexCatalog
+{
+    public:
+        /**
+         * @brief instance gets the catalog shared by all the solvers in this process
+         * @return The IndexCatalog
+         */
+        static IndexCatalog &instance();
+
+        /**
+         * @brief acquire borrows the indexes for the given index files and the index files found in the given folders
+         * @param indexFolders are the folders to search for index files
+         * @param indexFiles are index files to use in addition to the ones in the folders
+         * @param fullyLoaded should be true if the kd-trees must stay loaded until they are released (inParallel), otherwise only the metadata is loaded
+         * @return The borrowed indexes, which must be given back with release once the engine is done with them
+         */
+        QVector<index_t *> acquire(const QStringList &indexFolders, const QStringList &indexFiles, bool fullyLoaded);
+
+        /**
+         * @brief release gives back indexes that were borrowed with acquire
+         * @param indexes are the borrowed indexes
+         * @param fullyLoaded should be the same as when they were acquired
+         */
+        void release(const QVector<index_t *> &indexes, bool fullyLoaded);
+
+        /**
+         * @brief loadTrees loads the kd-trees of a borrowed index, if they are not still loaded from an earlier search,
+         * and keeps them loaded until doneWithTrees is called
+         * @param index is the borrowed index
+         * @return false if the kd-trees could not be loaded
+         */
+        bool loadTrees(index_t *index);
+
+        /**
+         * @brief doneWithTrees says that the kd-trees loaded with loadTrees are not being used any more.
+         * They stay loaded unless they are needed to make room for other indexes.
+         * @param index is the borrowed index
+         */
+        void doneWithTrees(index_t *index);
+
+        /**
+         * @brief setMemoryBudget sets how much of the index files may stay loaded between searches
+         * @param bytes is the total size of the index files to keep loaded, 0 means there is no limit
+         */
+        void setMemoryBudget(qint64 bytes);
+
+        /**
+         * @brief residency gets how many indexes are loaded and how often they were already loaded when they were needed
+         * @return The residency statistics
+         */
+        SSolver::IndexResidency residency();
+
+        /**
+         * @brief rescan forgets the folder listings so the index folders are searched again the next time they are used
+         */
+        void rescan();
+
+        /**
+         * @brief clear unloads all of the indexes and forgets the folder listings.
+         * Indexes that are still borrowed are unloaded once they are released.
+         */
+        void clear();
+
+    private:
+        IndexCatalog() = default;
+        ~IndexCatalog();
+        IndexCatalog(const IndexCatalog &) = delete;
+        IndexCatalog &operator=(const IndexCatalog &) = delete;
+
+        // This struct contains one index file held by the catalog
+        struct Entry
+        {
+            QString path;                   // The absolute path of the index file
+            qint64 size;                    // The size of the file when it was loaded
+            QDateTime modified;             // The modification time of the file when it was loaded
+            index_t *index;                 // The index lent to the solvers, nullptr if the file could not be loaded as an index
+            index_t *trees;                 // The index that owns the kd-trees while they are loaded, nullptr otherwise
+            bool fullyLoaded;               // Whether the kd-trees are loaded or just the metadata
+            int borrowers;                  // The number of solvers currently using the index
+            int treeUsers;                  // The number of solvers using the kd-trees right now, they can't be unloaded until it is 0
+            quint64 lastUsed;               // When the kd-trees were last used, in ticks of m_Clock
+        };
+
+        // This struct contains the cached metadata of one file in an index folder
+        struct CachedMetadata
+        {
+            qint64 size;                    // The size of the file when the metadata was cached
+            qint64 modified;                // The modification time of the file in ms since the epoch
+            bool isIndex;                   // Whether the file could be loaded as an index at all
+            QString indexname;              // The name astrometry.net uses for the index (the quad file)
+            qint32 indexid;
+            qint32 healpix;
+            qint32 hpnside;
+            double scaleLower;              // The smallest quad size in the index in arcseconds
+            double scaleUpper;              // The largest quad size in the index in arcseconds
+            double jitter;                  // The jitter of the index in arcseconds
+            qint32 cutnside;
+            qint32 cutnsweep;
+            double cutdedup;
+            QString cutband;
+            qint32 cutmargin;
+            bool circle;
+            bool cxLessThanDx;
+            bool meanxLessThanHalf;
+            qint32 dimquads;
+            qint32 nstars;
+            qint32 nquads;
+            bool packed;                    // Whether the file is a packed index
+        };
+
+        // This struct contains the metadata cache for one index folder
+        struct FolderMetadata
+        {
+            QHash<QString, CachedMetadata> files;  // The cached metadata keyed by the file name
+            bool modified = false;                 // Whether it needs to be saved
+        };
+
+        QMutex m_Mutex;                                 // Guards everything below since solvers run in their own threads
+        QHash<QString, Entry *> m_Entries;              // The current entry for each index file path
+        QHash<index_t *, Entry *> m_Owners;             // The entry each loaded index belongs to, used by release
+        QList<Entry *> m_Retired;                       // Entries replaced or cleared while they were still borrowed
+        QHash<QString, QStringList> m_FolderListings;   // The index files found in each folder
+        QHash<QString, FolderMetadata> m_MetadataCache; // The metadata cache for each index folder
+        qint64 m_MemoryBudget {0};                      // The total size of the index files that may stay loaded, 0 means no limit
+        quint64 m_Clock {0};                            // Counts the uses of the kd-trees to find the least recently used ones
+        quint64 m_Hits {0};                             // The number of times the kd-trees were already loaded when needed
+        quint64 m_Misses {0};                           // The number of times the kd-trees had to be loaded
+        quint64 m_Evictions {0};                        // The number of times the kd-trees were unloaded to make room
+
+        /**
+         * @brief folderListing gets the index files in a folder, searching the folder only if it has not been searched before
+         * @param folder is the folder to search
+         * @return The paths of the index files, in the order that astrometry.net adds them
+         */
+        QStringList folderListing(const QString &folder);
+
+        /**
+         * @brief lookup gets the entry for an index file, loading its metadata if it is new or has changed on disk
+         * @param path is the absolute path of the index file
+         * @return The entry, or nullptr if the file is not a usable index
+         */
+        Entry *lookup(const QString &path);
+
+        /**
+         * @brief loadEntryTrees loads the kd-trees of an entry, unloading the least recently used ones first if they don't fit in the budget
+         * @param entry is the entry to load
+         * @return false if the kd-trees could not be loaded
+         */
+        bool loadEntryTrees(Entry *entry);
+
+        /**
+         * @brief unloadEntryTrees takes the kd-trees out of the index lent to the solvers and frees them
+         * @param entry is the entry to unload, none of the solvers may be using its kd-trees
+         */
+        void unloadEntryTrees(Entry *entry);
+
+        /**
+         * @brief makeRoom unloads the kd-trees of the least recently used entries that are not being used
+         * until the given number of bytes more fits in the memory budget, or there is nothing more to unload
+         * @param bytes is the size that has to fit
+         */
+        void makeRoom(qint64 bytes);
+
+        /**
+         * @brief residentBytes gets the total size of the index files with their kd-trees loaded
+         * @return The size in bytes
+         */
+        qint64 residentBytes() const;
+
+        /**
+         * @brief retire removes an entry from the catalog, freeing it now or once its last borrower releases it
+         * @param entry is the entry to retire
+         */
+        void retire(Entry *entry);
+
+        /**
+         * @brief cachedMetadata gets the cached metadata for a file if it is still up to date
+         * @param info is the file
+         * @return The metadata, or nullptr if the file is not in the cache or has changed since
+         */
+        const CachedMetadata *cachedMetadata(const QFileInfo &info);
+
+        /**
+         * @brief cacheMetadata remembers the metadata of a file so it will be saved in its folder's cache file
+         * @param info is the file
+         * @param index is the index loaded from the file, or nullptr if it is not an index
+         */
+        void cacheMetadata(const QFileInfo &info, const index_t *index);
+
+        /**
+         * @brief folderMetadata gets the metadata cache for an index folder, reading the cache file the first time
+         * @param folder is the absolute path of the folder
+         * @return The metadata cache for the folder
+         */
+        FolderMetadata &folderMetadata(const QString &folder);
+
+        /**
+         * @brief saveMetadataCaches writes the cache files of any folders whose metadata changed
+         */
+        void saveMetadataCaches();
+
+        /**
+         * @brief metadataCacheFileName gets the path of the cache file used for an index folder
+         * @param folder is the absolute path of the folder
+         * @return The path of the cache file
+         */
+        static QString metadataCacheFileName(const QString &folder);
+
+        /**
+         * @brief freeEntry frees the index held by an entry and the entry itself
+         * @param entry is the entry to free
+         */
+        void freeEntry(Entry *entry);
+};
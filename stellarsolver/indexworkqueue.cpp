@@ -0,0 +1,69 @@
+/*  IndexWorkQueue, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "indexworkqueue.h"
+#include "indexcatalog.h"
+
+#include <QMutexLocker>
+
+IndexWorkQueue::IndexWorkQueue(const QStringList &indexFolders, const QStringList &indexFiles,
+                               bool fullyLoaded) : m_FullyLoaded(fullyLoaded)
+{
+    m_Indexes = IndexCatalog::instance().acquire(indexFolders, indexFiles, fullyLoaded);
+}
+
+IndexWorkQueue::~IndexWorkQueue()
+{
+    IndexCatalog::instance().release(m_Indexes, m_FullyLoaded);
+}
+
+void IndexWorkQueue::addDepthRange(int depthlo, int depthhi)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_DepthRanges.append(qMakePair(depthlo, depthhi));
+}
+
+void IndexWorkQueue::addWorker(anbool *cancelled)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Workers.append(cancelled);
+    //A child solver that starts late should not start searching if the image is already solved
+    if(m_Solved)
+        *cancelled = TRUE;
+}
+
+void IndexWorkQueue::removeWorker(anbool *cancelled)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Workers.removeAll(cancelled);
+}
+
+bool IndexWorkQueue::take(WorkUnit &unit)
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_Solved || m_Indexes.isEmpty() || m_NextUnit >= unitCount())
+        return false;
+
+    //The units go through every index with the first depth range before moving on to the next one.
+    const QPair<int, int> &depths = m_DepthRanges.at(m_NextUnit / m_Indexes.count());
+    unit.index = m_NextUnit % m_Indexes.count();
+    unit.depthlo = depths.first;
+    unit.depthhi = depths.second;
+    m_NextUnit++;
+    return true;
+}
+
+void IndexWorkQueue::solved(anbool *cancelled)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Solved = true;
+    for(auto &worker : m_Workers)
+    {
+        if(worker != cancelled)
+            *worker = TRUE;
+    }
+}
@@ -0,0 +1,104 @@
+/*  IndexWorkQueue, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QMutex>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+/**
+ * @brief The IndexWorkQueue class holds the work shared by the child solvers of a MULTI_INDEXES solve.
+ * Each unit of work is one index file searched over one range of star depths.  The child solvers keep taking
+ * the next unit until the queue runs out or one of them solves the image, at which point the others are cancelled.
+ * The units are handed out with the brightest stars first for every index, just like astrometry.net searches.
+ */
+class IndexWorkQueue
+{
+    public:
+        // This struct contains one unit of work for a child solver
+        struct WorkUnit
+        {
+            int index;      // The position of the index in indexes()
+            int depthlo;    // The first star to use
+            int depthhi;    // The last star to use
+        };
+
+        /**
+         * @brief IndexWorkQueue borrows the index files that will be searched from the IndexCatalog
+         * @param indexFolders are the folders to search for index files
+         * @param indexFiles are index files to use in addition to the ones in the folders
+         * @param fullyLoaded should be true if the kd-trees must be loaded (inParallel)
+         */
+        IndexWorkQueue(const QStringList &indexFolders, const QStringList &indexFiles, bool fullyLoaded);
+        ~IndexWorkQueue();
+
+        /**
+         * @brief addDepthRange adds a unit of work for every index file with this range of star depths
+         * @param depthlo is the first star to use
+         * @param depthhi is the last star to use
+         */
+        void addDepthRange(int depthlo, int depthhi);
+
+        /**
+         * @brief indexes gets the index files all the child solvers search, the units refer to them by position
+         * @return The indexes
+         */
+        const QVector<index_t *> &indexes() const
+        {
+            return m_Indexes;
+        }
+
+        /**
+         * @brief unitCount gets the total number of units of work in the queue
+         * @return The number of units
+         */
+        int unitCount() const
+        {
+            return m_Indexes.count() * m_DepthRanges.count();
+        }
+
+        /**
+         * @brief addWorker registers a child solver so that it can be cancelled once another one solves
+         * @param cancelled is the cancel variable of the child solver's astrometry job
+         */
+        void addWorker(anbool *cancelled);
+
+        /**
+         * @brief removeWorker unregisters a child solver once it is done taking work
+         * @param cancelled is the cancel variable that was registered
+         */
+        void removeWorker(anbool *cancelled);
+
+        /**
+         * @brief take gets the next unit of work
+         * @param unit is filled with the unit of work
+         * @return false if there is no more work or the image was already solved
+         */
+        bool take(WorkUnit &unit);
+
+        /**
+         * @brief solved stops the queue and cancels every other registered child solver
+         * @param cancelled is the cancel variable of the child solver that solved the image
+         */
+        void solved(anbool *cancelled);
+
+    private:
+        QMutex m_Mutex;                             // Guards the members below since the child solvers run in their own threads
+        QVector<index_t *> m_Indexes;               // The indexes borrowed from the IndexCatalog
+        bool m_FullyLoaded;                         // Whether the indexes were borrowed with their kd-trees loaded
+        QVector<QPair<int, int>> m_DepthRanges;     // The ranges of star depths to search
+        QVector<anbool *> m_Workers;                // The cancel variables of the registered child solvers
+        int m_NextUnit = 0;                         // The next unit of work to hand out
+        bool m_Solved = false;                      // Whether one of the child solvers solved the image
+};
@@ -18,6 +18,10 @@
 #include <memory>
 
 #include "internalextractorsolver.h"
+#include "indexcatalog.h"
+#include "indexworkqueue.h"
+#include "pixelkernels.h"
+#include "solverpool.h"
 #include "stellarsolver.h"
 #include "sep/extract.h"
 #include "qmath.h"
@@ -26,6 +30,7 @@
 extern "C" {
 #include "astrometry/log.h"
 #include "astrometry/sip-utils.h"
+#include "astrometry/fit-wcs.h"
 }
 
 using namespace SSolver;
@@ -33,13 +38,28 @@ using namespace SEP;
 
 static int solverNum = 1;
 
+//These let astrometry.net take the kd-trees of the indexes from the IndexCatalog when they are not searched in parallel,
+//so the most recently used ones stay loaded between searches instead of being read from the index files every time.
+static int loadCatalogIndex(index_t* index, void* userdata)
+{
+    Q_UNUSED(userdata);
+    return IndexCatalog::instance().loadTrees(index) ? 0 : -1;
+}
+
+static void doneWithCatalogIndex(index_t* index, void* userdata)
+{
+    Q_UNUSED(userdata);
+    IndexCatalog::instance().doneWithTrees(index);
+}
+
 InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorType eType, SolverType sType,
         FITSImage::Statistic imagestats, uint8_t const *imageBuffer, QObject *parent) : ExtractorSolver(pType, eType, sType,
                     imagestats, imageBuffer, parent)
 {
     //This sets the base name used for the temp files.
     m_BaseName = "internalExtractorSolver_" + QString::number(solverNum++);
-    m_PartitionThreads = QThread::idealThreadCount();
+    //The partitions are extracted with QtConcurrent, so they can use as many threads as its pool has
+    m_PartitionThreads = QThreadPool::globalInstance()->maxThreadCount();
 }
 
 InternalExtractorSolver::~InternalExtractorSolver()
@@ -59,6 +79,15 @@ void InternalExtractorSolver::abort()
     m_WasAborted = true;
 }
 
+void InternalExtractorSolver::startTask()
+{
+    m_Task = QtConcurrent::run(SolverPool::instance(), [this]()
+    {
+        SolverPool::applyAffinity();
+        run();
+    });
+}
+
 //This method generates child solvers with the options of the current solver
 ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
 {
@@ -67,6 +96,8 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
     InternalExtractorSolver *solver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics,
             m_ImageBuffer, nullptr);
     solver->m_ExtractedStars = m_ExtractedStars;
+    //The child solvers all read the star positions from the same catalog
+    solver->m_StarCatalog = getStarCatalog();
     solver->m_BasePath = m_BasePath;
     //They will all share the same basename
     solver->m_HasExtracted = true;
@@ -83,6 +114,9 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
         solver->setSearchScale(scalelo, scalehi, scaleunit);
     if(m_UsePosition)
         solver->setSearchPositionInDegrees(search_ra, search_dec);
+    if(m_UseSearchWCS)
+        solver->setSearchWCS(searchWCS);
+    solver->m_TrackSearchWCS = m_TrackSearchWCS;
     if(m_AstrometryLogLevel != SSolver::LOG_NONE || m_SSLogLevel != SSolver::LOG_OFF)
         connect(solver, &ExtractorSolver::logOutput, this,  &ExtractorSolver::logOutput);
     solver->usingDownsampledImage = usingDownsampledImage;
@@ -97,6 +131,13 @@ int InternalExtractorSolver::extract()
 //This is the method that runs the solver or star extractor.  Do not call it, use the methods above instead, so that it can start a new thread.
 void InternalExtractorSolver::run()
 {
+    //A solver queued on the pool can be aborted before it ever starts, then there is nothing left to do
+    if(m_WasAborted)
+    {
+        emit finished(-1);
+        return;
+    }
+
     if(m_AstrometryLogLevel != SSolver::LOG_NONE && m_LogToFile)
     {
         if(m_LogFileName == "")
@@ -154,31 +195,10 @@ void InternalExtractorSolver::cleanupTempFiles()
 
 void InternalExtractorSolver::allocateDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
 {
-    switch (m_Statistics.dataType)
+    for (uint32_t row = 0; row < h; row++)
     {
-        case SEP_TBYTE:
-            getFloatBuffer<uint8_t>(data, x, y, w, h);
-            break;
-        case TSHORT:
-            getFloatBuffer<int16_t>(data, x, y, w, h);
-            break;
-        case TUSHORT:
-            getFloatBuffer<uint16_t>(data, x, y, w, h);
-            break;
-        case TLONG:
-            getFloatBuffer<int32_t>(data, x, y, w, h);
-            break;
-        case TULONG:
-            getFloatBuffer<uint32_t>(data, x, y, w, h);
-            break;
-        case TFLOAT:
-            getFloatBuffer<float>(data, x, y, w, h);
-            break;
-        case TDOUBLE:
-            getFloatBuffer<double>(data, x, y, w, h);
-            break;
-        default:
-            delete [] data;
+        size_t offset = (static_cast<size_t>(y + row) * m_Statistics.width + x) * m_Statistics.bytesPerPixel;
+        PixelKernels::toFloat(m_ImageBuffer + offset, m_Statistics.dataType, w, data + static_cast<size_t>(row) * w);
     }
 }
 
@@ -216,6 +236,37 @@ void computeMargin(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2,
     *height = endY - *startY + 1;
 }
 
+// This function plans the partitions of the rectangle x, y, w, h for the adaptive partition algorithm.
+// It makes several partitions per thread, so that the threads stay busy even when some partitions
+// have many more stars than others, but it keeps them big enough that the margins around them are a
+// small part of the work.  The partitions are as close to square as the rectangle allows and together
+// they cover it exactly.
+QVector<QRect> planPartitions(uint32_t x, uint32_t y, uint32_t w, uint32_t h, int threads, int margin)
+{
+    constexpr int PARTITIONS_PER_THREAD = 4;
+    const int minSide = std::max(128, 8 * margin);
+    const int maxColumns = std::max(1, static_cast<int>(w) / minSide);
+    const int maxRows = std::max(1, static_cast<int>(h) / minSide);
+    const int wanted = std::min(threads > 1 ? threads * PARTITIONS_PER_THREAD : 1, maxColumns * maxRows);
+
+    const int columns = qBound(1, qRound(std::sqrt(static_cast<double>(wanted) * w / h)), maxColumns);
+    const int rows = qBound(1, (wanted + columns - 1) / columns, maxRows);
+
+    QVector<QRect> partitions;
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < columns; j++)
+        {
+            const int x1 = x + (w * j) / columns;
+            const int x2 = x + (w * (j + 1)) / columns;
+            const int y1 = y + (h * i) / rows;
+            const int y2 = y + (h * (i + 1)) / rows;
+            partitions.append(QRect(x1, y1, x2 - x1, y2 - y1));
+        }
+    }
+    return partitions;
+}
+
 }  // namespace
 
 //The code in this section is my attempt at running an internal star extractor program based on SEP
@@ -262,7 +313,6 @@ int InternalExtractorSolver::runSEPExtractor()
          innerStartX(inX1), innerStartY(inY1), innerEndX(inX2), innerEndY(inY2) {}
     };
 
-    QList<float *> dataBuffers;
     QVector<QFuture<QList<FITSImage::Star>>> futures;
     QList<StartupOffset> startupOffsets;
     QList<FITSImage::Background> backgrounds;
@@ -280,11 +330,32 @@ int InternalExtractorSolver::runSEPExtractor()
     else if (DEFAULT_MARGIN > 50)
       DEFAULT_MARGIN = 50;
 
-    // Only partition if:
+    const bool adaptive = m_ActiveParameters.partition && m_ActiveParameters.partitionAlgorithm == PARTITION_ADAPTIVE;
+
+    // With the grid algorithm, only partition if:
     // We have 2 or more threads.
     // The image width and height is larger than partition size.
     constexpr int PARTITION_SIZE = 200;
-    if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE && (m_PartitionThreads % 2) == 0)
+    if (adaptive)
+    {
+        // Every partition keeps up to initialKeep stars, and the largest of all of them are kept below.
+        for (const QRect &partition : planPartitions(x, y, w, h, m_PartitionThreads, DEFAULT_MARGIN))
+        {
+            uint32_t startX, startY, subWidth, subHeight;
+            computeMargin(partition.left(), partition.top(), partition.right(), partition.bottom(),
+                          m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
+                          &startX, &startY, &subWidth, &subHeight);
+
+            startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight,
+                                                partition.left(), partition.top(), partition.right(), partition.bottom()));
+            FITSImage::Background tempBackground;
+            backgrounds.append(tempBackground);
+
+            ImageParams parameters = {m_ImageBuffer, m_Statistics.width, m_Statistics.height, startX, startY, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
+            futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
+        }
+    }
+    else if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE && (m_PartitionThreads % 2) == 0)
     {
         // Partition the image to regions.
         // If there is extra at the end, we add an offset.
@@ -329,17 +400,14 @@ int InternalExtractorSolver::runSEPExtractor()
                 startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight,
                                                     rawStartX, rawStartY, rawEndX-1, rawEndY-1));
 
-                auto * data = new float[subWidth * subHeight];
-                allocateDataBuffer(data, startX, startY, subWidth, subHeight);
-                dataBuffers.append(data);
                 FITSImage::Background tempBackground;
                 backgrounds.append(tempBackground);
 
-                ImageParams parameters = {data,
-                                          subWidth,
-                                          subHeight,
-                                          0,
-                                          0,
+                ImageParams parameters = {m_ImageBuffer,
+                                          m_Statistics.width,
+                                          m_Statistics.height,
+                                          startX,
+                                          startY,
                                           subWidth,
                                           subHeight,
                                           m_ActiveParameters.initialKeep / m_PartitionThreads,
@@ -357,14 +425,11 @@ int InternalExtractorSolver::runSEPExtractor()
         computeMargin(x, y, x+w-1, y+h-1, m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
                       &startX, &startY, &subWidth, &subHeight);
 
-        auto * data = new float[subWidth * subHeight];
-        allocateDataBuffer(data, startX, startY, subWidth, subHeight);
-        dataBuffers.append(data);
         startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight, x, y, x+w-1, y+h-1));
         FITSImage::Background tempBackground;
         backgrounds.append(tempBackground);
 
-        ImageParams parameters = {data, subWidth, subHeight, 0, 0, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
+        ImageParams parameters = {m_ImageBuffer, m_Statistics.width, m_Statistics.height, startX, startY, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
         futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
     }
 
@@ -372,7 +437,6 @@ int InternalExtractorSolver::runSEPExtractor()
     {
         oneFuture.waitForFinished();
         QList<FITSImage::Star> partitionStars = oneFuture.result();
-        QList<FITSImage::Star> acceptedStars;
         if (!startupOffsets.empty())
         {
             const StartupOffset oneOffset = startupOffsets.takeFirst();
@@ -388,10 +452,19 @@ int InternalExtractorSolver::runSEPExtractor()
                   continue;
                 oneStar.x += startX;
                 oneStar.y += startY;
-                acceptedStars.append(oneStar);
+                m_ExtractedStars.append(oneStar);
             }
         }
-        m_ExtractedStars.append(acceptedStars);
+    }
+
+    // Each adaptive partition kept its own largest stars, so the largest of those are the largest in the image.
+    if (adaptive && m_ExtractedStars.size() > m_ActiveParameters.initialKeep)
+    {
+        std::stable_sort(m_ExtractedStars.begin(), m_ExtractedStars.end(), [](const FITSImage::Star & s1, const FITSImage::Star & s2)
+        {
+            return s1.a * s1.a + s1.b * s1.b > s2.a * s2.a + s2.b * s2.b;
+        });
+        m_ExtractedStars = m_ExtractedStars.mid(0, m_ActiveParameters.initialKeep);
     }
 
     double sumGlobal = 0, sumRmsSq = 0;
@@ -411,18 +484,26 @@ int InternalExtractorSolver::runSEPExtractor()
 
     applyStarFilters(m_ExtractedStars);
 
-    for (auto * buffer : dataBuffers)
-        delete [] buffer;
-    dataBuffers.clear();
-
     m_HasExtracted = true;
 
     return 0;
 }
 
+namespace
+{
+
+// This function gives the half height of the box SEP reads around an ellipse aperture,
+// the same way boxextent_ellipse in sep/aperture.cpp works it out.
+double ellipseExtent(double cxx, double cyy, double cxy, double r)
+{
+    const double dylim = cyy - cxy * cxy / (4.0 * cxx);
+    return dylim > 0.0 ? r / sqrt(dylim) : 0.0;
+}
+
+}  // namespace
+
 QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImageParams &parameters)
 {
-    float *imback = nullptr;
     double *fluxerr = nullptr, *area = nullptr;
     short *flag = nullptr;
     int status = 0;
@@ -435,7 +516,6 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     {
         sep_bkg_free(bkg);
         Extract::sep_catalog_free(catalog);
-        free(imback);
         free(fluxerr);
         free(area);
         free(flag);
@@ -456,11 +536,13 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     int numToProcess = 0;
 
     // #0 Create SEP Image structure
-    sep_image im = {parameters.data,
+    // SEP reads the partition straight out of the image buffer one line at a time, so the partition is never copied.
+    const size_t partitionOffset = (static_cast<size_t>(parameters.subY) * parameters.width + parameters.subX) * m_Statistics.bytesPerPixel;
+    sep_image im = {const_cast<uint8_t *>(parameters.data + partitionOffset),
                     nullptr,
                     nullptr,
                     nullptr,
-                    SEP_TFLOAT,
+                    static_cast<int>(m_Statistics.dataType),
                     0,
                     0,
                     0,
@@ -482,32 +564,16 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         return partitionStars;
     }
 
-    // #2 Background evaluation
-    imback = (float *)malloc((parameters.subW * parameters.subH) * sizeof(float));
-    status = sep_bkg_array(bkg, imback, SEP_TFLOAT);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
     //Saving some background information
     parameters.background->bh = bkg->bh;
     parameters.background->bw = bkg->bw;
     parameters.background->global = bkg->global;
     parameters.background->globalrms = bkg->globalrms;
 
-    // #3 Background subtraction
-    status = sep_bkg_subarray(bkg, im.data, im.dtype);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
     std::unique_ptr<Extract> extractor;
     extractor.reset(new Extract());
-    // #4 Source Extraction
+    // #2 Source Extraction
+    // The background is subtracted from each line as SEP reads it.
     // Note that we set deblend_cont = 1.0 to turn off deblending.
     const double extractionThreshold = m_ActiveParameters.threshold_bg_multiple * bkg->globalrms + m_ActiveParameters.threshold_offset;
     //fprintf(stderr, "Using %.1f =  %.1f * %.1f + %.1f\n", extractionThreshold, m_ActiveParameters.threshold_bg_multiple, bkg->globalrms,  m_ActiveParameters.threshold_offset);
@@ -515,7 +581,7 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                                     convFilter.data(),
                                     sqrt(convFilter.size()), sqrt(convFilter.size()), SEP_FILTER_CONV,
                                     m_ActiveParameters.deblend_thresh,
-                                    m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param, &catalog);
+                                    m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param, &catalog, bkg);
     if (status != 0)
     {
         cleanup();
@@ -525,6 +591,44 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     // Record the number of stars detected.
     parameters.background->num_stars_detected = catalog->nobj;
 
+    // #3 Photometry
+    // The apertures are measured in a band of background subtracted rows that follows the stars down the partition,
+    // so only the rows around the star being measured are held in memory.  SEP finds row y of the partition at
+    // (y % raw_h) in the band, so the band is a ring of raw_h rows holding rows bandFirst to bandLast - 1.
+    sep_image band = im;
+    band.data = nullptr;
+    band.dtype = SEP_TFLOAT;
+    band.raw_w = parameters.subW;
+    band.raw_h = 0;
+    QVector<float> bandRows;
+    int bandFirst = 0, bandLast = 0;
+
+    //This makes sure the band holds the rows an aperture reaching extent pixels above and below y will read
+    auto loadBand = [ & ](double y, double extent)
+    {
+        const int first = static_cast<int>(std::max(0.0, std::floor(y - extent)));
+        const int last = static_cast<int>(std::min(static_cast<double>(parameters.subH), std::ceil(y + extent) + 2));
+        if (first >= last)
+            return;
+        if (last - first > band.raw_h)
+        {
+            band.raw_h = std::min(static_cast<int>(parameters.subH), 2 * (last - first));
+            bandRows.resize(band.raw_h * band.raw_w);
+            band.data = bandRows.data();
+            bandFirst = bandLast = 0;
+        }
+        if (first < bandFirst || first > bandLast)
+            bandFirst = bandLast = first;
+        for (int row = bandLast; row < last; row++)
+        {
+            float *line = bandRows.data() + (row % band.raw_h) * band.raw_w;
+            allocateDataBuffer(line, parameters.subX, parameters.subY + row, parameters.subW, 1);
+            sep_bkg_subline(bkg, row, line, SEP_TFLOAT);
+        }
+        bandLast = std::max(bandLast, last);
+        bandFirst = std::max(bandFirst, bandLast - band.raw_h);
+    };
+
     // Find the oval sizes for each detection in the detected star catalog, and sort by that. Oval size
     // correlates very well with HFR and likely magnitude.
     for (int i = 0; i < catalog->nobj; i++)
@@ -535,9 +639,18 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     std::sort(ovals.begin(), ovals.end(), [](const std::pair<int, double> &o1, const std::pair<int, double> &o2) -> bool { return o1.second > o2.second;});
 
     numToProcess = std::min(static_cast<uint32_t>(catalog->nobj), parameters.keep);
+
+    // The detections are measured from the top of the partition down so that the band only moves forward,
+    // but they are still reported in the order of the sort above.
+    std::vector<int> measureOrder(numToProcess);
     for (int index = 0; index < numToProcess; index++)
+        measureOrder[index] = index;
+    std::sort(measureOrder.begin(), measureOrder.end(), [&](int i1, int i2) -> bool { return catalog->y[ovals[i1].first] < catalog->y[ovals[i2].first];});
+    std::vector<FITSImage::Star> measuredStars(numToProcess);
+    std::vector<bool> measured(numToProcess, false);
+
+    for (int index : measureOrder)
     {
-        // Processing detections in the order of the sort above.
         int i = ovals[index].first;
 
         if (catalog->flag[i] & SEP_OBJ_TRUNC)
@@ -576,7 +689,8 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
             //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
             //Finding the kron radius for the sextraction
 
-            sep_kron_radius(&im, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
+            loadBand(yPos, ellipseExtent(cxx, cyy, cxy, 6));
+            sep_kron_radius(&band, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
         }
 
         bool use_circle;
@@ -599,12 +713,16 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
 
         if(use_circle)
         {
-            sep_sum_circle(&im, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
+            loadBand(yPos, m_ActiveParameters.r_min);
+            sep_sum_circle(&band, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
                            &sumerr, &kron_area, &kron_flag);
         }
         else
         {
-            sep_sum_ellipse(&im, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
+            double ecxx, ecyy, ecxy;
+            sep_ellipse_coeffs(a, b, theta, &ecxx, &ecyy, &ecxy);
+            loadBand(yPos, ellipseExtent(ecxx, ecyy, ecxy, m_ActiveParameters.kron_fact * kronrad));
+            sep_sum_ellipse(&band, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
                             m_ActiveParameters.inflags, &sum, &sumerr,
                             &kron_area, &kron_flag);
         }
@@ -615,7 +733,8 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         if(m_ProcessType == EXTRACT_WITH_HFR)
         {
             //Get HFR
-            sep_flux_radius(&im, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
+            loadBand(catalog->y[i], maxRadius);
+            sep_flux_radius(&band, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
                             flux_fractions,
                             &flux_flag);
             HFR = flux_fractions[0];
@@ -634,8 +753,14 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                                    0,
                                    numPixels
                                   };
-        // Make a copy and add it to QList
-        partitionStars.append(oneStar);
+        measuredStars[index] = oneStar;
+        measured[index] = true;
+    }
+
+    for (int index = 0; index < numToProcess; index++)
+    {
+        if (measured[index])
+            partitionStars.append(measuredStars[index]);
     }
 
     cleanup();
@@ -746,118 +871,28 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
     }
 }
 
-template <typename T>
-void InternalExtractorSolver::getFloatBuffer(float * buffer, int x, int y, int w, int h)
-{
-    auto * rawBuffer = reinterpret_cast<T const *>(m_ImageBuffer);
-    float * floatPtr = buffer;
-
-    int x2 = x + w;
-    int y2 = y + h;
-
-    for (int y1 = y; y1 < y2; y1++)
-    {
-        int offset = y1 * m_Statistics.width;
-        for (int x1 = x; x1 < x2; x1++)
-        {
-            *floatPtr++ = rawBuffer[offset + x1];
-        }
-    }
-}
-
 void InternalExtractorSolver::downsampleImage(int d)
-{
-    switch (m_Statistics.dataType)
-    {
-        case SEP_TBYTE:
-            downSampleImageType<uint8_t>(d);
-            break;
-        case TSHORT:
-            downSampleImageType<int16_t>(d);
-            break;
-        case TUSHORT:
-            downSampleImageType<uint16_t>(d);
-            break;
-        case TLONG:
-            downSampleImageType<int32_t>(d);
-            break;
-        case TULONG:
-            downSampleImageType<uint32_t>(d);
-            break;
-        case TFLOAT:
-            downSampleImageType<float>(d);
-            break;
-        case TDOUBLE:
-            downSampleImageType<double>(d);
-            break;
-        default:
-            return;
-    }
-
-}
-
-template <typename T>
-void InternalExtractorSolver::downSampleImageType(int d)
 {
     int w = m_Statistics.width;
     int h = m_Statistics.height;
-    const uint8_t channels = m_Statistics.channels;
-    int oldBufferSize = m_Statistics.samples_per_channel * channels * m_Statistics.bytesPerPixel;
-    //It is d times smaller in width and height
-    int newBufferSize = oldBufferSize / (d * d);
-    if(downSampledBuffer)
-        delete [] downSampledBuffer;
-    downSampledBuffer = new uint8_t[newBufferSize];
-    auto * sourceBuffer = reinterpret_cast<T const *>(m_ImageBuffer);
-    auto * destinationBuffer = reinterpret_cast<T *>(downSampledBuffer);
-
-    //The G pixels are after all the R pixels, Same for the B pixels
-    auto * rSource = sourceBuffer;
-    auto * gSource = sourceBuffer + (w * h);
-    auto * bSource = sourceBuffer + (w * h * 2);
-
-    for(int y = 0; y < h - d; y += d)
+    //It is d times smaller in width and height, every block of d x d pixels of all the channels is averaged into one pixel
+    size_t newBufferSize = static_cast<size_t>(w / d) * (h / d) * m_Statistics.bytesPerPixel;
+    auto * newBuffer = new uint8_t[newBufferSize];
+    if(!PixelKernels::downsample(m_ImageBuffer, m_Statistics.dataType, w, h, m_Statistics.channels, d, newBuffer))
     {
-        for (int x = 0; x < w - d; x += d)
-        {
-            //The sum of all the pixels in the sample
-            double total = 0;
-
-            for(int y2 = 0; y2 < d; y2++)
-            {
-                //The offset for the current line of the sample to take, since we have to sample different rows
-                int currentLine = w * y2;
-
-                //Shifting the R, G, and B Pointers to the sample location
-                auto *rSample = rSource + currentLine + x;
-                auto *gSample = gSource + currentLine + x;
-                auto *bSample = bSource + currentLine + x;
-                for(int x2 = 0; x2 < d; x2++)
-                {
-                    //This iterates the sample x2 spots to the right,
-                    total += *rSample++;
-                    //This only samples frome the G and B spots if it is an RGB image
-                    if(channels == 3)
-                    {
-                        total += *gSample++;
-                        total += *bSample++;
-                    }
-                }
-            }
-            //This calculates the average pixel value and puts it in the new downsampled image.
-            int pixel = (x / d) + (y / d) * (w / d);
-            destinationBuffer[pixel] = total / (d * d) / channels;
-        }
-        //Shifts each pointer by a whole line, d times
-        rSource += w * d;
-        gSource += w * d;
-        bSource += w * d;
+        delete [] newBuffer;
+        return;
     }
+    if(downSampledBuffer)
+        delete [] downSampledBuffer;
+    downSampledBuffer = newBuffer;
 
     m_ImageBuffer = downSampledBuffer;
-    m_Statistics.samples_per_channel /= (d * d);
     m_Statistics.width /= d;
     m_Statistics.height /= d;
+    m_Statistics.samples_per_channel = m_Statistics.width * m_Statistics.height;
+    //The channels were averaged together
+    m_Statistics.channels = 1;
     if(scaleunit == ARCSEC_PER_PIX)
     {
         scalelo *= d;
@@ -1003,20 +1038,22 @@ int InternalExtractorSolver::runInternalSolver()
         if(logFile)
             log_to(logFile);
     }
-    for(auto &onePath : indexFiles)
+    //This borrows the index files from the catalog shared by all the solvers, based on the files and folders set before the solver was started.
+    //The catalog only loads index files that are new or have changed, so the indexes are not loaded again for every solve.
+    QVector<index_t *> catalogIndexes;
+    if(m_WorkQueue)
     {
-        engine_add_index(engine, onePath.toUtf8().data());
+        //In a MULTI_INDEXES solve, the work queue already borrowed the indexes for all of the child solvers.
+        for(auto &oneIndex : m_WorkQueue->indexes())
+            engine_add_loaded_index(engine, oneIndex);
     }
-    //These set the folders in which Astrometry.net will look for index files, based on the folers set before the solver was started.
-    for(auto &onePath : indexFolderPaths)
+    else
     {
-        engine_add_search_path(engine, onePath.toLatin1().constData());
+        catalogIndexes = IndexCatalog::instance().acquire(indexFolderPaths, indexFiles, m_ActiveParameters.inParallel);
+        for(auto &oneIndex : catalogIndexes)
+            engine_add_loaded_index(engine, oneIndex);
     }
 
-    //This actually adds the index files in the directories above.
-    if(indexFolderPaths.count() > 0)
-        engine_autoindex_search_paths(engine);
-
     //This checks to see that index files were found in the paths above, if not, it prints this warning and aborts.
     if (!pl_size(engine->indexes))
     {
@@ -1027,31 +1064,25 @@ int InternalExtractorSolver::runInternalSolver()
                                "---------------------------------------------------------------------\n"
                                "\n"));
         engine_free(engine);
+        IndexCatalog::instance().release(catalogIndexes, m_ActiveParameters.inParallel);
         return -1;
     }
 
     prepare_job();
 
     blind_t* bp = &(job->bp);
-
-    //This will set up the field file to solve as an xylist
-    double *xArray = new double[m_ExtractedStars.size()];
-    double *yArray = new double[m_ExtractedStars.size()];
-
-    int i = 0;
-    for(auto &oneStar : m_ExtractedStars)
+    //prepare_job clears the whole blind_t, so an abort that came in before it, or during the extraction, has to be set again
+    if(m_WasAborted)
+        bp->cancelled = TRUE;
+    if(!engine->inparallel)
     {
-        xArray[i] = oneStar.x;
-        yArray[i] = oneStar.y;
-        i++;
+        bp->load_index = loadCatalogIndex;
+        bp->done_with_index = doneWithCatalogIndex;
     }
 
+    //This will set up the field file to solve as an xylist, reading the star positions right out of the star catalog
     starxy_t* fieldToSolve = (starxy_t*)calloc(1, sizeof(starxy_t));
-    fieldToSolve->x = xArray;
-    fieldToSolve->y = yArray;
-    fieldToSolve->N = m_ExtractedStars.size();
-    fieldToSolve->flux = nullptr;
-    fieldToSolve->background = nullptr;
+    getStarCatalog().fieldView(fieldToSolve);
     bp->solver.fieldxy = fieldToSolve;
 
     if(depthlo != -1 && depthhi != -1)
@@ -1084,6 +1115,8 @@ int InternalExtractorSolver::runInternalSolver()
     if (engine->minwidth <= 0.0 || engine->maxwidth <= 0.0 || engine->minwidth > engine->maxwidth)
     {
         emit logOutput(QString("\"minwidth\" and \"maxwidth\" must be positive and the maxwidth must be greater!\n"));
+        engine_free(engine);
+        IndexCatalog::instance().release(catalogIndexes, m_ActiveParameters.inParallel);
         return -1;
     }
     ///This sets the scales based on the minwidth and maxwidth if the image scale isn't known
@@ -1113,7 +1146,12 @@ int InternalExtractorSolver::runInternalSolver()
                    " profile. . .");
 
     //This runs the job in the engine in the file engine.c
-    if (engine_run_job(engine, job))
+    //If the WCS of an earlier solve still fits the stars, there is no need to search for quads at all.
+    if(m_UseSearchWCS && verifySearchWCS(engine))
+        emit logOutput("The search WCS was verified, so the image was solved without searching");
+    else if(m_WorkQueue)
+        runWorkQueue(engine);
+    else if (engine_run_job(engine, job))
         emit logOutput("Failed to run job");
 
     //Needs to close the file after the logging is done
@@ -1124,11 +1162,17 @@ int InternalExtractorSolver::runInternalSolver()
 
     //This deletes or frees the items that are no longer needed.
     engine_free(engine);
+    IndexCatalog::instance().release(catalogIndexes, m_ActiveParameters.inParallel);
+    if(!m_ActiveParameters.inParallel && !isChildSolver)
+    {
+        IndexResidency residency = IndexCatalog::instance().residency();
+        emit logOutput(QString("%1 of %2 index files are loaded (%3 of %4 MB), %5 of %6 searches found their index loaded").arg(
+                           residency.resident).arg(residency.indexes).arg(residency.residentBytes / (1024 * 1024)).arg(
+                           residency.memoryBudget / (1024 * 1024)).arg(residency.hits).arg(residency.hits + residency.misses));
+    }
     bl_free(job->scales);
     dl_free(job->depths);
     free(fieldToSolve);
-    delete[] xArray;
-    delete[] yArray;
 
     //Note: I can only get these items after the solve because I made a couple of small changes to the Astrometry.net Code.
     //I made it return in solve_fields in blind.c before it ran "cleanup".  I also had it wait to clean up solutions, blind and solver in engine.c.  We will do that after we get the solution information.
@@ -1221,6 +1265,234 @@ int InternalExtractorSolver::runInternalSolver()
     return returnCode;
 }
 
+void InternalExtractorSolver::runWorkQueue(engine_t *engine)
+{
+    blind_t* bp = &(job->bp);
+
+    //This is registered after prepare_job so the other child solvers can cancel this one once they solve the image
+    m_WorkQueue->addWorker(&bp->cancelled);
+
+    //Each unit of work searches just one of the indexes with one range of depths
+    engine->index_subset = il_new(4);
+    IndexWorkQueue::WorkUnit unit;
+    while(!bp->cancelled && m_WorkQueue->take(unit))
+    {
+        il_remove_all(engine->index_subset);
+        il_append(engine->index_subset, unit.index);
+        il_remove_all(job->depths);
+        il_append(job->depths, unit.depthlo);
+        il_append(job->depths, unit.depthhi);
+
+        if (engine_run_job(engine, job))
+            emit logOutput("Failed to run job");
+
+        if(bp->single_field_solved)
+        {
+            m_WorkQueue->solved(&bp->cancelled);
+            break;
+        }
+    }
+
+    m_WorkQueue->removeWorker(&bp->cancelled);
+}
+
+bool InternalExtractorSolver::verifySearchWCS(engine_t *engine)
+{
+    blind_t* bp = &(job->bp);
+
+    //The search WCS is for the full size image, so it needs to be scaled down to match a downsampled image
+    sip_t verifyWCS;
+    if(usingDownsampledImage)
+        sip_scale(&searchWCS, &verifyWCS, 1.0 / m_ActiveParameters.downsample);
+    else
+        verifyWCS = searchWCS;
+    verifyWCS.wcstan.imagew = m_Statistics.width;
+    verifyWCS.wcstan.imageh = m_Statistics.height;
+
+    //In tracking mode, the search WCS is first moved onto the stars of this image by matching them with the index stars
+    if(m_TrackSearchWCS)
+    {
+        if(trackSearchWCS(engine, verifyWCS))
+            emit logOutput("Tracked the search WCS by matching the index stars");
+        else
+            emit logOutput("Could not track the search WCS, the index stars did not match");
+    }
+
+    emit logOutput("Verifying the search WCS before searching for quads");
+    blind_add_verify_wcs(bp, &verifyWCS);
+    bp->verify_only = TRUE;
+    if (engine_run_job(engine, job))
+        emit logOutput("Failed to run job");
+    bp->verify_only = FALSE;
+    blind_clear_verify_wcses(bp);
+
+    if(!bp->single_field_solved)
+        emit logOutput("The search WCS did not fit the stars, searching for quads");
+    return bp->single_field_solved;
+}
+
+//This matches the index stars that the WCS puts in the image with the extracted stars and fits a new WCS to them.
+//The field is allowed to drift by up to a tenth of the image, so it keeps up with fields that moved too far for verification alone.
+bool InternalExtractorSolver::trackSearchWCS(engine_t *engine, sip_t &trackedWCS)
+{
+    blind_t* bp = &(job->bp);
+    const double width = m_Statistics.width;
+    const double height = m_Statistics.height;
+    //The drift is found by voting for the offsets between the index stars and the extracted stars in bins this size, in pixels
+    const double matchRadius = 3.0;
+    const double maxDrift = qMax(width, height) / 10.0;
+    const int bins = qCeil(2 * maxDrift / matchRadius);
+
+    //These are the index stars within the field, including a margin for the drift
+    double pixscale = sip_pixel_scale(&trackedWCS);
+    double ra, dec, center[3];
+    sip_get_radec_center(&trackedWCS, &ra, &dec);
+    radecdeg2xyzarr(ra, dec, center);
+    double radius = arcsec2dist(pixscale * (hypot(width, height) / 2.0 + maxDrift));
+    double quadlo = bp->quad_size_fraction_lo * qMin(width, height) * pixscale;
+    double quadhi = bp->quad_size_fraction_hi * qMax(width, height) * pixscale;
+
+    QVector<double> indexXYZ;   // The positions of the index stars in the field, for the index with the most matches
+    QVector<double> starXYZ;    // The positions of the matched index stars
+    QVector<double> fieldXY;    // The positions of the extracted stars they matched
+
+    //The extracted stars are read from the columns of the star catalog
+    const StarCatalog &catalog = getStarCatalog();
+    const double *starX = catalog.x();
+    const double *starY = catalog.y();
+    const int numExtracted = catalog.count();
+
+    //This matches the projected index stars with the nearest extracted star to where the drift moved them
+    auto matchStars = [&](const QVector<double> &xyz, const QVector<QPointF> &projected, double dx, double dy,
+                          QVector<double> &matchedXYZ, QVector<double> &matchedXY)
+    {
+        matchedXYZ.clear();
+        matchedXY.clear();
+        for(int i = 0; i < projected.size(); i++)
+        {
+            double bestDistance = matchRadius * matchRadius;
+            int bestStar = -1;
+            for(int s = 0; s < numExtracted; s++)
+            {
+                double distance = pow(starX[s] - projected[i].x() - dx, 2) + pow(starY[s] - projected[i].y() - dy, 2);
+                if(distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    bestStar = s;
+                }
+            }
+            if(bestStar >= 0)
+            {
+                matchedXYZ << xyz[3 * i] << xyz[3 * i + 1] << xyz[3 * i + 2];
+                matchedXY << starX[bestStar] << starY[bestStar];
+            }
+        }
+    };
+
+    for (size_t i = 0; i < pl_size(engine->indexes); i++)
+    {
+        index_t* index = (index_t*)pl_get(engine->indexes, i);
+        //Only the indexes covering the field are searched, so an all-sky series doesn't load the kd-trees of every tile
+        if(!index_overlaps_scale_range(index, quadlo, quadhi) || !index_is_within_range(index, ra, dec, dist2deg(radius)))
+            continue;
+
+        double *nearbyXYZ = nullptr;
+        int numStars = 0;
+        //Only the metadata of an index may be loaded, the star kd-tree has to be loaded before searching it
+        if(!engine->inparallel && !IndexCatalog::instance().loadTrees(index))
+            continue;
+        if(index->starkd)
+            startree_search_for(index->starkd, center, radius * radius, &nearbyXYZ, nullptr, nullptr, &numStars);
+        if(!engine->inparallel)
+            IndexCatalog::instance().doneWithTrees(index);
+
+        QVector<double> xyz;
+        QVector<QPointF> projected;
+        for(int j = 0; j < numStars; j++)
+        {
+            double x, y;
+            if(!sip_xyzarr2pixelxy(&trackedWCS, nearbyXYZ + 3 * j, &x, &y))
+                continue;
+            if(x < -maxDrift || y < -maxDrift || x > width + maxDrift || y > height + maxDrift)
+                continue;
+            xyz << nearbyXYZ[3 * j] << nearbyXYZ[3 * j + 1] << nearbyXYZ[3 * j + 2];
+            projected << QPointF(x, y);
+        }
+        free(nearbyXYZ);
+
+        //Every pair of an index star and an extracted star votes for their offset, the field drifted by the most popular one
+        QVector<int> votes(bins * bins, 0);
+        for(auto &point : projected)
+        {
+            for(int s = 0; s < numExtracted; s++)
+            {
+                int binX = qFloor((starX[s] - point.x() + maxDrift) / matchRadius);
+                int binY = qFloor((starY[s] - point.y() + maxDrift) / matchRadius);
+                if(binX >= 0 && binY >= 0 && binX < bins && binY < bins)
+                    votes[binY * bins + binX]++;
+            }
+        }
+        int peak = std::max_element(votes.begin(), votes.end()) - votes.begin();
+        if(votes[peak] == 0)
+            continue;
+        double dx = (peak % bins + 0.5) * matchRadius - maxDrift;
+        double dy = (peak / bins + 0.5) * matchRadius - maxDrift;
+
+        QVector<double> matchedXYZ, matchedXY;
+        matchStars(xyz, projected, dx, dy, matchedXYZ, matchedXY);
+        if(matchedXYZ.size() > starXYZ.size())
+        {
+            indexXYZ = xyz;
+            starXYZ = matchedXYZ;
+            fieldXY = matchedXY;
+        }
+    }
+
+    //A TAN WCS needs at least 3 stars, a few more make sure the drift was not a chance alignment
+    const int minMatches = 6;
+    if(starXYZ.size() / 3 < minMatches)
+        return false;
+
+    tan_t tan;
+    if(fit_tan_wcs(starXYZ.constData(), fieldXY.constData(), starXYZ.size() / 3, &tan, nullptr))
+        return false;
+
+    //The fit is redone with the stars matched by the new WCS, which also takes care of any rotation
+    QVector<QPointF> projected;
+    for(int j = 0; j < indexXYZ.size() / 3; j++)
+    {
+        double x = -HUGE_VAL, y = -HUGE_VAL;
+        tan_xyzarr2pixelxy(&tan, indexXYZ.constData() + 3 * j, &x, &y);
+        projected << QPointF(x, y);
+    }
+    matchStars(indexXYZ, projected, 0, 0, starXYZ, fieldXY);
+    int numMatched = starXYZ.size() / 3;
+    if(numMatched < minMatches || fit_tan_wcs(starXYZ.constData(), fieldXY.constData(), numMatched, &tan, nullptr))
+        return false;
+
+    //We would like the WCS to be centered on the image, like the solutions
+    double crpix[2] = {width / 2.0 + 0.5, height / 2.0 + 0.5};
+    tan_t centered;
+    if(fit_tan_wcs_move_tangent_point(starXYZ.constData(), fieldXY.constData(), numMatched, crpix, &tan, &centered))
+        centered = tan;
+    centered.imagew = width;
+    centered.imageh = height;
+    sip_wrap_tan(&centered, &trackedWCS);
+    return true;
+}
+
+bool InternalExtractorSolver::getSolutionWCS(sip_t &solutionWCS)
+{
+    if(!m_HasWCS)
+        return false;
+    //The WCS of a downsampled image is scaled back up to the full size image
+    if(usingDownsampledImage)
+        sip_scale(&wcs, &solutionWCS, m_ActiveParameters.downsample);
+    else
+        solutionWCS = wcs;
+    return true;
+}
+
 bool InternalExtractorSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &skyPoint)
 {
     if(!hasWCSData())
@@ -10,6 +10,8 @@
 #include "extractorsolver.h"
 #include "astrometrylogger.h"
 
+#include <QSharedPointer>
+
 //SEP Includes
 #include "sep/sep.h"
 
@@ -20,6 +22,8 @@ extern "C" {
 
 using namespace SSolver;
 
+class IndexWorkQueue;
+
 class InternalExtractorSolver: public ExtractorSolver
 {
     public:
@@ -28,9 +32,10 @@ class InternalExtractorSolver: public ExtractorSolver
         ~InternalExtractorSolver();
 
         // This struct contains information about the image used by SEP
+        // SEP reads the partition (subX, subY, subW, subH) straight out of the image buffer, which is width pixels wide
         typedef struct
         {
-            float *data;
+            uint8_t const *data;
             uint32_t width;
             uint32_t height;
             uint32_t subX;
@@ -52,6 +57,11 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         void abort() override;
 
+        /**
+         * @brief startTask runs the InternalExtractorSolver as a task on the SolverPool instead of in a thread of its own
+         */
+        void startTask() override;
+
         /**
          * @brief appendStarsRAandDEC attaches the RA and DEC information to a star list
          * @param stars is the star list to process
@@ -89,6 +99,21 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint) override;
 
+        /**
+         * @brief getSolutionWCS gets the SIP object from the latest plate solve, scaled back up if the image was downsampled
+         * @param solutionWCS gets the WCS in the pixel coordinates of the full size image
+         * @return false if the image has not been solved
+         */
+        bool getSolutionWCS(sip_t &solutionWCS) override;
+
+        /**
+         * @brief setWorkQueue makes this child solver take its work from a queue shared with the other child solvers (MULTI_INDEXES)
+         * @param workQueue is the shared queue of index files and depth ranges to search
+         */
+        void setWorkQueue(const QSharedPointer<IndexWorkQueue> &workQueue)
+        {
+            m_WorkQueue = workQueue;
+        }
 
 
     protected:
@@ -116,8 +141,8 @@ class InternalExtractorSolver: public ExtractorSolver
         QList<FITSImage::Star> extractPartition(const ImageParams &parameters);
 
         /**
-         * @brief allocateDataBuffer allocates the space needed for the image buffer object used by SEP
-         * @param data is the image buffer used by SEP being allocated
+         * @brief allocateDataBuffer fills a float buffer used by SEP with part of the image
+         * @param data is the float buffer being filled, it must hold w * h values
          * @param x is the starting x coordinate of the partition to be processed
          * @param y is the starting y coordinate of the partition to be processed
          * @param w is the width of the partition to be processed
@@ -146,6 +171,9 @@ class InternalExtractorSolver: public ExtractorSolver
         FILE *logFile = nullptr;        // This is the name of the log file used
         AstrometryLogger astroLogger;  // This is an object that lets C based astrometry report to C++ based code
 
+        // The queue of work shared by the child solvers in a MULTI_INDEXES solve, null otherwise
+        QSharedPointer<IndexWorkQueue> m_WorkQueue;
+
     // InternalExtractorSolver Methods
 
         /**
@@ -166,26 +194,32 @@ class InternalExtractorSolver: public ExtractorSolver
         int runInternalSolver();
 
         /**
-         * @brief getFloatBuffer gets a float buffer from the image buffer for SEP to perform star extraction
-         * @param buffer is a pointer to the created image buffer
-         * @param x is the starting x coordinate of the buffer
-         * @param y is the starting y coordinate of the buffer
-         * @param w is the width of the buffer
-         * @param h is the height of the buffer
+         * @brief runWorkQueue runs the engine on units of work taken from the shared work queue until it runs out or the image is solved
+         * @param engine is the engine that was set up with all of the work queue's indexes
          */
-        template <typename T> void getFloatBuffer(float * buffer, int x, int y, int w, int h);
+        void runWorkQueue(engine_t *engine);
 
         /**
-         * @brief downsampleImage downsamples the image by the requested factor
-         * @param d The factor to downsample by in both dimensions
+         * @brief verifySearchWCS checks the search WCS against the engine's indexes without searching for quads
+         * @param engine is the engine that was set up with the indexes
+         * @return true if the search WCS fits the stars well enough to solve the image
          */
-        void downsampleImage(int d);
+        bool verifySearchWCS(engine_t *engine);
+
+        /**
+         * @brief trackSearchWCS moves the search WCS onto this image by matching the index stars it projects into the image with the extracted stars
+         * @param engine is the engine that was set up with the indexes
+         * @param trackedWCS is the search WCS, it gets the WCS fitted to the matched stars
+         * @return false if not enough stars matched, then trackedWCS is unchanged
+         */
+        bool trackSearchWCS(engine_t *engine, sip_t &trackedWCS);
 
         /**
-         * @brief downSampleImageType allows the downsampling code to handle various data types
+         * @brief downsampleImage downsamples the image by the requested factor
          * @param d The factor to downsample by in both dimensions
          */
-        template <typename T> void downSampleImageType(int d);
+        void downsampleImage(int d);
+
 
 
 };
@@ -21,6 +21,7 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //Option to partition star extraction in separate threads or not
             partition == o.partition &&
+            partitionAlgorithm == o.partitionAlgorithm &&
 
             threshold_offset == o.threshold_offset &&
             threshold_bg_multiple == o.threshold_bg_multiple &&
@@ -40,6 +41,7 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //Settings from the Astrometry Config file
             inParallel == o.inParallel &&
+            indexMemoryBudget == o.indexMemoryBudget &&
             solverTimeLimit == o.solverTimeLimit &&
             minwidth == o.minwidth &&
             maxwidth == o.maxwidth &&
@@ -83,6 +85,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(Parameters params)
 
     //Option to partition star extraction in separate threads or not
     settingsMap.insert("partition", QVariant(params.partition));
+    settingsMap.insert("partitionAlgo", QVariant(params.partitionAlgorithm));
 
     settingsMap.insert("threshold_offset", QVariant(params.threshold_offset));
     settingsMap.insert("threshold_bg_multiple", QVariant(params.threshold_bg_multiple));
@@ -104,6 +107,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(Parameters params)
     settingsMap.insert("maxwidth", QVariant(params.maxwidth)) ;
     settingsMap.insert("minwidth", QVariant(params.minwidth)) ;
     settingsMap.insert("inParallel", QVariant(params.inParallel)) ;
+    settingsMap.insert("indexMemoryBudget", QVariant(params.indexMemoryBudget)) ;
     settingsMap.insert("solverTimeLimit", QVariant(params.solverTimeLimit));
 
     //Astrometry Basic Parameters
@@ -150,6 +154,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(QMap<QString, QVariant>
 
     //Option to partition star extraction in separate threads or not
     params.partition = settingsMap.value("partition", params.partition).toBool();
+    params.partitionAlgorithm = (PartitionAlgo)(settingsMap.value("partitionAlgo", params.partitionAlgorithm)).toInt();
 
     //StellarSolver Star Filter Settings
     params.maxSize = settingsMap.value("maxSize", params.maxSize).toDouble();
@@ -168,6 +173,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(QMap<QString, QVariant>
     params.maxwidth = settingsMap.value("maxwidth", params.maxwidth).toDouble() ;
     params.minwidth = settingsMap.value("minwidth", params.minwidth).toDouble() ;
     params.inParallel = settingsMap.value("inParallel", params.inParallel).toBool() ;
+    params.indexMemoryBudget = settingsMap.value("indexMemoryBudget", params.indexMemoryBudget).toInt() ;
     params.solverTimeLimit = settingsMap.value("solverTimeLimit", params.solverTimeLimit).toInt();
 
     //Astrometry Basic Parameters
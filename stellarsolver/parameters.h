@@ -221,7 +221,9 @@ static QString getCommandString(SSolver::ProcessType processType, SSolver::Extra
 typedef enum {NOT_MULTI,    // This option does not use parallel solving
               MULTI_SCALES, // This option generates multiple threads based on different image scales
               MULTI_DEPTHS, // This option generates multiple threads based on different image "depths"
-              MULTI_AUTO    // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_AUTO,   // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_INDEXES, // This option generates a thread per core that share a queue of index files and depths to search (internal solver only)
+              MULTI_POSITIONS // This option splits the search circle into HEALPix cells and searches each cell in its own thread (needs a search position)
              } MultiAlgo;
 
 //This gets a string for which Parallel Solving Algorithm we are using
@@ -240,6 +242,38 @@ static QString getMultiAlgoString(SSolver::MultiAlgo multi)
         case MULTI_DEPTHS:
             return "Depths";
             break;
+
+        case MULTI_INDEXES:
+            return "Indexes";
+            break;
+
+        case MULTI_POSITIONS:
+            return "Positions";
+            break;
+        default:
+            return "";
+            break;
+    }
+}
+
+// These are the algorithms used to split the image into partitions for star extraction in parallel threads
+// When extracting with the internal star extractor and partition enabled, this is one of the Parameters
+typedef enum {PARTITION_GRID,       // This option uses 200 pixel partitions in 2 rows, and only partitions with an even number of threads
+              PARTITION_ADAPTIVE    // This option plans several partitions per thread from the number of threads and the shape of the image
+             } PartitionAlgo;
+
+//This gets a string for which Partition Algorithm we are using
+static QString getPartitionAlgoString(SSolver::PartitionAlgo algo)
+{
+    switch(algo)
+    {
+        case PARTITION_GRID:
+            return "Grid";
+            break;
+
+        case PARTITION_ADAPTIVE:
+            return "Adaptive";
+            break;
         default:
             return "";
             break;
@@ -296,6 +330,45 @@ static QString getLogLevelString(SSolver::logging_level logLevel)
     }
 }
 
+// This is how many of the index files the internal solver keeps loaded between solves, and how often they were already loaded when needed
+typedef struct IndexResidency
+{
+    int indexes = 0;            // The number of index files known to the internal solver
+    int resident = 0;           // The number of them with their kd-trees loaded
+    qint64 residentBytes = 0;   // The size of the index files with their kd-trees loaded
+    qint64 memoryBudget = 0;    // How much of the index files may stay loaded, 0 means there is no limit
+    quint64 hits = 0;           // The number of times an index was needed and its kd-trees were already loaded
+    quint64 misses = 0;         // The number of times the kd-trees of an index had to be loaded
+    quint64 evictions = 0;      // The number of times the kd-trees of an index were unloaded to make room for another one
+} IndexResidency;
+
+// This is one image to plate solve with StellarSolver::solveBatch, along with the hints for it
+typedef struct SolveJob
+{
+    int id = 0;                                 // A number to identify the job by in its result
+    FITSImage::Statistic statistics {};         // This is information about the image
+    const uint8_t *imageBuffer = nullptr;       // The image data, it must stay valid until the result of the job is ready
+    bool useScale = false;                      // Whether or not to use the image scale
+    double scaleLow = 0;                        // Lower bound of image scale estimate
+    double scaleHigh = 0;                       // Upper bound of image scale estimate
+    ScaleUnits scaleUnit = ARCMIN_WIDTH;        // In what units are the lower and upper bounds?
+    bool usePosition = false;                   // Whether or not to use the search position
+    double searchRA = 0;                        // RA of field center for search, format: decimal degrees
+    double searchDE = 0;                        // DEC of field center for search, format: decimal degrees
+} SolveJob;
+
+// This is the result of one SolveJob
+typedef struct SolveResult
+{
+    int id = 0;                                 // The id of the job
+    bool solved = false;                        // Whether or not the image was solved
+    FITSImage::Solution solution {};            // The solution, if it was solved
+    short indexNumber = -1;                     // The index number of the index that solved it
+    short healpix = -1;                         // The healpix of the index that solved it
+    int numStars = 0;                           // The number of stars extracted from the image
+    QList<FITSImage::Star> stars;               // The stars used to solve it, with their RA and DEC if it was solved
+} SolveResult;
+
 //STELLARSOLVER PARAMETERS
 //These are the parameters used by the StellarSolver for both Star Extraction and Solving
 //The values here are the defaults unless they get changed.
@@ -392,6 +465,10 @@ class Parameters
         double logratio_totune  = log(
                                       1e6); // Odds ratio at which to try tuning up a match that isn't good enough to solve (default: 1e6)
 
+        //Parameters added after the ones above are kept at the end so the layout of the earlier ones does not change
+        PartitionAlgo partitionAlgorithm = PARTITION_GRID; // The algorithm used to plan the partitions when partition is true
+        int indexMemoryBudget = 0;          // When inParallel is off, the internal solver keeps the most recently used index files loaded in up to this many MB between solves, 0 means use most of the free RAM
+
         bool operator==(const Parameters &o);
 
         static QMap<QString, QVariant> convertToMap(Parameters params);
@@ -0,0 +1,434 @@
+/*  PixelKernels, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "pixelkernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+//CFitsio Includes
+#include <fitsio.h>
+
+//The SIMD kernels are compiled for their instruction sets one function at a time, so the library still runs on any x86 CPU
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELKERNELS_X86
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PIXELKERNELS_X86
+#define TARGET_AVX2
+#define TARGET_SSE41
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace PixelKernels
+{
+
+namespace
+{
+
+enum SimdLevel
+{
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+SimdLevel detectSimdLevel()
+{
+#if defined(PIXELKERNELS_X86) && !defined(_MSC_VER)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return SIMD_SSE41;
+#elif defined(PIXELKERNELS_X86)
+    int info[4];
+    __cpuid(info, 1);
+    const bool sse41 = info[2] & (1 << 19);
+    //AVX2 also needs the operating system to save the AVX registers
+    const bool osAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    if(osAVX && (info[1] & (1 << 5)))
+        return SIMD_AVX2;
+    if(sse41)
+        return SIMD_SSE41;
+#endif
+    return SIMD_SCALAR;
+}
+
+SimdLevel simd()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+// Conversion to float
+
+template <typename T>
+void toFloatScalar(const T *source, size_t count, float *destination)
+{
+    for(size_t i = 0; i < count; i++)
+        destination[i] = static_cast<float>(source[i]);
+}
+
+#if defined(PIXELKERNELS_X86)
+
+TARGET_AVX2 void toFloatAVX2(const uint8_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + i)));
+        _mm256_storeu_ps(destination + i, _mm256_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_AVX2 void toFloatAVX2(const uint16_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i)));
+        _mm256_storeu_ps(destination + i, _mm256_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_AVX2 void toFloatAVX2(const int16_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i)));
+        _mm256_storeu_ps(destination + i, _mm256_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_AVX2 void toFloatAVX2(const int32_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + i));
+        _mm256_storeu_ps(destination + i, _mm256_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_AVX2 void toFloatAVX2(const double *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_ps(destination + i, _mm256_cvtpd_ps(_mm256_loadu_pd(source + i)));
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_SSE41 void toFloatSSE41(const uint8_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        int32_t packed;
+        memcpy(&packed, source + i, sizeof(packed));
+        __m128i pixels = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+        _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_SSE41 void toFloatSSE41(const uint16_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + i)));
+        _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_SSE41 void toFloatSSE41(const int16_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + i)));
+        _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_SSE41 void toFloatSSE41(const int32_t *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(pixels));
+    }
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+TARGET_SSE41 void toFloatSSE41(const double *source, size_t count, float *destination)
+{
+    size_t i = 0;
+    for(; i + 2 <= count; i += 2)
+        _mm_storel_pi(reinterpret_cast<__m64 *>(destination + i), _mm_cvtpd_ps(_mm_loadu_pd(source + i)));
+    toFloatScalar(source + i, count - i, destination + i);
+}
+
+#endif
+
+template <typename T>
+void toFloatType(const void *source, size_t count, float *destination)
+{
+    const T *pixels = static_cast<const T *>(source);
+#if defined(PIXELKERNELS_X86)
+    switch(simd())
+    {
+        case SIMD_AVX2:
+            toFloatAVX2(pixels, count, destination);
+            return;
+        case SIMD_SSE41:
+            toFloatSSE41(pixels, count, destination);
+            return;
+        default:
+            break;
+    }
+#endif
+    toFloatScalar(pixels, count, destination);
+}
+
+// Downsampling
+
+template <typename T, typename Acc>
+void addRowScalar(const T *row, int count, Acc *sums)
+{
+    for(int i = 0; i < count; i++)
+        sums[i] += row[i];
+}
+
+#if defined(PIXELKERNELS_X86)
+
+TARGET_AVX2 void addRowAVX2(const uint8_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i)));
+        __m256i *sum = reinterpret_cast<__m256i *>(sums + i);
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+TARGET_AVX2 void addRowAVX2(const uint16_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+        __m256i *sum = reinterpret_cast<__m256i *>(sums + i);
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+TARGET_AVX2 void addRowAVX2(const int16_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+        __m256i *sum = reinterpret_cast<__m256i *>(sums + i);
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+TARGET_SSE41 void addRowSSE41(const uint8_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        int32_t packed;
+        memcpy(&packed, row + i, sizeof(packed));
+        __m128i pixels = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+        __m128i *sum = reinterpret_cast<__m128i *>(sums + i);
+        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+TARGET_SSE41 void addRowSSE41(const uint16_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i)));
+        __m128i *sum = reinterpret_cast<__m128i *>(sums + i);
+        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+TARGET_SSE41 void addRowSSE41(const int16_t *row, int count, int32_t *sums)
+{
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i)));
+        __m128i *sum = reinterpret_cast<__m128i *>(sums + i);
+        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), pixels));
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+#endif
+
+//The 8 and 16 bit pixels are added up in 32 bit integers, which is exact and can be done many pixels at a time
+template <typename T>
+void addRowInt32(const T *row, int count, int32_t *sums)
+{
+#if defined(PIXELKERNELS_X86)
+    switch(simd())
+    {
+        case SIMD_AVX2:
+            addRowAVX2(row, count, sums);
+            return;
+        case SIMD_SSE41:
+            addRowSSE41(row, count, sums);
+            return;
+        default:
+            break;
+    }
+#endif
+    addRowScalar(row, count, sums);
+}
+
+template <typename T, typename Acc>
+void downsampleType(const void *source, int width, int height, int channels, int d, void *destination,
+                    void (*addRow)(const T *, int, Acc *))
+{
+    auto * image = static_cast<const T *>(source);
+    auto * downsampled = static_cast<T *>(destination);
+    const int outWidth = width / d;
+    const int outHeight = height / d;
+    const size_t plane = static_cast<size_t>(width) * height;
+
+    //The sums of the block rows of every channel for each column of the image
+    std::vector<Acc> sums(outWidth * d);
+
+    for(int outY = 0; outY < outHeight; outY++)
+    {
+        std::fill(sums.begin(), sums.end(), Acc(0));
+        //The G pixels are after all the R pixels, Same for the B pixels
+        for(int c = 0; c < channels; c++)
+        {
+            for(int y = outY * d; y < (outY + 1) * d; y++)
+                addRow(image + c * plane + static_cast<size_t>(y) * width, outWidth * d, sums.data());
+        }
+
+        T *line = downsampled + static_cast<size_t>(outY) * outWidth;
+        for(int outX = 0; outX < outWidth; outX++)
+        {
+            Acc total = 0;
+            for(int x = outX * d; x < (outX + 1) * d; x++)
+                total += sums[x];
+            //This calculates the average pixel value the same way for every data type
+            line[outX] = static_cast<T>(static_cast<double>(total) / (d * d) / channels);
+        }
+    }
+}
+
+}  // namespace
+
+bool toFloat(const void *source, uint32_t dataType, size_t count, float *destination)
+{
+    switch(dataType)
+    {
+        case TBYTE:
+            toFloatType<uint8_t>(source, count, destination);
+            return true;
+        case TSHORT:
+            toFloatType<int16_t>(source, count, destination);
+            return true;
+        case TUSHORT:
+            toFloatType<uint16_t>(source, count, destination);
+            return true;
+        case TINT:
+        case TLONG:
+            toFloatType<int32_t>(source, count, destination);
+            return true;
+        case TULONG:
+            toFloatScalar(static_cast<const uint32_t *>(source), count, destination);
+            return true;
+        case TFLOAT:
+            memcpy(destination, source, count * sizeof(float));
+            return true;
+        case TDOUBLE:
+            toFloatType<double>(source, count, destination);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool downsample(const void *source, uint32_t dataType, int width, int height, int channels, int factor, void *destination)
+{
+    if(factor < 1 || channels < 1)
+        return false;
+
+    switch(dataType)
+    {
+        case TBYTE:
+            downsampleType<uint8_t, int32_t>(source, width, height, channels, factor, destination, addRowInt32<uint8_t>);
+            return true;
+        case TSHORT:
+            downsampleType<int16_t, int32_t>(source, width, height, channels, factor, destination, addRowInt32<int16_t>);
+            return true;
+        case TUSHORT:
+            downsampleType<uint16_t, int32_t>(source, width, height, channels, factor, destination, addRowInt32<uint16_t>);
+            return true;
+        case TINT:
+        case TLONG:
+            downsampleType<int32_t, int64_t>(source, width, height, channels, factor, destination, addRowScalar<int32_t, int64_t>);
+            return true;
+        case TULONG:
+            downsampleType<uint32_t, int64_t>(source, width, height, channels, factor, destination, addRowScalar<uint32_t, int64_t>);
+            return true;
+        case TFLOAT:
+            downsampleType<float, double>(source, width, height, channels, factor, destination, addRowScalar<float, double>);
+            return true;
+        case TDOUBLE:
+            downsampleType<double, double>(source, width, height, channels, factor, destination, addRowScalar<double, double>);
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char *simdLevel()
+{
+    switch(simd())
+    {
+        case SIMD_AVX2:
+            return "AVX2";
+        case SIMD_SSE41:
+            return "SSE4.1";
+        default:
+            return "Scalar";
+    }
+}
+
+}
@@ -0,0 +1,51 @@
+/*  PixelKernels, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * The PixelKernels convert and downsample image buffers of any of the FITS data types StellarSolver supports
+ * (TBYTE, TSHORT, TUSHORT, TINT, TLONG, TULONG, TFLOAT and TDOUBLE, where TLONG and TULONG are 32 bits).
+ * On x86 they pick AVX2 or SSE4.1 versions of the kernels at runtime, depending on what the CPU supports,
+ * and fall back to plain loops everywhere else.  The results are the same whichever version runs.
+ */
+namespace PixelKernels
+{
+
+/**
+ * @brief toFloat converts pixels to floats
+ * @param source is the first pixel to convert
+ * @param dataType is the FITS data type of the pixels
+ * @param count is the number of pixels to convert
+ * @param destination gets the count converted pixels
+ * @return false if the data type is not supported
+ */
+bool toFloat(const void *source, uint32_t dataType, size_t count, float *destination);
+
+/**
+ * @brief downsample averages every block of factor x factor pixels of all the channels into one pixel
+ * @param source is the image, with the channels stored one after another
+ * @param dataType is the FITS data type of both images
+ * @param width is the width of the source image
+ * @param height is the height of the source image
+ * @param channels is the number of channels in the source image
+ * @param factor is how many times smaller the downsampled image is in each dimension
+ * @param destination gets the (width / factor) x (height / factor) downsampled image
+ * @return false if the data type is not supported
+ */
+bool downsample(const void *source, uint32_t dataType, int width, int height, int channels, int factor, void *destination);
+
+/**
+ * @brief simdLevel gets the name of the kernels that run on this CPU, for logging
+ * @return "AVX2", "SSE4.1" or "Scalar"
+ */
+const char *simdLevel();
+
+}
@@ -136,14 +136,15 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
 
     /* If the input array type is not PIXTYPE, allocate a buffer to hold
        converted values */
-    if (image->dtype != PIXDTYPE)
+    //# Modified by Robert Lancaster for the StellarSolver Internal Library, a subimage of a wider image (raw_w > w) is converted too, one line at a time
+    if (image->dtype != PIXDTYPE || image->raw_w != image->w)
     {
         QMALLOC(buf, PIXTYPE, bufsize, status);
         buft = buf;
         if (status != RETURN_OK)
             goto exit;
     }
-    if (image->mask && (image->mdtype != PIXDTYPE))
+    if (image->mask && (image->mdtype != PIXDTYPE || image->raw_w != image->w))
     {
         QMALLOC(mbuf, PIXTYPE, bufsize, status);
         mbuft = mbuf;
@@ -165,14 +166,24 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
             bufsize = npix % bufsize;
 
         /* convert this row to PIXTYPE and store in buffer(s)*/
-        if (image->dtype != PIXDTYPE)
+        if (image->raw_w != image->w)
+        {
+            for (k = 0; k < bufsize / image->w; k++)
+                convert(imt + elsize * image->raw_w * k, image->w, buft + image->w * k);
+        }
+        else if (image->dtype != PIXDTYPE)
             convert(imt, bufsize, buft);
         else
             buft = (PIXTYPE *)imt;
 
         if (image->mask)
         {
-            if (image->mdtype != PIXDTYPE)
+            if (image->raw_w != image->w)
+            {
+                for (k = 0; k < bufsize / image->w; k++)
+                    mconvert(maskt + melsize * image->raw_w * k, image->w, mbuft + image->w * k);
+            }
+            else if (image->mdtype != PIXDTYPE)
                 mconvert(maskt, bufsize, mbuft);
             else
                 mbuft = (PIXTYPE *)maskt;
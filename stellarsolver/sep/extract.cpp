@@ -46,8 +46,11 @@ Extract::~Extract()
 
 /* initialize buffer */
 /* bufw must be less than or equal to w */
+/* if bkg is given, it is subtracted from every line as it is read, so that the
+ * data does not need to be background subtracted (or even converted) in advance */
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, added bkg so large images can be streamed
 int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                              int bufw, int bufh)
+                              int bufw, int bufh, sep_bkg *bkg)
 {
     int status, yl;
     //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
@@ -59,9 +62,11 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
 
     /* buffer array info */
     buf->bptr = NULL;
-    QMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
+    QMALLOC(buf->bptr, PIXTYPE, bufw * (bufh + 1), status);
     buf->bw = bufw;
     buf->bh = bufh;
+    buf->bkg = bkg;
+    buf->bkgline = buf->bptr + bufw * bufh;
 
     /* pointers to within buffer */
     buf->midline = buf->bptr + bufw * (bufh / 2); /* ptr to middle buffer line */
@@ -105,8 +110,15 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
     //                      buf->lastline);
 
     if (y < buf->dh)
+    {
         buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->bw - 1,
                       buf->lastline);
+        if (buf->bkg && sep_bkg_line(buf->bkg, y, buf->bkgline, SEP_TFLOAT) == RETURN_OK)
+        {
+            for (int i = 0; i < buf->bw - 1; i++)
+                buf->lastline[i] -= buf->bkgline[i];
+        }
+    }
 
     return;
 }
@@ -157,7 +169,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                          int minarea, float *conv, int convw, int convh,
                          int filter_type, int deblend_nthresh, double deblend_cont,
                          int clean_flag, double clean_param,
-                         sep_catalog **catalog)
+                         sep_catalog **catalog, sep_bkg *bkg)
 {
     arraybuffer       dbuf, nbuf, mbuf;
     infostruct        curpixinfo, initinfo, freeinfo;
@@ -289,7 +301,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
      */
     bufh = conv ? convh : 1;
     status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
-                              bufh);
+                              bufh, bkg);
     if (status != RETURN_OK) goto exit;
     if (isvarnoise)
     {
@@ -46,7 +46,7 @@ class Extract
                         int minarea, float *conv, int convw, int convh,
                         int filter_type, int deblend_nthresh, double deblend_cont,
                         int clean_flag, double clean_param,
-                        sep_catalog **catalog);
+                        sep_catalog **catalog, sep_bkg *bkg = nullptr);
 
         static void free_catalog_fields(sep_catalog *catalog);
         static void sep_catalog_free(sep_catalog *catalog);
@@ -72,7 +72,7 @@ class Extract
 
 
         int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                             int bufw, int bufh);
+                             int bufw, int bufh, sep_bkg *bkg = nullptr);
         void arraybuffer_readline(arraybuffer *buf);
         void arraybuffer_free(arraybuffer *buf);
 
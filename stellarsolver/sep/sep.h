@@ -28,8 +28,16 @@ namespace SEP
 /* datatype codes */
 #define SEP_TBYTE        11
 /* 8-bit unsigned byte */
+#define SEP_TUSHORT      20
+/* 16-bit unsigned short */
+#define SEP_TSHORT       21
+/* 16-bit signed short */
 #define SEP_TINT         31
 /* native int type */
+#define SEP_TULONG       40
+/* 32-bit unsigned, as StellarSolver stores TULONG images */
+#define SEP_TLONG        41
+/* 32-bit signed, as StellarSolver stores TLONG images */
 #define SEP_TFLOAT       42
 #define SEP_TDOUBLE      82
 
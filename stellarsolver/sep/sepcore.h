@@ -141,6 +141,8 @@ typedef struct
     array_converter readline;  /* function to read a data line into buffer */
     int elsize;         /* size in bytes of one element in original data */
     int yoff;           /* line index in original data corresponding to bufptr */
+    sep_bkg *bkg;       /* background subtracted from each line as it is read (can be NULL) */
+    PIXTYPE *bkgline;   /* background of the line being read (within bptr) */
 } arraybuffer;
 
 typedef struct
@@ -19,8 +19,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "sep.h"
 #include "sepcore.h"
+#include "pixelkernels.h"
 
 #define DETAILSIZE 512
 
@@ -95,30 +97,47 @@ void convert_array_flt(void *ptr, int n, PIXTYPE *target)
         target[i] = *source;
 }
 
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, the SEP data types have the same codes as the FITS ones,
+//so the conversions that can be vectorized use the StellarSolver pixel kernels
 void convert_array_dbl(void *ptr, int n, PIXTYPE *target)
 {
-    double *source = (double *)ptr;
-    int i;
-    for (i = 0; i < n; i++, source++)
-        target[i] = *source;
+    PixelKernels::toFloat(ptr, SEP_TDOUBLE, n, target);
 }
 
 void convert_array_int(void *ptr, int n, PIXTYPE *target)
 {
-    int *source = (int *)ptr;
-    int i;
-    for (i = 0; i < n; i++, source++)
-        target[i] = *source;
+    PixelKernels::toFloat(ptr, SEP_TINT, n, target);
 }
 
 void convert_array_byt(void *ptr, int n, PIXTYPE *target)
 {
-    BYTE *source = (BYTE *)ptr;
+    PixelKernels::toFloat(ptr, SEP_TBYTE, n, target);
+}
+
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, the 16 and 32 bit integer types are read directly from the image buffer
+void convert_array_ushort(void *ptr, int n, PIXTYPE *target)
+{
+    PixelKernels::toFloat(ptr, SEP_TUSHORT, n, target);
+}
+
+void convert_array_short(void *ptr, int n, PIXTYPE *target)
+{
+    PixelKernels::toFloat(ptr, SEP_TSHORT, n, target);
+}
+
+void convert_array_ulong(void *ptr, int n, PIXTYPE *target)
+{
+    uint32_t *source = (uint32_t *)ptr;
     int i;
     for (i = 0; i < n; i++, source++)
         target[i] = *source;
 }
 
+void convert_array_long(void *ptr, int n, PIXTYPE *target)
+{
+    PixelKernels::toFloat(ptr, SEP_TLONG, n, target);
+}
+
 int get_array_converter(int dtype, array_converter *f, int *size)
 {
     int status = RETURN_OK;
@@ -143,6 +162,26 @@ int get_array_converter(int dtype, array_converter *f, int *size)
         *f = convert_array_dbl;
         *size = sizeof(double);
     }
+    else if (dtype == SEP_TUSHORT)
+    {
+        *f = convert_array_ushort;
+        *size = sizeof(uint16_t);
+    }
+    else if (dtype == SEP_TSHORT)
+    {
+        *f = convert_array_short;
+        *size = sizeof(int16_t);
+    }
+    else if (dtype == SEP_TULONG)
+    {
+        *f = convert_array_ulong;
+        *size = sizeof(uint32_t);
+    }
+    else if (dtype == SEP_TLONG)
+    {
+        *f = convert_array_long;
+        *size = sizeof(int32_t);
+    }
     else
     {
         *f = NULL;
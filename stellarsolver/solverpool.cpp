@@ -0,0 +1,115 @@
+/*  SolverPool, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solverpool.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace
+{
+
+QMutex affinityMutex;
+QList<int> affinityCores;           // The cores set with setAffinity
+QAtomicInt affinityGeneration {0};  // This changes every time the cores are set
+
+// The affinity each thread of the pool had last, so a thread only changes it when it was set again
+thread_local int appliedGeneration = 0;
+
+#if defined(__linux__)
+// The cores the process could use when the pool was made, for going back to them
+cpu_set_t processCores;
+#endif
+
+}  // namespace
+
+namespace SolverPool
+{
+
+QThreadPool *instance()
+{
+    static QThreadPool *pool = []()
+    {
+#if defined(__linux__)
+        CPU_ZERO(&processCores);
+        if(sched_getaffinity(0, sizeof(processCores), &processCores) != 0)
+        {
+            for(int i = 0; i < CPU_SETSIZE; i++)
+                CPU_SET(i, &processCores);
+        }
+#endif
+        QThreadPool *newPool = new QThreadPool();
+        newPool->setMaxThreadCount(QThread::idealThreadCount());
+        //The threads are kept waiting for the next task instead of ending after 30 seconds
+        newPool->setExpiryTimeout(-1);
+        return newPool;
+    }();
+    return pool;
+}
+
+void setThreads(int threads)
+{
+    instance()->setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+void setAffinity(const QList<int> &cores)
+{
+    instance();
+    QMutexLocker locker(&affinityMutex);
+    affinityCores = cores;
+    affinityGeneration.fetchAndAddOrdered(1);
+}
+
+void applyAffinity()
+{
+    int generation = affinityGeneration.loadAcquire();
+    if(generation == appliedGeneration)
+        return;
+    appliedGeneration = generation;
+
+    QMutexLocker locker(&affinityMutex);
+#if defined(__linux__)
+    cpu_set_t cores;
+    if(affinityCores.isEmpty())
+        cores = processCores;
+    else
+    {
+        CPU_ZERO(&cores);
+        for(int core : affinityCores)
+        {
+            if(core >= 0 && core < CPU_SETSIZE)
+                CPU_SET(core, &cores);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+#elif defined(_WIN32)
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if(!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+        return;
+    DWORD_PTR mask = 0;
+    for(int core : affinityCores)
+    {
+        if(core >= 0 && core < (int)(sizeof(DWORD_PTR) * 8))
+            mask |= (DWORD_PTR)1 << core;
+    }
+    mask &= processMask;
+    SetThreadAffinityMask(GetCurrentThread(), mask ? mask : processMask);
+#endif
+    //Other systems, like macOS, have no way to keep a thread on a core, so the cores are only a request there
+}
+
+}
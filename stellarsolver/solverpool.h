@@ -0,0 +1,45 @@
+/*  SolverPool, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QList>
+#include <QThreadPool>
+
+/**
+ * The SolverPool is the pool of threads the library keeps for the internal solvers.  Instead of starting a thread of their own
+ * for every extraction and solve, and one more for every child solver of a parallel solve, they run as tasks on these threads,
+ * which stay around between operations.  Its threads can be kept on chosen cores on Linux and Windows.
+ */
+namespace SolverPool
+{
+
+/**
+ * @brief instance gets the pool, making it the first time it is used
+ * @return the pool, which is never deleted
+ */
+QThreadPool *instance();
+
+/**
+ * @brief setThreads sets how many tasks the pool runs at once
+ * @param threads is the number of threads, 0 or less means the number of cores
+ */
+void setThreads(int threads);
+
+/**
+ * @brief setAffinity sets the cores the threads of the pool run on, starting with the next task each thread runs
+ * @param cores are the numbers of the cores, an empty list lets them run on any core the process can use
+ */
+void setAffinity(const QList<int> &cores);
+
+/**
+ * @brief applyAffinity keeps the calling thread of the pool on the cores set with setAffinity, if they changed since it last checked.
+ * The tasks call this before they start.
+ */
+void applyAffinity();
+
+}
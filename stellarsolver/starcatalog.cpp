@@ -0,0 +1,45 @@
+/*  StarCatalog, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starcatalog.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/starxy.h"
+}
+
+const QList<FITSImage::Star> StarCatalog::emptyStars;
+
+StarCatalog::StarCatalog(const QList<FITSImage::Star> &stars)
+{
+    if(stars.isEmpty())
+        return;
+
+    QSharedPointer<Data> data(new Data);
+    const int n = stars.size();
+    data->x.resize(n);
+    data->y.resize(n);
+    int i = 0;
+    for(auto &oneStar : stars)
+    {
+        data->x[i] = oneStar.x;
+        data->y[i] = oneStar.y;
+        i++;
+    }
+    data->stars = stars;
+    d = data;
+}
+
+void StarCatalog::fieldView(starxy_t *field) const
+{
+    //starxy_t has no const arrays, but astrometry.net never writes to the field it solves
+    field->x = const_cast<double *>(x());
+    field->y = const_cast<double *>(y());
+    field->flux = nullptr;
+    field->background = nullptr;
+    field->N = count();
+}
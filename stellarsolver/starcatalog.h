@@ -0,0 +1,93 @@
+/*  StarCatalog, StellarSolver Internal Library, by the StellarSolver contributors, 2026
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <QList>
+#include <QSharedPointer>
+#include <QVector>
+#include "structuredefinitions.h"
+
+struct starxy_t;
+
+/**
+ * @brief The StarCatalog class holds the positions of the stars extracted from an image in an x and a y column.
+ * It never changes once it is made, and copies of it share the same columns, so the child solvers of a parallel solve
+ * all use the same one.  The internal solver reads the star positions straight out of the columns.
+ * The other properties of the stars stay in the star list it was made from, which is shared too, so making it does not copy the list.
+ */
+class StarCatalog
+{
+    public:
+        /**
+         * @brief StarCatalog makes an empty catalog
+         */
+        StarCatalog() = default;
+
+        /**
+         * @brief StarCatalog makes a catalog of a star list
+         * @param stars is the star list, which the catalog shares instead of copying
+         */
+        explicit StarCatalog(const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief count gets the number of stars
+         * @return the number of stars in the catalog
+         */
+        int count() const
+        {
+            return d ? d->x.size() : 0;
+        }
+
+        // The columns, each one holds count() values in the order of the star list
+        const double *x() const
+        {
+            return d ? d->x.constData() : nullptr;
+        }
+        const double *y() const
+        {
+            return d ? d->y.constData() : nullptr;
+        }
+
+        /**
+         * @brief stars gets the star list the catalog was made from
+         * @return the star list, shared with the one given to the constructor
+         */
+        const QList<FITSImage::Star> &stars() const
+        {
+            return d ? d->stars : emptyStars;
+        }
+
+        /**
+         * @brief isCatalogOf gets whether the catalog was made from this star list and the list has not been changed since
+         * @param stars is the star list to check
+         * @return true if the catalog is still up to date for the list
+         */
+        bool isCatalogOf(const QList<FITSImage::Star> &stars) const
+        {
+            return stars.isEmpty() ? count() == 0 : this->stars().isSharedWith(stars);
+        }
+
+        /**
+         * @brief fieldView sets up a field for astrometry.net whose x and y arrays point into the columns of the catalog.
+         * The solver only reads them.  The field must not be freed with starxy_free, and the catalog has to outlive it.
+         * @param field is the field to set up
+         */
+        void fieldView(starxy_t *field) const;
+
+    private:
+        // The columns, made once and then only read
+        struct Data
+        {
+            QVector<double> x;
+            QVector<double> y;
+            QList<FITSImage::Star> stars;
+        };
+
+        QSharedPointer<const Data> d;
+        static const QList<FITSImage::Star> emptyStars;
+};
@@ -17,25 +17,161 @@
 #include "extractorsolver.h"
 #include "externalextractorsolver.h"
 #include "onlinesolver.h"
+#include "indexcatalog.h"
+#include "indexworkqueue.h"
+#include "internalextractorsolver.h"
+#include "solverpool.h"
 #include <QApplication>
 #include <QSettings>
+#include <QSet>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QFutureInterface>
+#include <QtConcurrent>
+#include <algorithm>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/healpix.h"
+}
 
 using namespace SSolver;
 
-StellarSolver::StellarSolver(QObject *parent) : QObject(parent)
+// This struct contains the thread pools of solveBatch and solvePipelined and keeps track of their jobs
+struct StellarSolver::BatchState
+{
+    QThreadPool batchPool;                  // The threads solveBatch solves the images in
+    QAtomicInt jobsLeft {0};                // The number of jobs of the batch that are not done yet
+    QMutex mutex;                           // Protects the two below
+    bool aborted {false};                   // Set to abort the batch
+    QSet<ExtractorSolver *> solvers;        // The solvers of the jobs that are solving right now
+
+    QThreadPool extractPool;                // The thread solvePipelined extracts the frames in, one at a time
+    QSemaphore pipelineSlots {2};           // The number of frames solvePipelined can still take before it blocks
+    int pipelineDepth {2};                  // The number of frames solvePipelined holds at once
+    QAtomicInt pipelineFramesLeft {0};      // The number of frames of the pipeline that are not done yet
+
+    // This reports the result of a frame of solvePipelined and makes room in the pipeline for the next one
+    void finishPipelinedFrame(const SolveResult &result, const std::function<void(const SolveResult &)> &callback,
+                              QFutureInterface<SolveResult> &future)
+    {
+        if(callback)
+            callback(result);
+        future.reportResult(result);
+        future.reportFinished();
+        pipelineFramesLeft.fetchAndSubAcquire(1);
+        pipelineSlots.release();
+    }
+};
+
+namespace
+{
+// One piece of the search circle for a MULTI_POSITIONS solve
+struct SearchCell
+{
+    double ra;          // The center of the cell in degrees
+    double dec;
+    double radius;      // The radius the child solver searches in degrees
+    double distance;    // How far the cell is from the center of the search circle in degrees
+};
+
+// This gets the HEALPix cells of one Nside that touch the search circle, walking out from the cell holding the center
+QList<int> cellsInSearchCircle(double ra, double dec, double radius, int nside)
+{
+    QList<int> cells;
+    QSet<int> seen;
+    int first = radecdegtohealpix(ra, dec, nside);
+    cells.append(first);
+    seen.insert(first);
+    for(int i = 0; i < cells.count(); i++)
+    {
+        int neighbours[8];
+        int n = healpix_get_neighbours(cells.at(i), neighbours, nside);
+        for(int j = 0; j < n; j++)
+        {
+            if(seen.contains(neighbours[j]))
+                continue;
+            seen.insert(neighbours[j]);
+            if(healpix_within_range_of_radec(neighbours[j], nside, ra, dec, radius))
+                cells.append(neighbours[j]);
+        }
+    }
+    return cells;
+}
+
+// This gets the search cells for the HEALPix cells of one Nside that touch the search circle.
+// Each cell gets a circle around its center that holds the whole cell plus the padding, so that every quad
+// with a star in the cell fits in some child's circle when the padding is as big as the field.
+QList<SearchCell> searchCellsForNside(double ra, double dec, double radius, double padding, int nside)
+{
+    QList<SearchCell> tiles;
+    for(int hp : cellsInSearchCircle(ra, dec, radius, nside))
+    {
+        SearchCell cell;
+        healpix_to_radecdeg(hp, nside, 0.5, 0.5, &cell.ra, &cell.dec);
+        //The corners and edge midpoints of the cell, the edges bulge a little so there is some margin
+        double cellRadius = 0;
+        for(int i = 0; i < 9; i++)
+        {
+            double cornerRA, cornerDec;
+            healpix_to_radecdeg(hp, nside, (i % 3) * 0.5, (i / 3) * 0.5, &cornerRA, &cornerDec);
+            cellRadius = qMax(cellRadius, deg_between_radecdeg(cell.ra, cell.dec, cornerRA, cornerDec));
+        }
+        cell.radius = cellRadius * 1.05 + padding;
+        cell.distance = deg_between_radecdeg(ra, dec, cell.ra, cell.dec);
+        tiles.append(cell);
+    }
+    return tiles;
+}
+
+// This splits the search circle into between minCells and 2 * minCells cells, nearest to the center first.
+// The cells are made smaller until there are enough of them and every child's circle is smaller than the search circle.
+// It returns no cells if that can't be done, when the padding is too big for the circle.
+QList<SearchCell> tileSearchCircle(double ra, double dec, double radius, double padding, int minCells)
+{
+    if(minCells < 2 || padding >= radius)
+        return QList<SearchCell>();
+
+    //Start with cells about as big as the circle
+    int nside = qMax(1, (int)healpix_nside_for_side_length_arcmin(radius * 2 * 60.0));
+    QList<SearchCell> tiles;
+    while(nside < 8192)
+    {
+        tiles = searchCellsForNside(ra, dec, radius, padding, nside);
+        if(tiles.count() > 2 * minCells)
+            return QList<SearchCell>();
+        bool smallEnough = true;
+        for(const SearchCell &cell : tiles)
+            smallEnough = smallEnough && cell.radius < radius;
+        if(tiles.count() >= minCells && smallEnough)
+            break;
+        nside = qMax(nside + 1, (int)(nside * 1.1));
+    }
+    if(nside >= 8192)
+        return QList<SearchCell>();
+    std::sort(tiles.begin(), tiles.end(), [](const SearchCell & a, const SearchCell & b)
+    {
+        return a.distance < b.distance;
+    });
+    return tiles;
+}
+}
+
+StellarSolver::StellarSolver(QObject *parent) : QObject(parent), m_Batch(new BatchState)
 {
     registerMetaTypes();
 }
 
 StellarSolver::StellarSolver(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer,
-                             QObject *parent) : QObject(parent)
+                             QObject *parent) : QObject(parent), m_Batch(new BatchState)
 {
     registerMetaTypes();
     loadNewImageBuffer(imagestats, imageBuffer);
 }
 
 StellarSolver::StellarSolver(ProcessType type, const FITSImage::Statistic &imagestats, const uint8_t *imageBuffer,
-                             QObject *parent) : QObject(parent)
+                             QObject *parent) : QObject(parent), m_Batch(new BatchState)
 {
     registerMetaTypes();
     m_ProcessType = type;
@@ -44,11 +180,22 @@ StellarSolver::StellarSolver(ProcessType type, const FITSImage::Statistic &image
 
 StellarSolver::~StellarSolver()
 {
+    abortIndexWarmUp();
+    m_IndexWarmUp.waitForFinished();
+    abortBatch();
+    //The frames being extracted still queue their solves, so the extraction has to be done first
+    m_Batch->extractPool.waitForDone();
+    m_Batch->batchPool.waitForDone();
     if(m_ExtractorSolver)
         m_ExtractorSolver->disconnect(this);
     for(auto &solver : parallelSolvers)
         solver->disconnect(this);
     abort();
+    //The tasks on the SolverPool are not threads that Qt waits for, so they have to finish before their solvers are deleted
+    if(m_ExtractorSolver)
+        m_ExtractorSolver->waitUntilDone();
+    for(auto &solver : parallelSolvers)
+        solver->waitUntilDone();
 }
 
 void StellarSolver::registerMetaTypes()
@@ -104,8 +251,7 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
         onlineSolver->externalPaths = m_ExternalPaths;
         solver = onlineSolver;
     }
-    else if((m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
-            && m_ExtractorType != EXTRACTOR_EXTERNAL))
+    else if(usesInternalExtractorSolver())
         solver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics, m_ImageBuffer, this);
     else
     {
@@ -134,12 +280,25 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
         solver->setSearchScale(m_ScaleLow, m_ScaleHigh, m_ScaleUnit);
     if(m_UsePosition)
         solver->setSearchPositionInDegrees(m_SearchRA, m_SearchDE);
+    if(m_UseSearchWCS)
+    {
+        if(m_SearchWCSFromSolution)
+            m_SearchWCS = solutionToWCS(m_SearchSolution);
+        solver->setSearchWCS(m_SearchWCS);
+    }
+    solver->m_TrackSearchWCS = m_TrackingMode;
     if(m_SSLogLevel != LOG_OFF)
         connect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
 
     return solver;
 }
 
+bool StellarSolver::usesInternalExtractorSolver() const
+{
+    return (m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
+            && m_ExtractorType != EXTRACTOR_EXTERNAL);
+}
+
 ExternalProgramPaths StellarSolver::getDefaultExternalPaths(ComputerSystemType system)
 {
     return ExternalExtractorSolver::getDefaultExternalPaths(system);
@@ -189,6 +348,283 @@ QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int i
     return indexFileList;
 }
 
+void StellarSolver::rescanIndexFolders()
+{
+    IndexCatalog::instance().rescan();
+}
+
+void StellarSolver::clearIndexCatalog()
+{
+    IndexCatalog::instance().clear();
+}
+
+IndexResidency StellarSolver::getIndexResidency()
+{
+    return IndexCatalog::instance().residency();
+}
+
+void StellarSolver::warmUpIndexes(bool populate)
+{
+    if(m_IndexWarmUp.isRunning())
+        return;
+    //The warm-up always stops at the memory budget, even when inParallel is on and the solves themselves would not set one
+    updateIndexMemoryBudget();
+
+    const QStringList folders = indexFolderPaths;
+    const QStringList files = m_IndexFilePaths;
+    const bool usePosition = m_UsePosition;
+    const double ra = m_SearchRA;
+    const double dec = m_SearchDE;
+    const double radius = params.search_radius;
+    m_AbortIndexWarmUp.storeRelease(0);
+    m_IndexWarmUp = QtConcurrent::run([this, folders, files, usePosition, ra, dec, radius, populate]()
+    {
+        IndexCatalog &catalog = IndexCatalog::instance();
+        QVector<index_t *> indexes = catalog.acquire(folders, files, false);
+        QVector<index_t *> nearby;
+        for(auto &oneIndex : indexes)
+        {
+            if(!usePosition || index_is_within_range(oneIndex, ra, dec, radius))
+                nearby.append(oneIndex);
+        }
+
+        qint64 bytes = 0;
+        for(int i = 0; i < nearby.count() && !m_AbortIndexWarmUp.loadAcquire(); i++)
+        {
+            //Once the memory budget is full, reading more would only unload the index files that were just read
+            IndexResidency residency = catalog.residency();
+            if(residency.memoryBudget > 0 && residency.residentBytes >= residency.memoryBudget)
+                break;
+            //The kd-trees stay loaded afterwards, just like after a search, so the first solve finds them loaded
+            if(!catalog.loadTrees(nearby[i]))
+                continue;
+            bytes += index_prefetch(nearby[i], populate ? TRUE : FALSE);
+            QString indexFile = QString::fromUtf8(nearby[i]->indexname);
+            catalog.doneWithTrees(nearby[i]);
+            emit indexWarmUpProgress(i + 1, nearby.count(), indexFile);
+        }
+        catalog.release(indexes, false);
+        emit indexWarmUpFinished(bytes);
+    });
+}
+
+void StellarSolver::setSolverThreads(int threads)
+{
+    SolverPool::setThreads(threads);
+}
+
+void StellarSolver::setSolverThreadAffinity(const QList<int> &cores)
+{
+    SolverPool::setAffinity(cores);
+}
+
+void StellarSolver::abortIndexWarmUp()
+{
+    m_AbortIndexWarmUp.storeRelease(1);
+}
+
+QList<QFuture<SolveResult>> StellarSolver::solveBatch(const QList<SolveJob> &jobs, std::function<void(const SolveResult &)> callback)
+{
+    QList<QFuture<SolveResult>> futures;
+    if(isBatchRunning())
+    {
+        emit logOutput("A batch of images is already being solved, please wait for it to finish before solving another one");
+        return futures;
+    }
+    //The batch always uses the internal solver, the solver type set for solve and start stays as it is
+    if(m_SolverType != SOLVER_STELLARSOLVER && m_SSLogLevel != LOG_OFF)
+        emit logOutput("Solving a batch of images only works with the internal solver.  Using the internal solver for the batch.");
+    //All of the jobs take their index files from the IndexCatalog, which keeps them loaded for the next job
+    updateIndexMemoryBudget();
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Solving %1 images in up to %2 threads").arg(jobs.count()).arg(m_Batch->batchPool.maxThreadCount()));
+
+    m_Batch->mutex.lock();
+    if(!isPipelineRunning())
+        m_Batch->aborted = false;
+    m_Batch->mutex.unlock();
+    m_Batch->jobsLeft.storeRelease(jobs.count());
+    for(const SolveJob &job : jobs)
+    {
+        //The solvers are made here, so they belong to this thread like the ones start makes
+        ExtractorSolver *solver = job.imageBuffer ? createBatchSolver(job) : nullptr;
+        const int id = job.id;
+        futures.append(QtConcurrent::run(&m_Batch->batchPool, [this, id, solver, callback]()
+        {
+            SolveResult result = runBatchJob(id, solver);
+            if(callback)
+                callback(result);
+            m_Batch->jobsLeft.fetchAndSubAcquire(1);
+            return result;
+        }));
+    }
+    return futures;
+}
+
+void StellarSolver::setBatchThreads(int threads)
+{
+    m_Batch->batchPool.setMaxThreadCount(threads);
+}
+
+bool StellarSolver::isBatchRunning() const
+{
+    return m_Batch->jobsLeft.loadAcquire() > 0;
+}
+
+void StellarSolver::abortBatch()
+{
+    QMutexLocker locker(&m_Batch->mutex);
+    m_Batch->aborted = true;
+    for(auto &solver : m_Batch->solvers)
+        solver->abort();
+}
+
+QFuture<SolveResult> StellarSolver::solvePipelined(const SolveJob &job, std::function<void(const SolveResult &)> callback)
+{
+    //This is the bounded queue between the caller and the pipeline
+    m_Batch->pipelineSlots.acquire();
+
+    m_Batch->mutex.lock();
+    if(!isPipelineRunning() && !isBatchRunning())
+        m_Batch->aborted = false;
+    m_Batch->mutex.unlock();
+    if(!isPipelineRunning())
+        updateIndexMemoryBudget();
+    m_Batch->pipelineFramesLeft.fetchAndAddRelease(1);
+
+    //The frames are extracted in the order they come in, each one with all the partition threads
+    m_Batch->extractPool.setMaxThreadCount(1);
+    ExtractorSolver *solver = job.imageBuffer ? createBatchSolver(job) : nullptr;
+    const int id = job.id;
+    QFutureInterface<SolveResult> future;
+    future.reportStarted();
+    QtConcurrent::run(&m_Batch->extractPool, [this, id, solver, callback, future]() mutable
+    {
+        if(solver)
+            solver->moveToThread(QThread::currentThread());
+        m_Batch->mutex.lock();
+        bool aborted = m_Batch->aborted;
+        m_Batch->mutex.unlock();
+        if(solver && !aborted)
+            solver->extract();
+        emit frameExtracted(id);
+
+        if(!solver || aborted || solver->getNumStarsFound() == 0)
+        {
+            if(solver && !aborted && m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("No stars were found in frame %1, so it cannot be solved").arg(id));
+            SolveResult result;
+            result.id = id;
+            delete solver;
+            m_Batch->finishPipelinedFrame(result, callback, future);
+            return;
+        }
+
+        //The solve finds the stars already extracted, so it goes right to the index files.
+        //The solver is let go of here, so the thread that solves it can take it over.
+        solver->moveToThread(nullptr);
+        QtConcurrent::run(&m_Batch->batchPool, [this, id, solver, callback, future]() mutable
+        {
+            m_Batch->finishPipelinedFrame(runBatchJob(id, solver), callback, future);
+        });
+    });
+    return future.future();
+}
+
+void StellarSolver::setPipelineDepth(int frames)
+{
+    frames = qMax(1, frames);
+    if(frames > m_Batch->pipelineDepth)
+        m_Batch->pipelineSlots.release(frames - m_Batch->pipelineDepth);
+    else if(frames < m_Batch->pipelineDepth)
+        m_Batch->pipelineSlots.acquire(m_Batch->pipelineDepth - frames);
+    m_Batch->pipelineDepth = frames;
+}
+
+bool StellarSolver::isPipelineRunning() const
+{
+    return m_Batch->pipelineFramesLeft.loadAcquire() > 0;
+}
+
+ExtractorSolver* StellarSolver::createBatchSolver(const SolveJob &job)
+{
+    InternalExtractorSolver *solver = new InternalExtractorSolver(SOLVE, EXTRACTOR_INTERNAL, SOLVER_STELLARSOLVER,
+            job.statistics, job.imageBuffer, nullptr);
+
+    //The jobs are already spread over the threads, so each one searches in one thread with the shared index files
+    Parameters jobParams = params;
+    jobParams.multiAlgorithm = NOT_MULTI;
+    jobParams.inParallel = false;
+    if(jobParams.autoDownsample)
+    {
+        int imageSize = job.statistics.width > job.statistics.height ? job.statistics.width : job.statistics.height;
+        jobParams.downsample = imageSize / 2048 + 1;
+    }
+
+    //Each solver logs to its own file, since they write at the same time
+    solver->m_LogToFile = m_LogToFile;
+    solver->m_AstrometryLogLevel = m_AstrometryLogLevel;
+    solver->m_SSLogLevel = m_SSLogLevel;
+    solver->m_BasePath = m_BasePath;
+    solver->m_ActiveParameters = jobParams;
+    solver->convFilter = convFilter;
+    solver->indexFolderPaths = indexFolderPaths;
+    solver->indexFiles = m_IndexFilePaths;
+    if(job.useScale)
+        solver->setSearchScale(job.scaleLow, job.scaleHigh, job.scaleUnit);
+    if(job.usePosition)
+        solver->setSearchPositionInDegrees(job.searchRA, job.searchDE);
+    if(m_SSLogLevel != LOG_OFF)
+        connect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
+
+    //The solver is run and deleted by a thread of the pool, which takes it over from here
+    solver->moveToThread(nullptr);
+    return solver;
+}
+
+SolveResult StellarSolver::runBatchJob(int id, ExtractorSolver *solver)
+{
+    SolveResult result;
+    result.id = id;
+    if(!solver)
+    {
+        emit logOutput(QString("The image buffer of job %1 is not loaded, so it cannot be solved").arg(id));
+        return result;
+    }
+    //A solver with no thread can be taken over by this one, so it is deleted in the thread it belongs to
+    solver->moveToThread(QThread::currentThread());
+
+    m_Batch->mutex.lock();
+    bool aborted = m_Batch->aborted;
+    if(!aborted)
+        m_Batch->solvers.insert(solver);
+    m_Batch->mutex.unlock();
+
+    if(!aborted)
+    {
+        //This runs the extraction and the solve right here, without a thread or an event loop of its own
+        solver->execute();
+
+        m_Batch->mutex.lock();
+        m_Batch->solvers.remove(solver);
+        m_Batch->mutex.unlock();
+
+        result.numStars = solver->getNumStarsFound();
+        if(solver->solvingDone())
+        {
+            result.solved = true;
+            result.solution = solver->getSolution();
+            result.indexNumber = solver->getSolutionIndexNumber();
+            result.healpix = solver->getSolutionHealpix();
+            result.stars = solver->getStarList();
+            if(solver->hasWCSData())
+                solver->appendStarsRAandDEC(result.stars);
+        }
+    }
+    delete solver;
+    return result;
+}
+
 bool StellarSolver::extract(bool calculateHFR, QRect frame)
 {
     m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
@@ -196,11 +632,7 @@ bool StellarSolver::extract(bool calculateHFR, QRect frame)
     if (useSubframe)
         m_Subframe = frame;
 
-    // This loop will wait syncrounously for the finished signal that the star extraction is done
-    QEventLoop loop;
-    connect(this, &StellarSolver::finished, &loop, &QEventLoop::quit);
-    start();
-    loop.exec(QEventLoop::ExcludeUserInputEvents);
+    runSynchronously();
 
     return m_HasExtracted;
 }
@@ -209,13 +641,23 @@ bool StellarSolver::solve()
 {
     m_ProcessType = SOLVE;
 
-    // This loop will wait syncrounously for the finished signal that the solving is done
+    runSynchronously();
+
+    return m_HasSolved;
+}
+
+void StellarSolver::runSynchronously()
+{
+    // The internal solver runs right in this thread when it does not solve in parallel, so it is usually done when start returns
     QEventLoop loop;
     connect(this, &StellarSolver::finished, &loop, &QEventLoop::quit);
+    m_RunDirectly = true;
     start();
-    loop.exec(QEventLoop::ExcludeUserInputEvents);
+    m_RunDirectly = false;
 
-    return m_HasSolved;
+    // Otherwise this loop will wait syncrounously for the finished signal that the process is done
+    if(m_isRunning)
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
 }
 
 void StellarSolver::start()
@@ -289,10 +731,16 @@ void StellarSolver::start()
         connect(m_ExtractorSolver, &ExtractorSolver::finished, this, &StellarSolver::processFinished);
         m_ExtractorSolver->execute();
     }
+    else if(m_RunDirectly && usesInternalExtractorSolver())
+    {
+        //The results are collected as soon as it finishes, even if this thread has no event loop or this StellarSolver lives in another thread
+        connect(m_ExtractorSolver, &ExtractorSolver::finished, this, &StellarSolver::processFinished, Qt::DirectConnection);
+        m_ExtractorSolver->execute();
+    }
     else
     {
         connect(m_ExtractorSolver, &ExtractorSolver::finished, this, &StellarSolver::processFinished);
-        m_ExtractorSolver->start();
+        m_ExtractorSolver->startTask();
     }
 
 }
@@ -348,6 +796,20 @@ bool StellarSolver::checkParameters()
                 params.multiAlgorithm = MULTI_SCALES;
         }
 
+        if(params.multiAlgorithm == MULTI_INDEXES && m_SolverType != SOLVER_STELLARSOLVER)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Only the internal solver can share index files between threads.  Solving on multiple scales instead.");
+            params.multiAlgorithm = MULTI_SCALES;
+        }
+
+        if(params.multiAlgorithm == MULTI_POSITIONS && !m_UsePosition)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Solving on multiple positions needs a search position.  Solving on multiple scales instead.");
+            params.multiAlgorithm = MULTI_SCALES;
+        }
+
         if(m_ProcessType == SOLVE && m_SolverType == SOLVER_WATNEYASTROMETRY && params.keepNum < 300)
         {
             emit logOutput("The Watney Solver needs at least 300 stars. Adjusting keepNum to 300");
@@ -371,6 +833,9 @@ bool StellarSolver::checkParameters()
                 params.inParallel = false;
             }
         }
+
+        if(!params.inParallel && m_SolverType == SOLVER_STELLARSOLVER)
+            updateIndexMemoryBudget();
     }
 
     return true;
@@ -384,7 +849,20 @@ void StellarSolver::parallelSolve()
         return;
     parallelSolvers.clear();
     m_ParallelSolversFinishedCount = 0;
-    int threads = QThread::idealThreadCount();
+    //The child solvers of the internal solver are tasks on the SolverPool, so there is one for each of its threads
+    int threads = m_SolverType == SOLVER_STELLARSOLVER ? SolverPool::instance()->maxThreadCount() : QThread::idealThreadCount();
+
+    QList<SearchCell> cells;
+    if(params.multiAlgorithm == MULTI_POSITIONS)
+    {
+        cells = tileSearchCircle(m_SearchRA, m_SearchDE, params.search_radius, maxFieldDiagonal(), threads);
+        if(cells.isEmpty())
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("The search radius is too small to split up for this field size.  Solving on multiple scales instead.");
+            params.multiAlgorithm = MULTI_SCALES;
+        }
+    }
 
     if(params.multiAlgorithm == MULTI_SCALES)
     {
@@ -422,9 +900,26 @@ void StellarSolver::parallelSolve()
                                    getScaleUnitString()));
         }
     }
-    //Note: it might be useful to do a parallel solve on multiple positions, but I am afraid
-    //that since it searches in a circle around the search position, it might be difficult to make it
-    //search a square grid without either missing sections of sky or overlapping search regions.
+    else if(params.multiAlgorithm == MULTI_POSITIONS)
+    {
+        //Attempt to search on multiple positions
+        //The search circle is split into HEALPix cells and each child searches a circle around one cell, nearest to the
+        //search position first.  The circles overlap by the size of the field so no quad falls between two of them.
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Starting %1 threads to solve on multiple positions").arg(cells.count()));
+        for(int i = 0; i < cells.count(); i++)
+        {
+            const SearchCell &cell = cells.at(i);
+            ExtractorSolver *solver = m_ExtractorSolver->spawnChildSolver(i);
+            connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+            solver->setSearchPositionInDegrees(cell.ra, cell.dec);
+            solver->setSearchRadius(cell.radius);
+            parallelSolvers.append(solver);
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Solver # %1, RA %2, DEC %3, Radius %4").arg(parallelSolvers.count()).arg(cell.ra).arg(
+                                   cell.dec).arg(cell.radius));
+        }
+    }
     else if(params.multiAlgorithm == MULTI_DEPTHS)
     {
         //Attempt to search on multiple depths
@@ -448,14 +943,91 @@ void StellarSolver::parallelSolve()
                 emit logOutput(QString("Child Solver # %1, Depth Low %2, Depth High %3").arg(parallelSolvers.count()).arg(i).arg(i + inc));
         }
     }
+    else if(params.multiAlgorithm == MULTI_INDEXES)
+    {
+        //Attempt to search with a queue of work shared by all the threads.  Each unit of work is one index file and one range of depths.
+        //The threads keep taking units until the queue is empty or one of them solves, so no thread sits idle while another one
+        //is stuck with a slow scale band, and the index files are only borrowed once for all of them.
+        int sourceNum = 200;
+        if(params.keepNum != 0)
+            sourceNum = params.keepNum;
+        int inc = sourceNum / threads;
+        if(inc < 10)
+            inc = 10;
+        QSharedPointer<IndexWorkQueue> workQueue(new IndexWorkQueue(indexFolderPaths, m_IndexFilePaths, params.inParallel));
+        int depthRanges = 0;
+        for(int i = 1; i < sourceNum; i += inc, depthRanges++)
+            workQueue->addDepthRange(i, i + inc);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Starting %1 threads to solve with %2 index files and %3 depth ranges").arg(threads)
+                           .arg(workQueue->indexes().count()).arg(depthRanges));
+        for(int thread = 0; thread < threads; thread++)
+        {
+            InternalExtractorSolver *solver = static_cast<InternalExtractorSolver*>(m_ExtractorSolver->spawnChildSolver(thread));
+            connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+            solver->setWorkQueue(workQueue);
+            parallelSolvers.append(solver);
+        }
+    }
     for(auto &solver : parallelSolvers)
-        solver->start();
+        solver->startTask();
+}
+
+void StellarSolver::updateIndexMemoryBudget()
+{
+    //Instead of loading every index file again for every solve, the internal solver keeps the most recently used ones loaded
+    qint64 budget = (qint64)params.indexMemoryBudget * 1024 * 1024;
+    if(budget <= 0)
+    {
+        double availableRAM = 0;
+        double totalRAM = 0;
+        getAvailableRAM(availableRAM, totalRAM);
+        //The index files that are already loaded are not counted as free RAM, so they are added back in
+        budget = IndexCatalog::instance().residency().residentBytes + (qint64)(availableRAM * 0.75);
+    }
+    IndexCatalog::instance().setMemoryBudget(budget);
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Keeping up to %1 MB of the most recently used index files loaded between solves").arg(
+                           budget / (1024 * 1024)));
+}
+
+double StellarSolver::maxFieldDiagonal() const
+{
+    double width;
+    if(m_UseScale)
+    {
+        switch(m_ScaleUnit)
+        {
+            case DEG_WIDTH:
+                width = m_ScaleHigh;
+                break;
+            case ARCMIN_WIDTH:
+                width = m_ScaleHigh / 60.0;
+                break;
+            case ARCSEC_PER_PIX:
+                width = m_ScaleHigh * m_Statistics.width / 3600.0;
+                break;
+            case FOCAL_MM:
+                // "35 mm" film is 36 mm wide.
+                // The field angle is twice the angle from the optical axis to the edge of the frame
+                width = rad2deg(2. * atan(36. / (2. * m_ScaleLow)));
+                break;
+            default:
+                width = params.maxwidth;
+                break;
+        }
+    }
+    else
+        width = params.maxwidth;
+    if(m_Statistics.width <= 0)
+        return width;
+    return width * hypot(m_Statistics.width, m_Statistics.height) / m_Statistics.width;
 }
 
 bool StellarSolver::parallelSolversAreRunning() const
 {
     for(auto solver : parallelSolvers)
-        if(solver->isRunning())
+        if(solver->isWorking())
             return true;
     return false;
 }
@@ -476,6 +1048,7 @@ void StellarSolver::processFinished(int code)
                 solverWithWCS = m_ExtractorSolver;
                 if(m_ExtractorStars.count() > 0)
                     solverWithWCS->appendStarsRAandDEC(m_ExtractorStars);
+                trackSolution();
             }
             m_HasSolved = true;
         }
@@ -521,7 +1094,7 @@ void StellarSolver::finishParallelSolve(int success)
         for(auto &solver : parallelSolvers)
         {
             disconnect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
-            if(solver != reportingSolver && solver->isRunning())
+            if(solver != reportingSolver && solver->isWorking())
                 solver->abort();
         }
         if(m_SSLogLevel != LOG_OFF)
@@ -543,6 +1116,7 @@ void StellarSolver::finishParallelSolve(int success)
             disconnect(solverWithWCS, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
             if(m_ExtractorStars.count() > 0)
                 solverWithWCS->appendStarsRAandDEC(m_ExtractorStars);
+            trackSolution();
             m_isRunning = false;
         }
         if(m_ExtractorType !=
@@ -602,7 +1176,7 @@ bool StellarSolver::isRunning() const
 {
     if(parallelSolversAreRunning())
         return true;
-    if(m_ExtractorSolver && m_ExtractorSolver->isRunning())
+    if(m_ExtractorSolver && m_ExtractorSolver->isWorking())
         return true;
     return m_isRunning;
 }
@@ -892,6 +1466,70 @@ void StellarSolver::setSearchPositionInDegrees(double ra, double dec)
     m_SearchDE = dec;
 }
 
+//This sets the WCS of an earlier solve that the internal solver verifies before searching for quads
+void StellarSolver::setSearchWCS(const sip_t &wcs)
+{
+    m_UseSearchWCS = true;
+    m_SearchWCSFromSolution = false;
+    m_SearchWCS = wcs;
+}
+
+//The WCS for a solution is made when the solver starts, since it depends on the size of the image
+void StellarSolver::setSearchWCS(const FITSImage::Solution &priorSolution)
+{
+    m_UseSearchWCS = true;
+    m_SearchWCSFromSolution = true;
+    m_SearchSolution = priorSolution;
+}
+
+bool StellarSolver::getSolutionWCS(sip_t &wcs) const
+{
+    if(hasWCS && solverWithWCS)
+        return solverWithWCS->getSolutionWCS(wcs);
+    return false;
+}
+
+void StellarSolver::trackSolution()
+{
+    sip_t solutionWCS;
+    if(m_TrackingMode && getSolutionWCS(solutionWCS))
+        setSearchWCS(solutionWCS);
+}
+
+//This makes a TAN WCS centered on the image that gives back the orientation and parity of the solution
+sip_t StellarSolver::solutionToWCS(const FITSImage::Solution &priorSolution) const
+{
+    tan_t tan;
+    memset(&tan, 0, sizeof(tan_t));
+    tan.crval[0] = priorSolution.ra;
+    tan.crval[1] = priorSolution.dec;
+    //FITS pixel coordinates start from 1, so this is the center of the image
+    tan.crpix[0] = m_Statistics.width / 2.0 + 0.5;
+    tan.crpix[1] = m_Statistics.height / 2.0 + 0.5;
+    tan.imagew = m_Statistics.width;
+    tan.imageh = m_Statistics.height;
+
+    double scale = arcsec2deg(priorSolution.pixscale);
+    double angle = deg2rad(priorSolution.orientation);
+    if(priorSolution.parity == FITSImage::POSITIVE)
+    {
+        tan.cd[0][0] = -scale * cos(angle);
+        tan.cd[0][1] = scale * sin(angle);
+        tan.cd[1][0] = scale * sin(angle);
+        tan.cd[1][1] = scale * cos(angle);
+    }
+    else
+    {
+        tan.cd[0][0] = scale * cos(angle);
+        tan.cd[0][1] = scale * sin(angle);
+        tan.cd[1][0] = -scale * sin(angle);
+        tan.cd[1][1] = scale * cos(angle);
+    }
+    sip_t wcs;
+    sip_wrap_tan(&tan, &wcs);
+    return wcs;
+}
+
 void addPathToListIfExists(QStringList *list, QString path)
 {
     if(list)
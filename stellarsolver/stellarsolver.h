@@ -21,6 +21,11 @@
 #include <QVector>
 #include <QRect>
 #include <QPointer>
+#include <QFuture>
+#include <QAtomicInt>
+#include <QScopedPointer>
+
+#include <functional>
 
 using namespace SSolver;
 
@@ -103,6 +108,116 @@ class StellarSolver : public QObject
          * @return The list of index files to use
          */
         static QStringList getIndexFiles(const QStringList &directoryList, int indexToUse = -1, int healpixToUse = -1);
+
+        /**
+         * @brief rescanIndexFolders makes the internal solver search the index folders again the next time it solves.
+         * The index folders are only searched the first time they are used, so call this after adding or removing index files.
+         * Index files that change on disk are reloaded automatically.
+         */
+        static void rescanIndexFolders();
+
+        /**
+         * @brief clearIndexCatalog unloads all of the index files that the internal solver keeps loaded between solves
+         */
+        static void clearIndexCatalog();
+
+        /**
+         * @brief getIndexResidency gets how many of the index files the internal solver keeps loaded between solves
+         * and how often they were already loaded when they were needed
+         * @return The residency statistics
+         */
+        static IndexResidency getIndexResidency();
+
+        /**
+         * @brief setSolverThreads sets the number of threads the library keeps for the internal solver.  Its extractions and solves,
+         * and the child solvers of a parallel solve, run as tasks on these threads instead of starting threads of their own.
+         * @param threads is the number of threads, 0 or less means the number of cores, which is the default
+         */
+        static void setSolverThreads(int threads);
+
+        /**
+         * @brief setSolverThreadAffinity keeps the threads of the internal solver on some of the cores, on Linux and Windows
+         * @param cores are the numbers of the cores to use, an empty list lets them use any core again
+         */
+        static void setSolverThreadAffinity(const QList<int> &cores);
+
+        /**
+         * @brief warmUpIndexes loads the index files for the internal solver and reads them into memory in a background thread,
+         * so the first solve does not have to wait for the disk.  It uses the index folders and files that are set,
+         * and if a search position is set, only the index files within the search radius of it.
+         * It stops once the index files it loaded fill the indexMemoryBudget parameter, or most of the free RAM if that is 0.
+         * indexWarmUpProgress is emitted after each index file and indexWarmUpFinished once it is done.
+         * @param populate makes it wait until every page is read, instead of just asking the system to read them ahead
+         */
+        void warmUpIndexes(bool populate = true);
+
+        /**
+         * @brief isWarmingUpIndexes returns whether the index files are being warmed up
+         * @return true if warmUpIndexes is still running
+         */
+        bool isWarmingUpIndexes() const
+        {
+            return m_IndexWarmUp.isRunning();
+        }
+
+        /**
+         * @brief abortIndexWarmUp stops warming up the index files after the one it is reading
+         */
+        void abortIndexWarmUp();
+
+        /**
+         * @brief solveBatch plate solves many images with the internal solver, each one in its own thread of a pool that stays
+         * around between batches.  The images all use the parameters, index folders and index files that are set, and they share
+         * the index files the internal solver keeps loaded, so each index is only read once for the whole batch.
+         * Each image is solved in a single thread, so the multiAlgorithm and inParallel parameters are not used.
+         * This does not block, and the image buffers of the jobs must stay valid until their results are ready.
+         * @param jobs are the images to solve, with the scale and position hints for each one
+         * @param callback if set, is called with the result of each job as soon as it is done.  It is called in the thread that solved it.
+         * @return a future for the result of each job, in the same order as the jobs, or nothing if a batch is already running
+         */
+        QList<QFuture<SolveResult>> solveBatch(const QList<SolveJob> &jobs, std::function<void(const SolveResult &)> callback = nullptr);
+
+        /**
+         * @brief setBatchThreads sets how many images solveBatch solves at the same time
+         * @param threads is the number of threads, the default is the number of cores
+         */
+        void setBatchThreads(int threads);
+
+        /**
+         * @brief isBatchRunning returns whether solveBatch still has images to solve
+         * @return true if some of the jobs are not done yet
+         */
+        bool isBatchRunning() const;
+
+        /**
+         * @brief abortBatch aborts the images solveBatch and solvePipelined are solving and skips the ones that have not started, they finish as not solved
+         */
+        void abortBatch();
+
+        /**
+         * @brief solvePipelined plate solves one frame of a sequence, like a continuous capture, in a two stage pipeline.
+         * The frames are extracted one after another in their own thread while the frames before them are solved in the threads of solveBatch,
+         * so extracting the next frame does not have to wait for the solve of the last one.  It uses the same settings as solveBatch.
+         * Once frameExtracted is emitted for the frame, its image buffer is not needed anymore, so two image buffers are enough to capture into.
+         * If the pipeline already holds as many frames as its depth, this blocks until the oldest one is solved.
+         * @param job is the frame to solve, with the scale and position hints for it
+         * @param callback if set, is called with the result as soon as it is done.  It is called in the thread that solved it.
+         * @return a future for the result of the frame
+         */
+        QFuture<SolveResult> solvePipelined(const SolveJob &job, std::function<void(const SolveResult &)> callback = nullptr);
+
+        /**
+         * @brief setPipelineDepth sets how many frames solvePipelined holds at once, including the one being extracted.
+         * Lowering it waits until enough frames are done.
+         * @param frames is the number of frames, the default is 2
+         */
+        void setPipelineDepth(int frames);
+
+        /**
+         * @brief isPipelineRunning returns whether solvePipelined still has frames to extract or solve
+         * @return true if some of the frames are not done yet
+         */
+        bool isPipelineRunning() const;
   
         /**
          * @brief getCommandString gets the processType as a string explaining the command StellarSolver is Running
@@ -183,6 +298,7 @@ class StellarSolver : public QObject
 
         /**
          * @brief extract Performs Star Extraction on the image.  This is performed synchronously and blocks the calling thread until the finished signal is emitted.
+         * The internal star extractor runs right in the calling thread, so it needs no event loop there and the results are ready without waiting for any signals.
          * @param calculateHFR If true, it will also calculated Half-Flux Radius for each detected star. HFR calculations can be very CPU-intensive.
          * @param frame If set, it will only extract stars within this rectangular region of the image.
          * @return A boolean that reports whether it was successful, true means success.
@@ -191,6 +307,7 @@ class StellarSolver : public QObject
 
         /**
          * @brief solve Plate Solves the image.  This is performed synchronously and blocks the calling thread until the finished signal is emitted.
+         * The internal solver runs right in the calling thread unless it solves in parallel (multiAlgorithm is not NOT_MULTI), so then it needs no event loop there.
          * @return A boolean that reports whether it was successful, true means success.
          */
         bool solve();
@@ -286,6 +403,48 @@ class StellarSolver : public QObject
          */
         void setSearchPositionInDegrees(double ra, double dec);
 
+        /**
+         * @brief setSearchWCS sets the WCS of an earlier solve of the same field, like the previous frame while guiding.
+         * The internal solver checks whether it still fits the stars before it searches for quads, which is much faster when the field has barely moved.
+         * @param wcs The WCS in the pixel coordinates of the image, such as the one from getSolutionWCS
+         */
+        void setSearchWCS(const sip_t &wcs);
+
+        /**
+         * @brief setSearchWCS sets the solution of an earlier solve of the same field, which the internal solver checks before it searches for quads
+         * @param priorSolution The solution, its center, pixel scale, orientation and parity are used for the WCS
+         */
+        void setSearchWCS(const FITSImage::Solution &priorSolution);
+
+        /**
+         * @brief setTrackingMode is for image sequences, like video or time lapses.  When tracking, each solve follows the field from the previous one
+         * by matching the index stars with the extracted stars, and only searches for quads when that does not verify.  The WCS of every
+         * successful solve becomes the search WCS of the next one, so just load each new image and solve it.
+         * @param enabled Whether or not to track
+         */
+        void setTrackingMode(bool enabled)
+        {
+            m_TrackingMode = enabled;
+        }
+
+        /**
+         * @brief isTracking gets whether or not the solver is in tracking mode
+         * @return true means it is tracking
+         */
+        bool isTracking() const
+        {
+            return m_TrackingMode;
+        }
+
+        /**
+         * @brief clearSearchWCS stops verifying the WCS or solution set with setSearchWCS
+         */
+        void clearSearchWCS()
+        {
+            m_UseSearchWCS = false;
+            m_SearchWCSFromSolution = false;
+        }
+
         /**
          * @brief setLogLevel sets the astrometry logging level
          * @param level The level of logging
@@ -440,6 +599,13 @@ class StellarSolver : public QObject
             return hasWCS;
         };
 
+        /**
+         * @brief getSolutionWCS gets the WCS of the latest internal plate solve, so that it can be given to setSearchWCS for the next image
+         * @param wcs gets the WCS in the pixel coordinates of the image
+         * @return false if there is no WCS from the internal solver
+         */
+        bool getSolutionWCS(sip_t &wcs) const;
+
         /**
          * @brief getNumThreads gets the number of ExtractorSolvers used to plate solve the image
          * @return the number of solvers
@@ -551,6 +717,7 @@ class StellarSolver : public QObject
         bool m_HasFailed {false};           // This boolean is set when a process has failed
         bool hasWCS {false};                // This boolean gets set if the StellarSolver has WCS data to retrieve
         bool m_isRunning {false};           // Whether or not the StellarSolver is currently running
+        bool m_RunDirectly {false};         // Whether start may run the internal solver in the calling thread, for extract and solve
 
    //StellarSolver Options
 
@@ -569,6 +736,12 @@ class StellarSolver : public QObject
         // Index File Options
         QStringList indexFolderPaths;           // This is the list of folder paths that the solver will use to search for index files
         QStringList m_IndexFilePaths;           // This is an alternative to the indexFolderPaths variable.  We can just load individual index files instead of searching for them
+        QFuture<void> m_IndexWarmUp;            // The background thread started by warmUpIndexes
+        QAtomicInt m_AbortIndexWarmUp {0};      // Set to stop warming up the index files
+
+        // Batch and Pipeline Options
+        struct BatchState;                      // The thread pools and the bookkeeping of solveBatch and solvePipelined, in stellarsolver.cpp
+        QScopedPointer<BatchState> m_Batch;
 
         // Online Options
         QString m_AstrometryAPIKey;
@@ -601,6 +774,13 @@ class StellarSolver : public QObject
         double m_SearchRA = HUGE_VAL;           // RA of field center for search, format: decimal degrees
         double m_SearchDE = HUGE_VAL;           // DEC of field center for search, format: decimal degrees
 
+        // Astrometry Search WCS Parameters, These are not saved parameters and change for each image, use the methods to set them
+        bool m_UseSearchWCS {false};            // Whether or not to verify the WCS of an earlier solve before searching
+        bool m_SearchWCSFromSolution {false};   // Whether the WCS still has to be made from m_SearchSolution for the size of the image
+        sip_t m_SearchWCS {};                   // The WCS of an earlier solve
+        FITSImage::Solution m_SearchSolution {};    // The solution of an earlier solve
+        bool m_TrackingMode {false};            // Whether or not each solve follows the field from the previous one
+
     // StellarSolver Variables
 
         FITSImage::Statistic m_Statistics;              // This is information about the image
@@ -666,6 +846,18 @@ class StellarSolver : public QObject
          */
         void parallelSolve();
 
+        /**
+         * @brief updateIndexMemoryBudget sets how much of the index files the internal solver keeps loaded when they are not
+         * searched in parallel, from the indexMemoryBudget parameter or the free RAM
+         */
+        void updateIndexMemoryBudget();
+
+        /**
+         * @brief maxFieldDiagonal gets the diagonal of the widest field the solve could find, from the scale and the image size
+         * @return The diagonal in degrees
+         */
+        double maxFieldDiagonal() const;
+
         /**
          * @brief updateConvolutionFilter This will update the convolution filter when the StellarSolver gets set up
          */
@@ -690,6 +882,44 @@ class StellarSolver : public QObject
          */
         ExtractorSolver* createExtractorSolver();
 
+        /**
+         * @brief usesInternalExtractorSolver gets whether createExtractorSolver makes an InternalExtractorSolver for the process, when it is not online
+         * @return true if the process is done by the internal star extractor and solver
+         */
+        bool usesInternalExtractorSolver() const;
+
+        /**
+         * @brief runSynchronously starts the process and returns once it is done, for extract and solve
+         */
+        void runSynchronously();
+
+        /**
+         * @brief createBatchSolver creates the internal solver for one job of solveBatch, with the options of this StellarSolver
+         * @param job is the image to solve and its hints
+         * @return The newly created ExtractorSolver, which has no parent and no thread, so that the pool thread that runs it can take it over.
+         */
+        ExtractorSolver* createBatchSolver(const SolveJob &job);
+
+        /**
+         * @brief runBatchJob solves one job of solveBatch in the calling thread and deletes its solver, after moving it to this thread
+         * @param id is the id of the job
+         * @param solver is the solver made for the job by createBatchSolver
+         * @return The result of the job
+         */
+        SolveResult runBatchJob(int id, ExtractorSolver *solver);
+
+        /**
+         * @brief solutionToWCS makes the search WCS for the loaded image from the solution set with setSearchWCS
+         * @param priorSolution The solution of an earlier solve
+         * @return The TAN WCS, centered on the image
+         */
+        sip_t solutionToWCS(const FITSImage::Solution &priorSolution) const;
+
+        /**
+         * @brief trackSolution makes the WCS of the solve that just finished the search WCS of the next one when in tracking mode
+         */
+        void trackSolution();
+
         /**
          * @brief getAvailableRAM finds out the amount of available RAM on the system
          * @param availableRAM is the variable that will be set to the available RAM found
@@ -719,6 +949,27 @@ class StellarSolver : public QObject
          */
         void ready();
 
+        /**
+         * @brief indexWarmUpProgress signals that warmUpIndexes has read another index file
+         * @param done is the number of index files read so far
+         * @param total is the number of index files to read
+         * @param indexFile is the index file that was just read
+         */
+        void indexWarmUpProgress(int done, int total, QString indexFile);
+
+        /**
+         * @brief indexWarmUpFinished signals that warmUpIndexes is done, whether it finished or was aborted
+         * @param bytes is how much of the index files was read
+         */
+        void indexWarmUpFinished(qint64 bytes);
+
+        /**
+         * @brief frameExtracted signals that solvePipelined is done with the image buffer of a frame, so it can be used for another one.
+         * It is emitted in the thread that extracts the frames.
+         * @param id is the id of the frame
+         */
+        void frameExtracted(int id);
+
         // Finished Signal note: It should be safe to delete StellarSolver at this time since no parallel threads are running.
         /**
          * @brief finished Extraction and/or solving complete, whether successful or not, and StellarSolver has shut down.
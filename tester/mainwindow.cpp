@@ -257,6 +257,7 @@ MainWindow::MainWindow() :
     ui->showConv->setToolTip("Loads the convolution filter into a window for viewing");
 
     ui->partition->setToolTip("Whether or not to partition the image during SEP operations for Internal SEP.  This can greatly speed up star extraction, but at the cost of possibly missing some objects.  For solving, Focusing, and guiding operations, this doesn't matter, but for doing science, you might want to turn it off.");
+    ui->partitionAlgo->setToolTip("How the partitions are planned.  Grid uses 200 pixel partitions in 2 rows.  Adaptive makes several partitions per thread shaped to the image, which keeps all the threads busy.");
 
     connect(ui->showConv,&QPushButton::clicked,this,[this](){
         if(!convInspector)
@@ -1032,6 +1033,7 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.convFilterType = (SSolver::ConvFilterType)ui->convFilterType->currentIndex();
     params.fwhm = ui->fwhm->text().toInt();
     params.partition = ui->partition->isChecked();
+    params.partitionAlgorithm = (SSolver::PartitionAlgo)ui->partitionAlgo->currentIndex();
 
     //Star Filter Settings
     params.resort = ui->resort->isChecked();
@@ -1089,6 +1091,7 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     connect(ui->convFilterType, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::settingJustChanged);
     ui->fwhm->setValue(a.fwhm);
     ui->partition->setChecked(a.partition);
+    ui->partitionAlgo->setCurrentIndex(a.partitionAlgorithm);
 
     //Star Filter Settings
 
@@ -2059,7 +2062,7 @@ void MainWindow::addExtractionToTable()
     setItemInColumn(table, "clean param", QString::number(params.clean_param));
     setItemInColumn(table, "conv", stellarSolver.getConvFilterString());
     setItemInColumn(table, "fwhm", QString::number(params.fwhm));
-    setItemInColumn(table, "part", QString::number(params.partition));
+    setItemInColumn(table, "part", params.partition ? SSolver::getPartitionAlgoString(params.partitionAlgorithm) : "0");
     setItemInColumn(table, "Field", ui->fileNameDisplay->text());
 
     //StarFilter Parameters
@@ -0,0 +1,323 @@
+/*  SyntheticStarField
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include "syntheticstarfield.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+#include "astrometry/starkd.h"
+#include "astrometry/sip-utils.h"
+}
+
+namespace
+{
+
+const double PI = 3.14159265358979323846;
+
+// This struct contains a star from the index that falls in the field
+struct FieldStar
+{
+    double x, y;        // The position in the image, starting from 0
+    double ra, dec;
+    double mag;
+};
+
+//The numbers are drawn straight from the generator since the std distributions differ between platforms
+class NoiseGenerator
+{
+    public:
+        explicit NoiseGenerator(quint32 seed) : m_Generator(seed) {}
+        double uniform()
+        {
+            return (m_Generator() + 0.5) / 4294967296.0;
+        }
+        double gaussian()
+        {
+            return std::sqrt(-2.0 * std::log(uniform())) * std::cos(2.0 * PI * uniform());
+        }
+    private:
+        std::mt19937 m_Generator;
+};
+
+}  // namespace
+
+bool SyntheticStarField::fieldForIndex(const QString &indexFile, quint32 seed, Settings &settings)
+{
+    index_t *index = index_load(indexFile.toUtf8().constData(), INDEX_ONLY_LOAD_METADATA, NULL);
+    if(!index)
+        return false;
+    double scaleUpper = index->index_scale_upper;
+    index_free(index);
+
+    startree_t *starkd = startree_open(indexFile.toUtf8().constData());
+    if(!starkd)
+        return false;
+    NoiseGenerator generator(seed);
+    int starCount = startree_N(starkd);
+    double ra = 0, dec = 0;
+    bool found = starCount > 0 && startree_get_radec(starkd, qMin(starCount - 1, (int)(generator.uniform() * starCount)), &ra, &dec) == 0;
+    startree_close(starkd);
+    if(!found)
+        return false;
+
+    //The diagonal of the field is twice the largest quads of the index, so the biggest quads fit in the field
+    settings.ra = ra;
+    settings.dec = dec;
+    settings.pixelScale = 2 * scaleUpper / std::hypot(settings.width, settings.height);
+    settings.orientation = generator.uniform() * 360.0 - 180.0;
+    settings.parity = generator.uniform() < 0.5 ? FITSImage::POSITIVE : FITSImage::NEGATIVE;
+    settings.seed = seed;
+    return true;
+}
+
+void SyntheticStarField::makeWCS(const Settings &settings)
+{
+    tan_t tan;
+    memset(&tan, 0, sizeof(tan_t));
+    tan.crval[0] = settings.ra;
+    tan.crval[1] = settings.dec;
+    //FITS pixel coordinates start from 1, so this is the center of the image
+    tan.crpix[0] = settings.width / 2.0 + 0.5;
+    tan.crpix[1] = settings.height / 2.0 + 0.5;
+    tan.imagew = settings.width;
+    tan.imageh = settings.height;
+
+    //This CD matrix gives back the orientation and parity with sip_get_orientation and sip_det_cd
+    double scale = settings.pixelScale / 3600.0;
+    double angle = settings.orientation * PI / 180.0;
+    if(settings.parity == FITSImage::POSITIVE)
+    {
+        tan.cd[0][0] = -scale * cos(angle);
+        tan.cd[0][1] = scale * sin(angle);
+        tan.cd[1][0] = scale * sin(angle);
+        tan.cd[1][1] = scale * cos(angle);
+    }
+    else
+    {
+        tan.cd[0][0] = scale * cos(angle);
+        tan.cd[0][1] = scale * sin(angle);
+        tan.cd[1][0] = -scale * sin(angle);
+        tan.cd[1][1] = scale * cos(angle);
+    }
+    sip_wrap_tan(&tan, &m_WCS);
+
+    if(settings.radialDistortion != 0)
+    {
+        //u' = u (1 + k r^2) and v' = v (1 + k r^2), scaled so the corners move by radialDistortion
+        double cornerRadius2 = (settings.width * settings.width + settings.height * settings.height) / 4.0;
+        double k = settings.radialDistortion / cornerRadius2;
+        m_WCS.a_order = 3;
+        m_WCS.b_order = 3;
+        m_WCS.a[3][0] = k;
+        m_WCS.a[1][2] = k;
+        m_WCS.b[2][1] = k;
+        m_WCS.b[0][3] = k;
+        sip_ensure_inverse_polynomials(&m_WCS);
+    }
+}
+
+bool SyntheticStarField::render(const QString &indexFile, const Settings &settings)
+{
+    if(settings.width <= 0 || settings.height <= 0 || settings.pixelScale <= 0 || settings.fwhm <= 0)
+        return false;
+    if(settings.dataType != TBYTE && settings.dataType != TUSHORT && settings.dataType != TFLOAT)
+        return false;
+
+    startree_t *starkd = startree_open(indexFile.toUtf8().constData());
+    if(!starkd)
+        return false;
+
+    makeWCS(settings);
+
+    //The search radius is a little bigger than the field so stars moved in by the distortion are found too
+    double radius = std::hypot(settings.width, settings.height) / 2.0 * settings.pixelScale / 3600.0;
+    radius *= 1.1 + std::fabs(settings.radialDistortion);
+    double *radec = nullptr;
+    int *inds = nullptr;
+    int count = 0;
+    startree_search_for_radec(starkd, settings.ra, settings.dec, radius, nullptr, &radec, &inds, &count);
+
+    //The magnitudes come from the tag-along table when the index has them.
+    //Otherwise the stars are ranked by sweep, which is how the index was cut from brightest to faintest.
+    double *mags = nullptr;
+    if(startree_has_tagalong(starkd))
+    {
+        for(int i = 0; i < startree_get_tagalong_N_columns(starkd); i++)
+        {
+            if(QString(startree_get_tagalong_column_name(starkd, i)).compare("mag", Qt::CaseInsensitive) == 0)
+            {
+                mags = startree_get_data_column(starkd, "mag", inds, count);
+                break;
+            }
+        }
+    }
+
+    QVector<FieldStar> fieldStars;
+    QVector<QPair<int, int>> ranks;
+    for(int i = 0; i < count; i++)
+    {
+        double px, py;
+        if(!sip_radec2pixelxy(&m_WCS, radec[2 * i], radec[2 * i + 1], &px, &py))
+            continue;
+        FieldStar star;
+        star.x = px - 1;
+        star.y = py - 1;
+        if(star.x < 0 || star.y < 0 || star.x >= settings.width || star.y >= settings.height)
+            continue;
+        star.ra = radec[2 * i];
+        star.dec = radec[2 * i + 1];
+        star.mag = mags ? mags[i] : 0;
+        if(!mags)
+            ranks.append(qMakePair(qMax(0, startree_get_sweep(starkd, inds[i])), inds[i]));
+        fieldStars.append(star);
+    }
+    if(!mags)
+    {
+        QVector<int> order(fieldStars.count());
+        for(int i = 0; i < order.count(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&ranks](int a, int b)
+        {
+            return ranks.at(a) < ranks.at(b);
+        });
+        //A flux that falls off as 1/rank, like the number counts of stars
+        for(int rank = 0; rank < order.count(); rank++)
+            fieldStars[order.at(rank)].mag = 2.5 * log10(rank + 1.0);
+    }
+    std::stable_sort(fieldStars.begin(), fieldStars.end(), [](const FieldStar & a, const FieldStar & b)
+    {
+        return a.mag < b.mag;
+    });
+    if(fieldStars.count() > settings.maxStars)
+        fieldStars.resize(qMax(0, settings.maxStars));
+
+    if(mags)
+        startree_free_data_column(starkd, mags);
+    free(radec);
+    free(inds);
+    startree_close(starkd);
+
+    //Draw the stars on the background
+    const double sigma = settings.fwhm / (2.0 * sqrt(2.0 * log(2.0)));
+    const double brightest = fieldStars.isEmpty() ? 0 : fieldStars.first().mag;
+    QVector<float> pixels(settings.width * settings.height, settings.background);
+    m_Stars.clear();
+    for(auto &fieldStar : fieldStars)
+    {
+        double peak = settings.peak * pow(10.0, -0.4 * (fieldStar.mag - brightest));
+        //The PSF is drawn out to where it drops below a tenth of an ADU
+        int halfWidth = (int)ceil(sigma * sqrt(2.0 * log(qMax(1.0, peak * 10.0))));
+        int x0 = qMax(0, (int)fieldStar.x - halfWidth), x1 = qMin(settings.width - 1, (int)fieldStar.x + halfWidth);
+        int y0 = qMax(0, (int)fieldStar.y - halfWidth), y1 = qMin(settings.height - 1, (int)fieldStar.y + halfWidth);
+        for(int y = y0; y <= y1; y++)
+        {
+            double dy2 = (y - fieldStar.y) * (y - fieldStar.y);
+            for(int x = x0; x <= x1; x++)
+            {
+                double dx2 = (x - fieldStar.x) * (x - fieldStar.x);
+                pixels[y * settings.width + x] += peak * exp(-(dx2 + dy2) / (2 * sigma * sigma));
+            }
+        }
+
+        FITSImage::Star star;
+        star.x = fieldStar.x;
+        star.y = fieldStar.y;
+        star.mag = fieldStar.mag;
+        star.flux = peak * 2 * PI * sigma * sigma;
+        star.peak = peak;
+        star.HFR = settings.fwhm / 2;
+        star.a = sigma;
+        star.b = sigma;
+        star.theta = 0;
+        star.ra = fieldStar.ra;
+        star.dec = fieldStar.dec;
+        star.numPixels = (x1 - x0 + 1) * (y1 - y0 + 1);
+        m_Stars.append(star);
+    }
+
+    //Add the shot noise and the read noise, then convert to the requested data type
+    NoiseGenerator noise(settings.seed);
+    double maxValue = settings.dataType == TBYTE ? 255 : settings.dataType == TUSHORT ? 65535 : HUGE_VAL;
+    double minValue = settings.dataType == TFLOAT ? -HUGE_VAL : 0;
+    for(auto &pixel : pixels)
+    {
+        double variance = settings.readNoise * settings.readNoise;
+        if(settings.gain > 0)
+            variance += qMax(0.0f, pixel) / settings.gain;
+        double value = pixel + sqrt(variance) * noise.gaussian();
+        if(settings.dataType != TFLOAT)
+            value = round(value);
+        pixel = qBound(minValue, value, maxValue);
+    }
+
+    const int samples = settings.width * settings.height;
+    m_Stats = FITSImage::Statistic();
+    m_Stats.width = settings.width;
+    m_Stats.height = settings.height;
+    m_Stats.channels = 1;
+    m_Stats.dataType = settings.dataType;
+    m_Stats.bytesPerPixel = settings.dataType == TBYTE ? sizeof(uint8_t) : settings.dataType == TUSHORT ? sizeof(uint16_t) : sizeof(float);
+    m_Stats.samples_per_channel = samples;
+    m_Stats.size = samples * m_Stats.bytesPerPixel;
+    m_ImageBuffer.resize(m_Stats.size);
+    for(int i = 0; i < samples; i++)
+    {
+        if(settings.dataType == TBYTE)
+            m_ImageBuffer[i] = (uint8_t)pixels.at(i);
+        else if(settings.dataType == TUSHORT)
+            reinterpret_cast<uint16_t *>(m_ImageBuffer.data())[i] = (uint16_t)pixels.at(i);
+        else
+            reinterpret_cast<float *>(m_ImageBuffer.data())[i] = pixels.at(i);
+    }
+
+    double sum = 0, sum2 = 0;
+    m_Stats.min[0] = HUGE_VAL;
+    m_Stats.max[0] = -HUGE_VAL;
+    for(auto &pixel : pixels)
+    {
+        m_Stats.min[0] = qMin(m_Stats.min[0], (double)pixel);
+        m_Stats.max[0] = qMax(m_Stats.max[0], (double)pixel);
+        sum += pixel;
+        sum2 += (double)pixel * pixel;
+    }
+    m_Stats.mean[0] = sum / samples;
+    m_Stats.stddev[0] = sqrt(qMax(0.0, sum2 / samples - m_Stats.mean[0] * m_Stats.mean[0]));
+    std::nth_element(pixels.begin(), pixels.begin() + samples / 2, pixels.end());
+    m_Stats.median[0] = pixels.at(samples / 2);
+
+    //The true solution, worked out from the WCS the same way the internal solver does it
+    char *fieldUnits;
+    double fieldWidth, fieldHeight;
+    sip_get_radec_center(&m_WCS, &m_Solution.ra, &m_Solution.dec);
+    sip_get_field_size(&m_WCS, &fieldWidth, &fieldHeight, &fieldUnits);
+    if(strcmp(fieldUnits, "degrees") == 0)
+    {
+        fieldWidth *= 60;
+        fieldHeight *= 60;
+    }
+    if(strcmp(fieldUnits, "arcseconds") == 0)
+    {
+        fieldWidth /= 60;
+        fieldHeight /= 60;
+    }
+    m_Solution.fieldWidth = fieldWidth;
+    m_Solution.fieldHeight = fieldHeight;
+    m_Solution.orientation = sip_get_orientation(&m_WCS);
+    m_Solution.pixscale = sip_pixel_scale(&m_WCS);
+    m_Solution.parity = sip_det_cd(&m_WCS) < 0 ? FITSImage::POSITIVE : FITSImage::NEGATIVE;
+    m_Solution.raError = 0;
+    m_Solution.decError = 0;
+    return true;
+}
@@ -0,0 +1,131 @@
+/*  SyntheticStarField
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "structuredefinitions.h"
+
+//CFitsio Includes
+#include "fitsio.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/sip.h"
+}
+
+/**
+ * @brief The SyntheticStarField class renders a star field image from the stars in an astrometry index file.
+ * The stars are projected with a TAN-SIP WCS built from the settings, drawn with a gaussian PSF and the noise is
+ * drawn from a seeded generator, so the same settings always make the same image on every machine.
+ * Since the WCS is known, the image comes with its true solution and star positions, so solves can be checked without
+ * real images.  The buffer and statistics can be given straight to StellarSolver::loadNewImageBuffer.
+ */
+class SyntheticStarField
+{
+    public:
+        // This struct contains everything needed to render a field
+        struct Settings
+        {
+            double ra = 0;                  // The Right Ascension of the center of the field in degrees
+            double dec = 0;                 // The Declination of the center of the field in degrees
+            double pixelScale = 2.0;        // The pixel scale in arcseconds per pixel
+            double orientation = 0;         // The orientation angle of the image from North in degrees, as in FITSImage::Solution
+            FITSImage::Parity parity = FITSImage::POSITIVE; // Whether the image is flipped
+            int width = 1024;               // The width of the image in pixels
+            int height = 768;               // The height of the image in pixels
+            double fwhm = 3.0;              // The full width at half maximum of the PSF in pixels
+            double background = 1000;       // The background level in ADU
+            double readNoise = 10;          // The standard deviation of the read noise in ADU
+            double gain = 1.0;              // Electrons per ADU for the shot noise, 0 means no shot noise
+            double peak = 30000;            // The peak value in ADU of the brightest star, above the background
+            int maxStars = 500;             // The number of the brightest stars in the field to draw
+            double radialDistortion = 0;    // How far the corners are moved outwards by the SIP distortion, as a fraction of their distance from the center
+            uint32_t dataType = TUSHORT;    // TBYTE, TUSHORT or TFLOAT
+            quint32 seed = 1;               // The seed for the noise
+        };
+
+        /**
+         * @brief render makes the image of the field
+         * @param indexFile is the astrometry index file whose star kd-tree supplies the stars
+         * @param settings describe the field, the PSF and the noise
+         * @return false if the index file could not be read or the settings are not valid
+         */
+        bool render(const QString &indexFile, const Settings &settings);
+
+        /**
+         * @brief fieldForIndex picks a field the index can solve, centered on one of its stars and with a pixel scale
+         * that fits its largest quads in the field.  The orientation and parity are picked too.
+         * @param indexFile is the astrometry index file
+         * @param seed picks the field, the same seed always picks the same field
+         * @param settings gets the position, scale, orientation, parity and seed, the image size must already be set
+         * @return false if the index file could not be read
+         */
+        static bool fieldForIndex(const QString &indexFile, quint32 seed, Settings &settings);
+
+        /**
+         * @brief getImageBuffer gets the rendered image
+         * @return The image buffer, it stays valid until the next render
+         */
+        const uint8_t *getImageBuffer() const
+        {
+            return m_ImageBuffer.constData();
+        }
+
+        /**
+         * @brief getStats gets the image statistics that go with the buffer
+         * @return The statistics
+         */
+        const FITSImage::Statistic &getStats() const
+        {
+            return m_Stats;
+        }
+
+        /**
+         * @brief getSolution gets the true solution of the field, computed like the internal solver reports it
+         * @return The solution
+         */
+        const FITSImage::Solution &getSolution() const
+        {
+            return m_Solution;
+        }
+
+        /**
+         * @brief getWCS gets the TAN-SIP WCS used to render the field
+         * @return The WCS
+         */
+        const sip_t &getWCS() const
+        {
+            return m_WCS;
+        }
+
+        /**
+         * @brief getStars gets the stars that were drawn with their true positions, brightest first
+         * @return The stars
+         */
+        const QList<FITSImage::Star> &getStars() const
+        {
+            return m_Stars;
+        }
+
+    private:
+        QVector<uint8_t> m_ImageBuffer;     // The rendered image
+        FITSImage::Statistic m_Stats;       // The statistics of the rendered image
+        FITSImage::Solution m_Solution {};  // The true solution of the field
+        sip_t m_WCS {};                     // The WCS the stars were projected with
+        QList<FITSImage::Star> m_Stars;     // The stars that were drawn
+
+        /**
+         * @brief makeWCS builds the TAN-SIP WCS from the settings
+         * @param settings describe the field
+         */
+        void makeWCS(const Settings &settings);
+};